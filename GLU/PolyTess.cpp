@@ -5,10 +5,10 @@ namespace RA {
     class Tess : public ITess {
     private:
         GLUtesselator* m_tess;
-        const std::function<void(TessMode type)>& m_begin;
-        const std::function<void(int idx)>& m_vertex;
-        const std::function<void()>& m_end;
-        const std::function<int(const glm::dvec2& new_pos, const glm::vec4& indices, const glm::vec4& weight)>& m_lerp;
+        std::function<void(TessMode type)> m_begin;
+        std::function<void(int idx)> m_vertex;
+        std::function<void()> m_end;
+        std::function<int(const glm::dvec2& new_pos, const glm::vec4& indices, const glm::vec4& weight)> m_lerp;
     public:
         void StartPolygon() override {
             gluTessBeginPolygon(m_tess, this);
@@ -48,7 +48,8 @@ namespace RA {
              const std::function<void(int idx)>& vertex,
              const std::function<void()>& end,
              const std::function<int(const glm::dvec2& new_pos, const glm::vec4& indices, const glm::vec4& weight)>& lerp,
-             bool triangulate
+             bool triangulate,
+             TessWinding winding
         );
         ~Tess() override {
             gluDeleteTess(m_tess);
@@ -60,10 +61,11 @@ namespace RA {
         const std::function<void(int idx)>& vertex,
         const std::function<void()>& end,
         const std::function<int(const glm::dvec2& new_pos, const glm::vec4& indices, const glm::vec4& weight)>& lerp,
-        bool triangulate
+        bool triangulate,
+        TessWinding winding
     )
     {
-        return std::make_unique<Tess>(begin, vertex, end, lerp, triangulate);
+        return std::make_unique<Tess>(begin, vertex, end, lerp, triangulate, winding);
     }
 
     void cbTess_Vertex(intptr_t idx, Tess* obj) {
@@ -97,7 +99,8 @@ namespace RA {
         const std::function<void(int idx)>& vertex,
         const std::function<void()>& end,
         const std::function<int(const glm::dvec2& new_pos, const glm::vec4& indices, const glm::vec4& weight)>& lerp,
-        bool triangulate) :
+        bool triangulate,
+        TessWinding winding) :
         m_begin(begin),
         m_vertex(vertex),
         m_end(end),
@@ -111,7 +114,9 @@ namespace RA {
         gluTessCallback(m_tess, GLU_TESS_COMBINE_DATA, (_GLUfuncptr*)&cbTess_Combine);
         gluTessCallback(m_tess, GLU_TESS_EDGE_FLAG_DATA, (_GLUfuncptr*)&cbTess_EdgeFlag);
 
-        gluTessProperty(m_tess, GLU_TESS_WINDING_RULE, GLU_TESS_WINDING_ODD);
+        gluTessProperty(m_tess, GLU_TESS_WINDING_RULE, (winding == TessWinding::NonZero) ? GLU_TESS_WINDING_NONZERO : GLU_TESS_WINDING_ODD);
+        //all input is planar, so the normal is known and doesn't have to be computed for every polygon
+        gluTessNormal(m_tess, 0, 0, 1);
         if (triangulate)
             gluTessProperty(m_tess, GLU_TESS_BOUNDARY_ONLY, GL_FALSE);
         else
@@ -5,6 +5,7 @@
 namespace RA {
 
     enum class TessMode { TriList, TriStrip, TriFan, LineLoop };
+    enum class TessWinding { Odd, NonZero };
 
     class ITess {
     private:
@@ -22,7 +23,8 @@ namespace RA {
         const std::function<void(int idx)>& vertex,
         const std::function<void()>& end,
         const std::function<int(const glm::dvec2& new_pos, const glm::vec4& indices, const glm::vec4& weight)>& lerp,
-        bool triangulate
+        bool triangulate,
+        TessWinding winding = TessWinding::Odd
     );
 
     template<typename T>
@@ -53,7 +55,9 @@ namespace RA {
     struct Poly {
         std::vector<Contour<T>> contours;
 
-        Tris<T> Trinagulate(const std::function<T(const glm::dvec2& new_pos, const T& v0, const T& v1, const T& v2, const T& v3, const glm::vec4& weights)>& vert_lerp) {
+        //Odd orients contours by the hole flag, NonZero keeps the contour orientation as is
+        Tris<T> Trinagulate(const std::function<T(const glm::dvec2& new_pos, const T& v0, const T& v1, const T& v2, const T& v3, const glm::vec4& weights)>& vert_lerp,
+                            TessWinding winding = TessWinding::Odd) {
             std::vector<T> verts;
             std::vector<int32_t> inds;
             
@@ -61,7 +65,7 @@ namespace RA {
             std::vector<int32_t> tmp_inds;
 
             auto cb_lerp = [&verts, &vert_lerp](const glm::dvec2& new_pos, const glm::vec4& indices, const glm::vec4& weight)->int {
-                verts.push_back(vert_lerp(new_pos, verts[indices.x], verts[indices.y], verts[indices.z], verts[indices.w], weight));
+                verts.push_back(vert_lerp(new_pos, verts[int(indices.x)], verts[int(indices.y)], verts[int(indices.z)], verts[int(indices.w)], weight));
                 return int(verts.size()) - 1;
             };
             auto cb_begin = [&curr_mode, &tmp_inds](TessMode type) {
@@ -71,7 +75,7 @@ namespace RA {
             auto cb_vertex = [&tmp_inds](int idx) {
                 tmp_inds.push_back(idx);
             };
-            auto cb_end = [&verts, &inds, &tmp_inds]() {
+            auto cb_end = [&curr_mode, &inds, &tmp_inds]() {
                 switch (curr_mode) {
                     case TessMode::TriList: {
                         for (const auto& i : tmp_inds)
@@ -79,8 +83,8 @@ namespace RA {
                         return;
                     }
                     case TessMode::TriStrip: {
-                        int i0 = tmp_inds[0];
-                        int i1 = tmp_inds[1];
+                        int i0 = 0;
+                        int i1 = 1;
                         int flip = 0;
                         for (int i = 2; i < tmp_inds.size(); i++) {
                             if (flip) {
@@ -100,8 +104,8 @@ namespace RA {
                         return;
                     }
                     case TessMode::TriFan: {
-                        int i0 = tmp_inds[0];
-                        int iprev = tmp_inds[1];
+                        int i0 = 0;
+                        int iprev = 1;
                         for (int i = 2; i < tmp_inds.size(); i++) {
                             inds.push_back(tmp_inds[i0]);
                             inds.push_back(tmp_inds[iprev]);
@@ -110,15 +114,17 @@ namespace RA {
                         }
                         return;
                     }
+                    default:
+                        return;
                 }
             };
             
-            ITessPtr tess = Create_tesselator(cb_begin, cb_vertex, cb_end, cb_lerp, true);
+            ITessPtr tess = Create_tesselator(cb_begin, cb_vertex, cb_end, cb_lerp, true, winding);
 
             tess->StartPolygon();
             for (const Contour<T>& cntr : contours) {
                 tess->StartContour();
-                bool reverse = (cntr.SignedArea() < 0) ^ cntr.hole;
+                bool reverse = (winding == TessWinding::Odd) && ((cntr.SignedArea() < 0) ^ cntr.hole);
                 if (reverse) {
                     for (auto it = cntr.pts.rbegin(); it != cntr.pts.rend(); ++it) {
                         verts.push_back(*it);
@@ -158,6 +158,7 @@ namespace RA {
         case LayoutType::Word: return 2 * num_fields * array_size;
         case LayoutType::UInt: return 4 * num_fields * array_size;
         case LayoutType::Float: return 4 * num_fields * array_size;
+        case LayoutType::Half: return 2 * num_fields * array_size;
         default:
             assert(false);
         }
@@ -226,6 +227,8 @@ namespace RA {
         m_r_desc.MultisampleEnable = false;
         m_r_desc.AntialiasedLineEnable = false;
         m_r_state = nullptr;
+        m_scissor = { 0, 0, 0, 0 };
+        m_scissor_valid = false;
 
         m_stencil_ref = 0xff;
         m_d_desc.DepthEnable = false;
@@ -275,6 +278,9 @@ namespace RA {
         m_d_state = last.m_d_state;
         m_b_state = last.m_b_state;
         m_stencil_ref = last.m_stencil_ref;
+        m_scissor = last.m_scissor;
+        m_scissor_valid = false;
+        m_states.pop_back();
         if (m_r_state)
             m_deviceContext->RSSetState(m_r_state.Get());
         if (m_d_state)
@@ -288,6 +294,10 @@ namespace RA {
             CheckD3DErr(m_device->CreateRasterizerState(&m_r_desc, &m_r_state));
             m_deviceContext->RSSetState(m_r_state.Get());
         }
+        if (!m_scissor_valid) {
+            if (m_r_desc.ScissorEnable) m_deviceContext->RSSetScissorRects(1, &m_scissor);
+            m_scissor_valid = true;
+        }
         if (!m_d_state) {
             CheckD3DErr(m_device->CreateDepthStencilState(&m_d_desc, &m_d_state));
             m_deviceContext->OMSetDepthStencilState(m_d_state.Get(), m_stencil_ref);
@@ -317,6 +327,18 @@ namespace RA {
             m_r_state = nullptr;
         }
     }
+    void States::SetScissor(bool enable, const glm::ivec4& rect)
+    {
+        if (bool(m_r_desc.ScissorEnable) != enable) {
+            m_r_desc.ScissorEnable = enable;
+            m_r_state = nullptr;
+            m_scissor_valid = false;
+        }
+        if (enable && ((m_scissor.left != rect.x) || (m_scissor.top != rect.y) || (m_scissor.right != rect.z) || (m_scissor.bottom != rect.w))) {
+            m_scissor = { LONG(rect.x), LONG(rect.y), LONG(rect.z), LONG(rect.w) };
+            m_scissor_valid = false;
+        }
+    }
     void States::SetDepthEnable(bool enable)
     {
         if (bool(m_d_desc.DepthEnable) != enable) {
@@ -564,6 +586,19 @@ namespace RA {
     {
         return m_wnd;
     }
+    const DeviceStats& Device::Stats() const
+    {
+        return m_stats;
+    }
+    void Device::ResetStats()
+    {
+        m_stats = DeviceStats();
+    }
+    void Device::CountUpload(size_t bytes)
+    {
+        m_stats.uploads++;
+        m_stats.upload_bytes += bytes;
+    }
     FrameBufferPtr Device::SetFrameBuffer(const FrameBufferPtr& fbo, bool update_viewport)
     {
         FrameBufferPtr prev_fbo = m_active_fbo.lock();
@@ -677,6 +712,11 @@ namespace RA {
         SetFrameBuffer(nullptr);
         m_swapChain->Present(1, 0);
         m_active_program = nullptr;
+        m_frame_index++;
+    }
+    uint64_t Device::FrameIndex() const
+    {
+        return m_frame_index;
     }
     DevChild::DevChild(const DevicePtr& device) : m_device(device)
     {
@@ -871,6 +911,7 @@ namespace RA {
         box.front = 0;
         box.back = 1;
         m_device->m_deviceContext->UpdateSubresource(m_handle.Get(), res_idx, &box, data, PixelsSize(m_fmt) * size.x, PixelsSize(m_fmt) * size.x * size.y);
+        m_device->CountUpload(size_t(PixelsSize(m_fmt)) * size.x * size.y);
     }
     void Texture2D::GenerateMips()
     {
@@ -1354,6 +1395,7 @@ namespace RA {
         if (index_count < 0) index_count = m_selected_ibo->IndexCount();
         if (instance_count < 0) instance_count = m_selected_instances ? m_selected_instances->VertexCount() : 0;
 
+        m_device->m_stats.draw_calls++;
         if (instance_count) {
             m_device->m_deviceContext->DrawIndexedInstanced(index_count, instance_count, index_start, base_vertex, base_instance);
         }
@@ -1369,6 +1411,7 @@ namespace RA {
         if (vert_count < 0) vert_count = m_selected_vbo->VertexCount();
         if (instance_count < 0) instance_count = m_selected_instances ? m_selected_instances->VertexCount() : 0;
 
+        m_device->m_stats.draw_calls++;
         if (instance_count) {
             m_device->m_deviceContext->DrawInstanced(vert_count, instance_count, vert_start, base_instance);
         }
@@ -1435,6 +1478,7 @@ namespace RA {
     {
         m_layout = layout;
         m_vert_count = vertex_count;
+        m_dynamic = false;
 
         if (!m_vert_count) {
             m_handle = nullptr;
@@ -1455,6 +1499,7 @@ namespace RA {
             dxdata.SysMemPitch = desc.ByteWidth;
             dxdata.SysMemSlicePitch = desc.ByteWidth;
             CheckD3DErr( m_device->m_device->CreateBuffer(&desc, &dxdata, &m_handle) );
+            m_device->CountUpload(desc.ByteWidth);
         }
         else {
             CheckD3DErr( m_device->m_device->CreateBuffer(&desc, nullptr, &m_handle) );
@@ -1463,6 +1508,7 @@ namespace RA {
     void VertexBuffer::SetSubData(int start_vertex, int num_vertices, const void* data)
     {
         assert(m_handle);
+        assert(!m_dynamic);
         D3D11_BOX box;
         box.left = start_vertex * m_layout->stride;
         box.top = 0;
@@ -1471,11 +1517,46 @@ namespace RA {
         box.front = 0;
         box.back = 1;
         m_device->m_deviceContext->UpdateSubresource(m_handle.Get(), 0, &box, data, 0, 0);
+        m_device->CountUpload(box.right - box.left);
+    }
+    void VertexBuffer::SetStateDynamic(const Layout* layout, int vertex_count)
+    {
+        m_layout = layout;
+        m_vert_count = vertex_count;
+        m_dynamic = true;
+
+        if (!m_vert_count) {
+            m_handle = nullptr;
+            return;
+        }
+
+        D3D11_BUFFER_DESC desc;
+        desc.ByteWidth = vertex_count * m_layout->stride;
+        desc.Usage = D3D11_USAGE_DYNAMIC;
+        desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        desc.MiscFlags = 0;
+        desc.StructureByteStride = m_layout->stride;
+        CheckD3DErr( m_device->m_device->CreateBuffer(&desc, nullptr, &m_handle) );
+    }
+    void* VertexBuffer::Map(int start_vertex, int num_vertices, bool discard)
+    {
+        assert(m_handle && m_dynamic);
+        assert(start_vertex + num_vertices <= m_vert_count);
+        D3D11_MAPPED_SUBRESOURCE map_res;
+        CheckD3DErr( m_device->m_deviceContext->Map(m_handle.Get(), 0, discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &map_res) );
+        m_device->CountUpload(size_t(num_vertices) * m_layout->stride);
+        return (char*)map_res.pData + size_t(start_vertex) * m_layout->stride;
+    }
+    void VertexBuffer::Unmap()
+    {
+        m_device->m_deviceContext->Unmap(m_handle.Get(), 0);
     }
     VertexBuffer::VertexBuffer(const DevicePtr& device) : DevChild(device)
     {
         m_layout = nullptr;
         m_vert_count = 0;
+        m_dynamic = false;
     }
     ComPtr<ID3D11ShaderResourceView> StructuredBuffer::GetShaderResourceView()
     {
@@ -1523,6 +1604,7 @@ namespace RA {
         m_vert_count = vertex_count;
         m_UAV_access = UAV;
         m_UAV_with_counter = UAV_with_counter;
+        m_dynamic = false;
 
         D3D11_BUFFER_DESC desc;
         desc.ByteWidth = glm::max(vertex_count, 1) * m_stride;
@@ -1540,6 +1622,7 @@ namespace RA {
             dxdata.SysMemPitch = desc.ByteWidth;
             dxdata.SysMemSlicePitch = desc.ByteWidth;
             CheckD3DErr(m_device->m_device->CreateBuffer(&desc, &dxdata, &m_handle));
+            m_device->CountUpload(desc.ByteWidth);
         }
         else {
             CheckD3DErr(m_device->m_device->CreateBuffer(&desc, nullptr, &m_handle));
@@ -1548,6 +1631,7 @@ namespace RA {
     void StructuredBuffer::SetSubData(int start_vertex, int num_vertices, const void* data)
     {
         assert(m_handle);
+        assert(!m_dynamic);
         if (num_vertices <= 0) return;
         D3D11_BOX box;
         box.left = start_vertex * m_stride;
@@ -1557,6 +1641,40 @@ namespace RA {
         box.front = 0;
         box.back = 1;
         m_device->m_deviceContext->UpdateSubresource(m_handle.Get(), 0, &box, data, 0, 0);
+        m_device->CountUpload(box.right - box.left);
+    }
+    void StructuredBuffer::SetStateDynamic(int stride, int vertex_count)
+    {
+        m_uav = nullptr;
+        m_srv = nullptr;
+
+        m_stride = stride;
+        m_vert_count = vertex_count;
+        m_UAV_access = false;
+        m_UAV_with_counter = false;
+        m_dynamic = true;
+
+        D3D11_BUFFER_DESC desc;
+        desc.ByteWidth = glm::max(vertex_count, 1) * m_stride;
+        desc.Usage = D3D11_USAGE_DYNAMIC;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+        desc.StructureByteStride = m_stride;
+        CheckD3DErr(m_device->m_device->CreateBuffer(&desc, nullptr, &m_handle));
+    }
+    void* StructuredBuffer::Map(int start_vertex, int num_vertices, bool discard)
+    {
+        assert(m_handle && m_dynamic);
+        assert(start_vertex + num_vertices <= m_vert_count);
+        D3D11_MAPPED_SUBRESOURCE map_res;
+        CheckD3DErr( m_device->m_deviceContext->Map(m_handle.Get(), 0, discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &map_res) );
+        m_device->CountUpload(size_t(num_vertices) * m_stride);
+        return (char*)map_res.pData + size_t(start_vertex) * m_stride;
+    }
+    void StructuredBuffer::Unmap()
+    {
+        m_device->m_deviceContext->Unmap(m_handle.Get(), 0);
     }
     void StructuredBuffer::ReadBack(void* data)
     {
@@ -1584,6 +1702,7 @@ namespace RA {
         m_vert_count = 0;
         m_UAV_access = false;
         m_UAV_with_counter = false;
+        m_dynamic = false;
     }
     int IndexBuffer::IndexCount()
     {
@@ -1607,6 +1726,7 @@ namespace RA {
             dxdata.SysMemPitch = desc.ByteWidth;
             dxdata.SysMemSlicePitch = desc.ByteWidth;
             CheckD3DErr(m_device->m_device->CreateBuffer(&desc, &dxdata, &m_handle));
+            m_device->CountUpload(desc.ByteWidth);
         }
         else {
             CheckD3DErr(m_device->m_device->CreateBuffer(&desc, nullptr, &m_handle));
@@ -1624,6 +1744,7 @@ namespace RA {
         box.front = 0;
         box.back = 1;
         m_device->m_deviceContext->UpdateSubresource(m_handle.Get(), 0, &box, data, 0, 0);
+        m_device->CountUpload(box.right - box.left);
     }
     IndexBuffer::IndexBuffer(const DevicePtr& device) : DevChild(device)
     {
@@ -1652,6 +1773,7 @@ namespace RA {
         CheckD3DErr( m_device->m_deviceContext->Map(m_handle.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &map_res) );
         memcpy(map_res.pData, m_data.data(), m_data.size());
         m_device->m_deviceContext->Unmap(m_handle.Get(), 0);
+        m_device->CountUpload(m_data.size());
     }
     const Layout* UniformBuffer::GetLayout() const
     {
@@ -1680,6 +1802,7 @@ namespace RA {
             dxdata.SysMemPitch = desc.ByteWidth;
             dxdata.SysMemSlicePitch = desc.ByteWidth;
             CheckD3DErr(m_device->m_device->CreateBuffer(&desc, &dxdata, &m_handle));
+            m_device->CountUpload(desc.ByteWidth);
         }
         else {
             CheckD3DErr(m_device->m_device->CreateBuffer(&desc, nullptr, &m_handle));
@@ -1763,6 +1886,14 @@ namespace RA {
             case 4: return DXGI_FORMAT_R32G32B32A32_FLOAT;
             }
         }
+        case LayoutType::Half: {
+            switch (l.num_fields) {
+            case 1: return DXGI_FORMAT_R16_FLOAT;
+            case 2: return DXGI_FORMAT_R16G16_FLOAT;
+            case 3: throw std::runtime_error("unsupported format"); //there is no 3 component half format
+            case 4: return DXGI_FORMAT_R16G16B16A16_FLOAT;
+            }
+        }
         default:
             throw std::runtime_error("unsupported format");
         }
@@ -14,6 +14,7 @@ namespace RA {
     }
     void BaseAtlas::ValidateAll()
     {
+        std::lock_guard<std::mutex> lock(m_mutex);
         if (!m_tex_valid) {
             m_tex_valid = true;
             ValidateTexture();
@@ -211,6 +212,7 @@ namespace RA {
     }
     AtlasSpritePtr Atlas::ObtainSprite(const fs::path& filename)
     {
+        std::lock_guard<std::mutex> lock(m_mutex);
         TexDataIntf* tex = TM()->Load(filename);        
         auto it = m_data.find(tex);
         if (it == m_data.end()) {
@@ -1,27 +1,115 @@
 #include "pch.h"
 #include "RCanvas.h"
 #include "RAdoptConsts.h"
+#include "GLU/PolyTess.h"
 
 namespace RA {
+    static const uint32_t cQuadIndices[6] = { 0, 1, 2, 2, 1, 3 };
+
+    static int Capacity(VertexBuffer* buf) { return buf->VertexCount(); }
+    static int Capacity(IndexBuffer* buf) { return buf->IndexCount(); }
+    template <typename T>
+    static void Reserve(VertexBuffer* buf, int count) { buf->SetState(T::Layout(), count, nullptr); }
+    template <typename T>
+    static void Reserve(IndexBuffer* buf, int count) { buf->SetState(count, nullptr); }
+
+    //buffer grows by powers of two and is never shrunk, so redrawing the same ui doesn't recreate it.
+    //uploaded mirrors buffer content, only the span that differs from it goes to the gpu
+    template <typename T, typename Buf>
+    static void UploadData(const std::shared_ptr<Buf>& buf, const std::vector<T>& data, std::vector<T>& uploaded)
+    {
+        int count = int(data.size());
+        if (!count) return;
+        if (Capacity(buf.get()) < count) {
+            Reserve<T>(buf.get(), glm::nextPowerOfTwo(count));
+            buf->SetSubData(0, count, data.data());
+            uploaded = data;
+            return;
+        }
+        int common = glm::min(count, int(uploaded.size()));
+        int first = 0;
+        while ((first < common) && (memcmp(&data[first], &uploaded[first], sizeof(T)) == 0)) first++;
+        int last = count;
+        if (count <= int(uploaded.size())) {
+            while ((last > first) && (memcmp(&data[last - 1], &uploaded[last - 1], sizeof(T)) == 0)) last--;
+        }
+        if (first == last) return;
+        buf->SetSubData(first, last - first, &data[first]);
+        if (int(uploaded.size()) < count) uploaded.resize(count, data[0]);
+        std::copy(data.begin() + first, data.begin() + last, uploaded.begin() + first);
+    }
     void Canvas::ValidateBuffers()
     {
         if (!m_text_buf_valid) {
-            m_text_buf->SetState(TextGlyphVertex3D::Layout(), int(m_text.size()), m_text.data());
+            UploadData(m_text_buf, m_text, m_text_uploaded);
             m_text_buf_valid = true;
         }
         if (!m_tris_buf_valid) {
-            m_tris_buf->SetState(TrisVertex::Layout(), int(m_tris.size()), m_tris.data());
+            UploadData(m_tris_buf, m_tris, m_tris_uploaded);
+            UploadData(m_tris_ibuf, m_tris_indices, m_tris_indices_uploaded);
             m_tris_buf_valid = true;
         }
         if (!m_lines_buf_valid) {
-            m_lines_buf->SetState(LineVertex::Layout(), int(m_lines.size()), m_lines.data());
+            UploadData(m_lines_buf, m_lines, m_lines_uploaded);
             m_lines_buf_valid = true;
         }
     }
-    void Canvas::PushBatch(BatchKind kind, int size)
+    static glm::AABR GlyphBounds(const glm::vec4& bounds2d, float valign, const TextGlyphVertex& v)
+    {
+        glm::vec2 pos = glm::mix(bounds2d.xy(), bounds2d.zw(), glm::vec2(v.halign, valign)) + v.pos;
+        return glm::AABR(pos - v.size * 0.5f, pos + v.size * 0.5f);
+    }
+    //trims glyph quad to clip together with its atlas rect, returns false if the glyph is completely outside
+    static bool ClipGlyph(TextGlyphVertex& v, const glm::AABR& glyph_bounds, const glm::AABR& clip)
+    {
+        if (!glyph_bounds.IsIntersects(clip)) return false;
+        glm::AABR b = glyph_bounds.Intersect(clip);
+        if ((b.min == glyph_bounds.min) && (b.max == glyph_bounds.max)) return true;
+        glm::vec2 t0 = (b.min - glyph_bounds.min) / v.size;
+        glm::vec2 t1 = (b.max - glyph_bounds.min) / v.size;
+        v.pos += b.Center() - glyph_bounds.Center();
+        v.size = b.Size();
+        v.sprite_xy += v.sprite_size * t0;
+        v.sprite_size *= t1 - t0;
+        return true;
+    }
+    //clamps monotonic grid lines xx to [lo, hi] and moves texture coords tt along, 
+    //returns false if the grid is completely outside
+    static bool ClipGrid(float* xx, float* tt, int n, float lo, float hi)
+    {
+        assert(n <= 4);
+        float xmin = glm::min(xx[0], xx[n - 1]);
+        float xmax = glm::max(xx[0], xx[n - 1]);
+        if ((xmax <= lo) || (xmin >= hi)) return false;
+        if ((xmin >= lo) && (xmax <= hi)) return true;
+        float new_xx[4];
+        float new_tt[4];
+        for (int i = 0; i < n; i++) {
+            new_xx[i] = glm::clamp(xx[i], lo, hi);
+            new_tt[i] = tt[i];
+            if (new_xx[i] == xx[i]) continue;
+            for (int j = 0; j + 1 < n; j++) {
+                float a = xx[j];
+                float b = xx[j + 1];
+                if ((a == b) || (new_xx[i] < glm::min(a, b)) || (new_xx[i] > glm::max(a, b))) continue;
+                new_tt[i] = glm::mix(tt[j], tt[j + 1], (new_xx[i] - a) / (b - a));
+                break;
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            xx[i] = new_xx[i];
+            tt[i] = new_tt[i];
+        }
+        return true;
+    }
+    void Canvas::PushBatch(BatchKind kind, int size, const glm::AABR& bounds, float pix_margin)
+    {
+        PushBatch(kind, size, bounds, pix_margin, m_clip_stack.size() ? m_clip_stack.back() : -1);
+    }
+    void Canvas::PushBatch(BatchKind kind, int size, const glm::AABR& bounds, float pix_margin, int clip)
     {
         BatchKind prev_batch = BatchKind::None;
-        if (m_batches.size()) {
+        if (m_batches.size() && (m_batches.back().clip == clip)) {
             prev_batch = m_batches.back().kind;
         }
         if (prev_batch != kind) {
@@ -33,7 +121,7 @@ namespace RA {
                 break;
             }
             case BatchKind::Tris: {
-                new_batch.ranges.x = int(m_tris.size()) - size;
+                new_batch.ranges.x = int(m_tris_indices.size()) - size;
                 break;
             }
             case BatchKind::Lines: {
@@ -44,13 +132,113 @@ namespace RA {
                 assert(false);
             }
             new_batch.ranges.y = size;
+            new_batch.bounds = bounds;
+            new_batch.pix_margin = pix_margin;
+            new_batch.clip = clip;
             m_batches.push_back(new_batch);
         }
         else {
-            m_batches.back().ranges.y += size;
+            Batch& batch = m_batches.back();
+            batch.ranges.y += size;
+            batch.bounds += bounds;
+            batch.pix_margin = glm::max(batch.pix_margin, pix_margin);
+        }
+    }
+    const std::vector<Batch>& Canvas::ReorderBatches(const glm::mat3& transform_2d)
+    {
+        //pixel margins are converted to canvas space with the smallest axis scale of transform_2d,
+        //one extra pixel covers hinting
+        float dpi_scale = (m_canvas_common_object) ? m_canvas_common_object->GetDPIScale() : 1.0f;
+        float scale = glm::min(glm::length(glm::vec2(transform_2d[0])), glm::length(glm::vec2(transform_2d[1])));
+        float pix_to_canvas = 1.0f / glm::max(scale, 0.0001f);
+
+        m_reordered_batches.clear();
+        int last_of_kind[4] = { -1, -1, -1, -1 };
+        for (const Batch& b : m_batches) {
+            glm::AABR bounds = b.bounds.Expand((b.pix_margin * dpi_scale + 1.0f) * pix_to_canvas);
+            int& last = last_of_kind[int(b.kind)];
+            //vertices of the same kind are stored in order, so b continues the last batch of its kind
+            bool can_merge = (last >= 0) && (m_reordered_batches[last].clip == b.clip);
+            for (int i = last + 1; can_merge && (i < int(m_reordered_batches.size())); i++) {
+                const Batch& other = m_reordered_batches[i];
+                if (bounds.IsIntersects(other.bounds.Expand((other.pix_margin * dpi_scale + 1.0f) * pix_to_canvas)))
+                    can_merge = false;
+            }
+            if (can_merge) {
+                Batch& batch = m_reordered_batches[last];
+                batch.ranges.y += b.ranges.y;
+                batch.bounds += b.bounds;
+                batch.pix_margin = glm::max(batch.pix_margin, b.pix_margin);
+            }
+            else {
+                last = int(m_reordered_batches.size());
+                m_reordered_batches.push_back(b);
+            }
+        }
+        return m_reordered_batches;
+    }
+    const glm::AABR* Canvas::ActiveClip() const
+    {
+        return m_clip_stack.size() ? &m_clips[m_clip_stack.back()] : nullptr;
+    }
+    glm::ivec4 Canvas::ScissorRect(CameraBase& camera, const glm::mat3& transform_2d, const glm::AABR& clip)
+    {
+        //same math as canvas shaders: pos3d is projected, 2d offsets are added in pixels divided by dpi scale
+        float dpi_scale = (m_canvas_common_object) ? m_canvas_common_object->GetDPIScale() : 1.0f;
+        glm::vec2 fb_size = glm::vec2(m_dev->ActiveFrameBuffer()->GetSize());
+        glm::vec4 proj = camera.ViewProj() * glm::vec4(m_pos, 1.0f);
+        if (proj.w <= 0) return glm::ivec4(0);
+        glm::vec2 origin = glm::vec2(proj.x / proj.w + 1.0f, 1.0f - proj.y / proj.w) * 0.5f * fb_size;
+        glm::AABR r = transform_2d * clip;
+        r.min = glm::clamp(origin + r.min / dpi_scale, glm::vec2(0.0f), fb_size);
+        r.max = glm::clamp(origin + r.max / dpi_scale, glm::vec2(0.0f), fb_size);
+        return glm::ivec4(glm::floor(r.min), glm::ceil(r.max));
+    }
+    uint32_t Canvas::PenSpriteIdx(const AtlasSprite* sprite)
+    {
+        uint32_t res = sprite ? uint32_t(sprite->Index()) : cNoSprite;
+        if (m_pen.GetHinting()) res |= cHintingBit;
+        return res;
+    }
+    void Canvas::PushTris(const TrisVertex* v, int vert_count, const uint32_t* indices, int ind_count)
+    {
+        uint32_t base = uint32_t(m_tris.size());
+        m_tris.insert(m_tris.end(), v, v + vert_count);
+        for (int i = 0; i < ind_count; i++) {
+            m_tris_indices.push_back(base + indices[i]);
+        }
+        m_tris_buf_valid = false;
+        glm::AABR bounds;
+        for (int i = 0; i < vert_count; i++) {
+            bounds += v[i].coord;
+        }
+        PushBatch(BatchKind::Tris, ind_count, bounds);
+    }
+    void Canvas::PushTessellation(const PathTessCache::Tessellation& tess, const glm::vec2& offset)
+    {
+        if (tess.indices.empty()) return;
+        glm::AABR bounds(tess.bounds.min + offset, tess.bounds.max + offset);
+        if (const glm::AABR* clip = ActiveClip()) {
+            if (!clip->IsIntersects(bounds)) return;
+        }
+        TrisVertex v;
+        v.texcoord = glm::vec2(0, 0);
+        v.color = glm::packUnorm4x8(m_pen.GetColor());
+        v.sprite_idx = PenSpriteIdx(nullptr);
+        uint32_t base = uint32_t(m_tris.size());
+        m_tris.reserve(m_tris.size() + tess.vertices.size());
+        for (const glm::vec2& pt : tess.vertices) {
+            v.coord = pt + offset;
+            m_tris.push_back(v);
         }
+        m_tris_indices.reserve(m_tris_indices.size() + tess.indices.size());
+        for (uint32_t idx : tess.indices) {
+            m_tris_indices.push_back(base + idx);
+        }
+        m_tris_buf_valid = false;
+        PushBatch(BatchKind::Tris, int(tess.indices.size()), bounds);
     }
-    void Canvas::InitProgram(BatchKind kind, CameraBase& camera, const glm::mat3& transform_2d)
+    void Canvas::InitProgram(BatchKind kind, CameraBase& camera, const glm::mat3& transform_2d, const VertexBufferPtr& buf, const IndexBufferPtr& ibuf)
     {
         if (m_prog_was_inited[int(kind)]) return;
         m_prog_was_inited[int(kind)] = true;
@@ -73,7 +261,7 @@ namespace RA {
             m_tris_out_prog->SetResource("sprites_data", m_sprite_atlas->GlyphsSBO());
             m_tris_out_prog->SetResource("atlas", m_sprite_atlas->Texture());
             m_tris_out_prog->SetResource("atlasSampler", RA::cSampler_Linear);
-            m_tris_out_prog->SetInputBuffers(m_tris_buf, nullptr, nullptr);
+            m_tris_out_prog->SetInputBuffers(buf, ibuf, nullptr);
             break;
         }
         case BatchKind::Glyphs: {
@@ -83,7 +271,7 @@ namespace RA {
             m_text_out_prog->SetValue("transform_2d", m4);
             m_text_out_prog->SetResource("atlas", m_glyphs_atlas->Texture());
             m_text_out_prog->SetResource("atlasSampler", RA::cSampler_Linear);
-            m_text_out_prog->SetInputBuffers(nullptr, nullptr, m_text_buf);
+            m_text_out_prog->SetInputBuffers(nullptr, nullptr, buf);
             break;
         }
         case BatchKind::Lines: {
@@ -92,7 +280,7 @@ namespace RA {
             m_lines_out_prog->SetValue("dpi_scale", dpi_scale);
             m_lines_out_prog->SetValue("pos3d", m_pos);
             m_lines_out_prog->SetValue("transform_2d", m4);
-            m_lines_out_prog->SetInputBuffers(nullptr, nullptr, m_lines_buf);
+            m_lines_out_prog->SetInputBuffers(nullptr, nullptr, buf);
             break;
         }
         }
@@ -109,10 +297,47 @@ namespace RA {
     {
         return m_tb.get();
     }
+    TextLayoutCache* Canvas::TC()
+    {
+        if (!m_tc) m_tc = std::make_shared<TextLayoutCache>(m_glyphs_atlas.get());
+        return m_tc.get();
+    }
     Pen& Canvas::Pen()
     {
         return m_pen;
     }
+    bool Canvas::GetBatchReordering() const
+    {
+        return m_reorder_batches;
+    }
+    void Canvas::SetBatchReordering(bool enable)
+    {
+        m_reorder_batches = enable;
+    }
+    bool Canvas::GetStreamed() const
+    {
+        return m_streamed;
+    }
+    void Canvas::SetStreamed(bool enable)
+    {
+        m_streamed = enable;
+        if (!m_streamed) {
+            m_text_ring = nullptr;
+            m_lines_ring = nullptr;
+        }
+    }
+    void Canvas::PushClip(const glm::vec4& bounds)
+    {
+        glm::AABR clip(bounds.xy(), bounds.zw());
+        if (const glm::AABR* parent = ActiveClip()) clip = clip.Intersect(*parent);
+        m_clip_stack.push_back(int(m_clips.size()));
+        m_clips.push_back(clip);
+    }
+    void Canvas::PopClip()
+    {
+        assert(m_clip_stack.size());
+        m_clip_stack.pop_back();
+    }
     AtlasSpritePtr Canvas::GetSprite(const fs::path& filename)
     {
         return m_sprite_atlas->ObtainSprite(filename);
@@ -121,42 +346,43 @@ namespace RA {
     {
         TrisVertex v[4];
 
-        float x1 = -size.x * origin.x;
-        float x2 = x1 + size.x;
-        float y1 = -size.y * origin.y;
-        float y2 = y1 + size.y;
-        v[0].coord = glm::vec2(x1, y1);
-        v[1].coord = glm::vec2(x1, y2);
-        v[2].coord = glm::vec2(x2, y1);
-        v[3].coord = glm::vec2(x2, y2);
-        for (int i = 0; i < 4; i++) {
-            v[i].coord = glm::rotate(v[i].coord, rotation) + pos;
-            v[i].color = m_pen.GetColor();
-            v[i].hinting = m_pen.GetHinting() ? 1.0f : 0.0f;
-            v[i].sprite_idx = sprite->Index();
-        }
+        float xx[2];
+        xx[0] = -size.x * origin.x;
+        xx[1] = xx[0] + size.x;
+        float yy[2];
+        yy[0] = -size.y * origin.y;
+        yy[1] = yy[0] + size.y;
 
         glm::vec4 rct = sprite->Rect();
-        float u1 = float(sprite_cliprect.x) / rct.z;
-        float u2 = float(sprite_cliprect.x + sprite_cliprect.z) / rct.z;
-        float v1 = float(sprite_cliprect.y) / rct.w;
-        float v2 = float(sprite_cliprect.y + sprite_cliprect.w) / rct.w;
-        v[0].texcoord = glm::vec2(u1, v1);
-        v[1].texcoord = glm::vec2(u1, v2);
-        v[2].texcoord = glm::vec2(u2, v1);
-        v[3].texcoord = glm::vec2(u2, v2);
-
-        m_tris.push_back(v[0]);
-        m_tris.push_back(v[1]);
-        m_tris.push_back(v[2]);
-        m_tris.push_back(v[2]);
-        m_tris.push_back(v[1]);
-        m_tris.push_back(v[3]);
-        m_tris_buf_valid = false;
+        float uu[2];
+        uu[0] = float(sprite_cliprect.x) / rct.z;
+        uu[1] = float(sprite_cliprect.x + sprite_cliprect.z) / rct.z;
+        float vv[2];
+        vv[0] = float(sprite_cliprect.y) / rct.w;
+        vv[1] = float(sprite_cliprect.y + sprite_cliprect.w) / rct.w;
+
+        const glm::AABR* clip = ActiveClip();
+        if (clip && (rotation == 0)) {
+            if (!ClipGrid(xx, uu, 2, clip->min.x - pos.x, clip->max.x - pos.x)) return;
+            if (!ClipGrid(yy, vv, 2, clip->min.y - pos.y, clip->max.y - pos.y)) return;
+        }
+
+        uint32_t color = glm::packUnorm4x8(m_pen.GetColor());
+        uint32_t sprite_idx = PenSpriteIdx(sprite.get());
+        glm::AABR bounds;
+        for (int i = 0; i < 4; i++) {
+            v[i].coord = glm::rotate(glm::vec2(xx[i / 2], yy[i % 2]), rotation) + pos;
+            v[i].texcoord = glm::vec2(uu[i / 2], vv[i % 2]);
+            v[i].color = color;
+            v[i].sprite_idx = sprite_idx;
+            bounds += v[i].coord;
+        }
+        //rotated quads are only culled, the scissor cuts the rest
+        if (clip && !bounds.IsIntersects(*clip)) return;
 
         m_used_sprites.push_back(sprite);
 
-        PushBatch(BatchKind::Tris, 6);
+        PushTris(v, 4, cQuadIndices, 6);
     }
     void Canvas::AddSprite(const glm::vec2& pos, const glm::vec2& origin, const glm::vec2& size, const AtlasSpritePtr& sprite)
     {
@@ -194,66 +420,177 @@ namespace RA {
         ty[1] = y1 / rct.w;
         ty[2] = (rct.w - y2) / rct.w;
         ty[3] = 1.0f;
+        if (const glm::AABR* clip = ActiveClip()) {
+            if (!ClipGrid(xx, tx, 4, clip->min.x, clip->max.x)) return;
+            if (!ClipGrid(yy, ty, 4, clip->min.y, clip->max.y)) return;
+        }
+        uint32_t color = glm::packUnorm4x8(m_pen.GetColor());
+        uint32_t sprite_idx = PenSpriteIdx(sprite.get());
         for (int j = 0; j < 4; j++) {
             for (int i = 0; i < 4; i++) {            
                 int n = j * 4 + i;
                 v[n].coord.x = xx[i];
                 v[n].coord.y = yy[j];
-                v[n].color = m_pen.GetColor();
-                v[n].hinting = m_pen.GetHinting() ? 1.0f : 0.0f;
-                v[n].sprite_idx = sprite->Index();
+                v[n].color = color;
+                v[n].sprite_idx = sprite_idx;
                 v[n].texcoord.x = tx[i];
                 v[n].texcoord.y = ty[j];
             }
         }
 
+        uint32_t ind[6 * 9];
+        uint32_t* pind = ind;
         for (int j = 0; j < 3; j++) {
             for (int i = 0; i < 3; i++) {
-                int offset = i + j * 4;
-                m_tris.push_back(v[offset + 0]);
-                m_tris.push_back(v[offset + 4]);
-                m_tris.push_back(v[offset + 1]);
-                m_tris.push_back(v[offset + 1]);
-                m_tris.push_back(v[offset + 4]);
-                m_tris.push_back(v[offset + 5]);
+                uint32_t offset = i + j * 4;
+                *pind++ = offset + 0;
+                *pind++ = offset + 4;
+                *pind++ = offset + 1;
+                *pind++ = offset + 1;
+                *pind++ = offset + 4;
+                *pind++ = offset + 5;
             }
         }
 
-        m_tris_buf_valid = false;
-
         m_used_sprites.push_back(sprite);
 
-        PushBatch(BatchKind::Tris, 6 * 9);
+        PushTris(v, 16, ind, 6 * 9);
     }
-    void Canvas::AddLine(const glm::vec2& pt1, const glm::vec2& pt2)
+    static const float cMiterLimit = 4.0f; //also the range of packed line normals
+    static uint32_t PackLineNormal(const glm::vec2& n)
     {
-        LineVertex v;
-        v.width = { m_pen.GetWidth(), m_pen.GetMinPixWidth() };
-        v.color = m_pen.GetColor();
-        v.hinting = m_pen.GetHinting() ? 1.0f : 0.0f;
+        //canvas y goes down, line offsets are applied in pixels with y going up
+        return glm::packUnorm2x16(glm::vec2(n.x, -n.y) / (2.0f * cMiterLimit) + 0.5f);
+    }
+    static float Cross(const glm::vec2& a, const glm::vec2& b)
+    {
+        return a.x * b.y - a.y * b.x;
+    }
+    void Canvas::PushPolyline(const glm::vec2* pts, int count, bool closed, bool flip_side)
+    {
+        m_polyline_pts.clear();
+        for (int i = 0; i < count; i++) {
+            if (m_polyline_pts.empty() || (m_polyline_pts.back() != pts[i])) m_polyline_pts.push_back(pts[i]);
+        }
+        if (closed && (m_polyline_pts.size() > 1) && (m_polyline_pts.back() == m_polyline_pts[0])) m_polyline_pts.pop_back();
+        int n = int(m_polyline_pts.size());
+        if (n < 2) return;
+        if (n < 3) closed = false;
+        const glm::vec2* p = m_polyline_pts.data();
 
-        v.coords.x = pt1.x;
-        v.coords.y = pt1.y;
+        //directions and normals are computed in flat passes without branches, so the compiler can vectorize them
+        int seg_count = closed ? n : n - 1;
+        m_polyline_dirs.resize(seg_count);
+        glm::vec2* dirs = m_polyline_dirs.data();
+        for (int i = 0; i < seg_count; i++) {
+            dirs[i] = glm::normalize(p[(i + 1 < n) ? i + 1 : 0] - p[i]);
+        }
+        //normals point to the right side of the segment, the side where lines are drawn with PenAlign::right
+        float side = flip_side ? -1.0f : 1.0f;
+        m_polyline_normals.resize(n);
+        glm::vec4* normals = m_polyline_normals.data();
+        for (int i = 0; i < n; i++) {
+            glm::vec2 d0 = dirs[(i > 0) ? i - 1 : seg_count - 1];
+            glm::vec2 d1 = dirs[(i < seg_count) ? i : seg_count - 1];
+            normals[i] = glm::vec4(-d0.y, d0.x, -d1.y, d1.x) * side;
+        }
+        if (!closed) {
+            normals[0] = glm::vec4(normals[0].zw(), normals[0].zw());
+            normals[n - 1] = glm::vec4(normals[n - 1].xy(), normals[n - 1].xy());
+        }
 
-        v.coords.z = pt2.x;
-        v.coords.w = pt2.y;
+        LineVertex v;
+        v.color = glm::packUnorm4x8(m_pen.GetColor());
+        //width is in framebuffer pixels whatever the dpi scale is, so min width is a plain clamp
+        v.width = glm::max(m_pen.GetWidth(), m_pen.GetMinPixWidth());
+        v.hinting = m_pen.GetHinting() ? 1.0f : 0.0f;
+        PenJoin join = m_pen.GetJoin();
+        const glm::AABR* clip = ActiveClip();
+        glm::AABR bounds;
+        int inst_count = 0;
 
-        glm::vec2 n = { (pt2.x - pt1.x), (pt2.y - pt1.y) };
-        float n_lensqr = glm::dot(n, n);
-        if (n_lensqr == 0) {
-            n_lensqr = 1.0f;
-            n = { 1, 0 };
+        //joins. Inner side and short miters share one normal between both segments,
+        //outer bevel and round joins are filled with zero length wedge instances
+        auto add_wedge = [&](const glm::vec2& pt, glm::vec2 a, glm::vec2 b) {
+            if (Cross(a, b) > 0) std::swap(a, b); //keeps the strip front facing
+            v.coords = glm::vec4(pt, pt);
+            v.normals[0] = PackLineNormal(a);
+            v.normals[1] = PackLineNormal(b);
+            m_lines.push_back(v);
+            inst_count++;
+        };
+        for (int i = closed ? 0 : 1; i < (closed ? n : n - 1); i++) {
+            glm::vec2 n0 = normals[i].xy();
+            glm::vec2 n1 = normals[i].zw();
+            glm::vec2 d0 = dirs[(i > 0) ? i - 1 : seg_count - 1];
+            glm::vec2 d1 = dirs[i];
+            float denom = 1.0f + glm::dot(n0, n1);
+            glm::vec2 miter = (denom > 1e-4f) ? (n0 + n1) / denom : n0;
+            float miter_lensqr = glm::dot(miter, miter);
+            bool outer = (denom <= 1e-4f) || (glm::dot(d1, n0) < 0);
+            if (!outer || ((join == PenJoin::miter) && (miter_lensqr <= cMiterLimit * cMiterLimit))) {
+                if (miter_lensqr > cMiterLimit * cMiterLimit) miter *= cMiterLimit / glm::sqrt(miter_lensqr);
+                normals[i] = glm::vec4(miter, miter);
+                continue;
+            }
+            if (clip && !glm::AABR(p[i], p[i]).Expand(v.width).IsIntersects(*clip)) continue;
+            bounds += p[i];
+            if (join != PenJoin::round) {
+                add_wedge(p[i], n0, n1);
+                continue;
+            }
+            //arc goes around the point from n0 to n1 through the outer side, max deviation is about a quarter of a pixel
+            float angle = glm::acos(glm::clamp(glm::dot(n0, n1), -1.0f, 1.0f));
+            float step = 2.0f * glm::acos(glm::clamp(1.0f - 0.25f / glm::max(v.width, 0.25f), -1.0f, 1.0f));
+            int steps = glm::clamp(int(glm::ceil(angle / step)), 1, 32);
+            float dir = (Cross(n0, d0) > 0) ? 1.0f : -1.0f;
+            glm::vec2 prev = n0;
+            for (int k = 1; k <= steps; k++) {
+                float a = dir * angle * float(k) / float(steps);
+                glm::vec2 curr = (k == steps) ? n1 : glm::vec2(n0.x * glm::cos(a) - n0.y * glm::sin(a), n0.x * glm::sin(a) + n0.y * glm::cos(a));
+                add_wedge(p[i], prev, curr);
+                prev = curr;
+            }
         }
-        n /= glm::sqrt(n_lensqr);
-        v.normals.x = n.x;
-        v.normals.y = n.y;
-        v.normals.z = n.x;
-        v.normals.w = n.y;        
 
-        m_lines.push_back(v);
+        //segments share normals of their end points, so there are no gaps or overlaps at joins
+        for (int i = 0; i < seg_count; i++) {
+            int next = (i + 1 < n) ? i + 1 : 0;
+            glm::AABR edge;
+            edge += p[i];
+            edge += p[next];
+            if (clip && !edge.Expand(v.width).IsIntersects(*clip)) continue;
+            //flipped side is drawn from the end to the start, so the strip stays front facing
+            if (flip_side) {
+                v.coords = glm::vec4(p[next], p[i]);
+                v.normals[0] = PackLineNormal(normals[next].xy());
+                v.normals[1] = PackLineNormal(normals[i].zw());
+            }
+            else {
+                v.coords = glm::vec4(p[i], p[next]);
+                v.normals[0] = PackLineNormal(normals[i].zw());
+                v.normals[1] = PackLineNormal(normals[next].xy());
+            }
+            m_lines.push_back(v);
+            bounds += edge;
+            inst_count++;
+        }
+        if (!inst_count) return;
         m_lines_buf_valid = false;
-
-        PushBatch(BatchKind::Lines, 1);
+        PushBatch(BatchKind::Lines, inst_count, bounds, v.width);
+    }
+    void Canvas::AddLine(const glm::vec2& pt1, const glm::vec2& pt2)
+    {
+        glm::vec2 pts[2] = { pt1, pt2 };
+        PushPolyline(pts, 2, false, m_pen.GetAlign() == PenAlign::left);
+    }
+    void Canvas::AddPolyline(const glm::vec2* pts, int count, bool closed)
+    {
+        PushPolyline(pts, count, closed, m_pen.GetAlign() == PenAlign::left);
+    }
+    void Canvas::AddPolyline(const std::vector<glm::vec2>& pts, bool closed)
+    {
+        PushPolyline(pts.data(), int(pts.size()), closed, m_pen.GetAlign() == PenAlign::left);
     }
     void Canvas::AddRectangle(const glm::AABR& rect)
     {
@@ -263,32 +600,14 @@ namespace RA {
     {
         glm::vec2 size = bounds.zw() - bounds.xy();
         if ((size.x == 0) || (size.y == 0)) return;
-        glm::vec2 n = glm::sign(size);
-        if (m_pen.GetAlign() == PenAlign::left) n = -n;
-
-        LineVertex v;
-        v.width = { m_pen.GetWidth(), m_pen.GetMinPixWidth() };
-        v.color = m_pen.GetColor();
-        v.hinting = m_pen.GetHinting() ? 1.0f : 0.0f;
-
         glm::vec2 p[4];
         p[0] = { bounds.x, bounds.y };
         p[1] = { bounds.z, bounds.y };
         p[2] = { bounds.z, bounds.w };
         p[3] = { bounds.x, bounds.w };
-        glm::vec2 np[4];
-        np[0] = { n.x, -n.y };
-        np[1] = { -n.x, -n.y };
-        np[2] = { -n.x, n.y };
-        np[3] = { n.x, n.y };
-
-        for (int i = 0; i < 4; i++) {
-            v.coords = { p[i], p[(i + 1) % 4] };
-            v.normals = { np[i], np[(i + 1) % 4] };
-            m_lines.push_back(v);
-        }
-        m_lines_buf_valid = false;
-        PushBatch(BatchKind::Lines, 4);
+        //the right side of p is inside for rectangles with positive size, PenAlign::right draws inside
+        bool flip_side = (m_pen.GetAlign() == PenAlign::left) != (size.x * size.y < 0);
+        PushPolyline(p, 4, true, flip_side);
     }
     void Canvas::AddFillRect(const glm::vec4& bounds)
     {
@@ -298,14 +617,22 @@ namespace RA {
         float x2 = bounds.z;
         float y1 = bounds.y;
         float y2 = bounds.w;
+        if (const glm::AABR* clip = ActiveClip()) {
+            x1 = glm::clamp(x1, clip->min.x, clip->max.x);
+            x2 = glm::clamp(x2, clip->min.x, clip->max.x);
+            y1 = glm::clamp(y1, clip->min.y, clip->max.y);
+            y2 = glm::clamp(y2, clip->min.y, clip->max.y);
+            if ((x1 == x2) || (y1 == y2)) return;
+        }
         v[0].coord = glm::vec2(x1, y1);
         v[1].coord = glm::vec2(x1, y2);
         v[2].coord = glm::vec2(x2, y1);
         v[3].coord = glm::vec2(x2, y2);
+        uint32_t color = glm::packUnorm4x8(m_pen.GetColor());
+        uint32_t sprite_idx = PenSpriteIdx(nullptr);
         for (int i = 0; i < 4; i++) {
-            v[i].color = m_pen.GetColor();
-            v[i].hinting = m_pen.GetHinting() ? 1.0f : 0.0f;
-            v[i].sprite_idx = -1;
+            v[i].color = color;
+            v[i].sprite_idx = sprite_idx;
         }
 
         v[0].texcoord = glm::vec2(0, 0);
@@ -313,29 +640,88 @@ namespace RA {
         v[2].texcoord = glm::vec2(0, 0);
         v[3].texcoord = glm::vec2(0, 0);
 
-        m_tris.push_back(v[0]);
-        m_tris.push_back(v[1]);
-        m_tris.push_back(v[2]);
-        m_tris.push_back(v[2]);
-        m_tris.push_back(v[1]);
-        m_tris.push_back(v[3]);
-        m_tris_buf_valid = false;
-
-        PushBatch(BatchKind::Tris, 6);
+        PushTris(v, 4, cQuadIndices, 6);
+    }
+    void Canvas::AddPath(const CanvasPath& path, FillRule rule, const glm::vec2& offset)
+    {
+        if (path.Empty()) return;
+        PathTessCache::TessellationPtr tess = PathCache()->Obtain(path, rule);
+        PushTessellation(*tess, offset);
+    }
+    void Canvas::AddPolygon(const std::vector<glm::vec2>& pts, FillRule rule)
+    {
+        if (pts.size() < 3) return;
+        CanvasPath path;
+        path.MoveTo(pts[0]);
+        for (size_t i = 1; i < pts.size(); i++) {
+            path.LineTo(pts[i]);
+        }
+        path.Close();
+        PathTessCache::TessellationPtr tess = PathTessCache::Tessellate(path, rule);
+        PushTessellation(*tess, glm::vec2(0));
+    }
+    PathTessCache* Canvas::PathCache()
+    {
+        if (!m_path_cache) m_path_cache = std::make_shared<PathTessCache>();
+        return m_path_cache.get();
     }
     void Canvas::AddText(const ITextLinesPtr& lines)
     {
+        const glm::AABR* clip = ActiveClip();
+        glm::AABR bounds;
+        int count = 0;
         for (const TextGlyphVertex& v : lines->AllGlyphs()) {
             TextGlyphVertex3D vv(lines, v);
-            m_text.emplace_back(lines, v);
+            glm::AABR glyph_bounds = GlyphBounds(vv.bounds2d, vv.valign, v);
+            if (clip) {
+                if (!ClipGlyph(vv.v2d, glyph_bounds, *clip)) continue;
+                glyph_bounds = glyph_bounds.Intersect(*clip);
+            }
+            m_text.push_back(vv);
+            bounds += glyph_bounds;
+            count++;
         }        
+        if (!count) return;
         m_text_buf_valid = false;
-        PushBatch(BatchKind::Glyphs, int(lines->AllGlyphs().size()));
+        PushBatch(BatchKind::Glyphs, count, bounds);
+    }
+    void Canvas::AddText(VirtualTextLines* text, const glm::vec2& pos, const glm::vec4& clip_bounds)
+    {
+        const glm::AABR* active_clip = ActiveClip();
+        glm::vec4 clip = clip_bounds;
+        if (active_clip) {
+            clip = glm::vec4(glm::max(clip.xy(), active_clip->min), glm::min(clip.zw(), active_clip->max));
+            if ((clip.x >= clip.z) || (clip.y >= clip.w)) return;
+        }
+        int count = 0;
+        glm::AABR glyphs_bounds;
+        for (const VirtualTextLines::Span& span : text->Visible(clip.y - pos.y, clip.w - pos.y)) {
+            glm::vec4 bounds(pos.x, pos.y + span.ypos, pos.x + text->MaxWidth(), pos.y + span.ypos);
+            const std::vector<TextGlyphVertex>& glyphs = span.lines->AllGlyphs();
+            for (int i = span.glyphs.x; i < span.glyphs.x + span.glyphs.y; i++) {
+                const TextGlyphVertex& v = glyphs[i];
+                float x = glm::mix(bounds.x, bounds.z, v.halign) + v.pos.x;
+                if ((x + v.size.x * 0.5f < clip.x) || (x - v.size.x * 0.5f > clip.z)) continue;
+                glm::AABR glyph_bounds = GlyphBounds(bounds, 0.0f, v);
+                TextGlyphVertex3D vv(bounds, 0.0f, v);
+                if (active_clip) {
+                    if (!ClipGlyph(vv.v2d, glyph_bounds, *active_clip)) continue;
+                    glyph_bounds = glyph_bounds.Intersect(*active_clip);
+                }
+                m_text.push_back(vv);
+                glyphs_bounds += glyph_bounds;
+                count++;
+            }
+        }
+        if (!count) return;
+        m_text_buf_valid = false;
+        PushBatch(BatchKind::Glyphs, count, glyphs_bounds);
     }
     void Canvas::Clear()
     {
         m_used_sprites.clear();
         m_tris.clear();
+        m_tris_indices.clear();
         m_tris_buf_valid = false;
 
         m_text.clear();
@@ -345,43 +731,137 @@ namespace RA {
         m_lines_buf_valid = false;
 
         m_batches.clear();
+        m_clips.clear();
+        m_clip_stack.clear();
+    }
+    void Canvas::Append(const Canvas& canvas)
+    {
+        uint32_t tris_base = uint32_t(m_tris.size());
+        int clips_base = int(m_clips.size());
+        m_tris.insert(m_tris.end(), canvas.m_tris.begin(), canvas.m_tris.end());
+        m_clips.insert(m_clips.end(), canvas.m_clips.begin(), canvas.m_clips.end());
+        for (const Batch& b : canvas.m_batches) {
+            int first = b.ranges.x;
+            int last = b.ranges.x + b.ranges.y;
+            switch (b.kind) {
+            case BatchKind::Glyphs: {
+                m_text.insert(m_text.end(), canvas.m_text.begin() + first, canvas.m_text.begin() + last);
+                break;
+            }
+            case BatchKind::Tris: {
+                for (int i = first; i < last; i++) {
+                    m_tris_indices.push_back(tris_base + canvas.m_tris_indices[i]);
+                }
+                break;
+            }
+            case BatchKind::Lines: {
+                m_lines.insert(m_lines.end(), canvas.m_lines.begin() + first, canvas.m_lines.begin() + last);
+                break;
+            }
+            default:
+                assert(false);
+            }
+            PushBatch(b.kind, b.ranges.y, b.bounds, b.pix_margin, (b.clip >= 0) ? b.clip + clips_base : -1);
+        }
+        m_used_sprites.insert(m_used_sprites.end(), canvas.m_used_sprites.begin(), canvas.m_used_sprites.end());
+        m_text_buf_valid = false;
+        m_tris_buf_valid = false;
+        m_lines_buf_valid = false;
     }
     CanvasBuffers Canvas::GetBuffers()
     {
         ValidateBuffers();
         CanvasBuffers res;
         res.batches = &m_batches;
-        res.text_buf = m_text_buf->VertexCount() ? &m_text_buf : nullptr;
-        res.tris_buf = m_tris_buf->VertexCount() ? &m_tris_buf : nullptr;
+        res.text_buf = m_text.size() ? &m_text_buf : nullptr;
+        res.tris_buf = m_tris.size() ? &m_tris_buf : nullptr;
+        res.tris_ibuf = m_tris.size() ? &m_tris_ibuf : nullptr;
         return res;
     }
-    void Canvas::Render(CameraBase& camera, const glm::mat3& transform_2d)
+    void Canvas::RenderBatches(CameraBase& camera, const glm::mat3& transform_2d, const std::vector<Batch>& batches,
+                               const VertexBufferPtr& text_buf, const VertexBufferPtr& tris_buf, const IndexBufferPtr& tris_ibuf, const VertexBufferPtr& lines_buf,
+                               const glm::ivec2& instance_offsets)
     {
-        ValidateBuffers();
-
         for (int i = 0; i < 4; i++) {
             m_prog_was_inited[i] = false;
         }
 
-        for (auto batch : m_batches) {
-            InitProgram(batch.kind, camera, transform_2d);
+        //scissor changes are batch breaks, states are restored after the last batch
+        bool states_pushed = false;
+        int active_clip = -1;
+        for (auto batch : batches) {
+            if (batch.clip != active_clip) {
+                if (!states_pushed) {
+                    m_dev->States()->Push();
+                    states_pushed = true;
+                }
+                if (batch.clip >= 0)
+                    m_dev->States()->SetScissor(true, ScissorRect(camera, transform_2d, m_clips[batch.clip]));
+                else
+                    m_dev->States()->SetScissor(false);
+                active_clip = batch.clip;
+            }
+            switch (batch.kind) {
+            case BatchKind::Tris: InitProgram(batch.kind, camera, transform_2d, tris_buf, tris_ibuf); break;
+            case BatchKind::Glyphs: InitProgram(batch.kind, camera, transform_2d, text_buf, nullptr); break;
+            case BatchKind::Lines: InitProgram(batch.kind, camera, transform_2d, lines_buf, nullptr); break;
+            default: break;
+            }
             switch (batch.kind) {
             case BatchKind::Tris: {
                 m_tris_out_prog->SelectProgram();
-                m_tris_out_prog->Draw(PrimTopology::Triangle, batch.ranges.x, batch.ranges.y, 0, 0);
+                m_tris_out_prog->DrawIndexed(PrimTopology::Triangle, batch.ranges.x, batch.ranges.y, 0, 0, 0);
                 break;
             }
             case BatchKind::Glyphs: {
                 m_text_out_prog->SelectProgram();
-                m_text_out_prog->Draw(PrimTopology::Trianglestrip, 0, 4, batch.ranges.y, batch.ranges.x);
+                m_text_out_prog->Draw(PrimTopology::Trianglestrip, 0, 4, batch.ranges.y, batch.ranges.x + instance_offsets.x);
                 break;
             }
             case BatchKind::Lines: {
                 m_lines_out_prog->SelectProgram();
-                m_lines_out_prog->Draw(PrimTopology::Trianglestrip, 0, 4, batch.ranges.y, batch.ranges.x);
+                m_lines_out_prog->Draw(PrimTopology::Trianglestrip, 0, 4, batch.ranges.y, batch.ranges.x + instance_offsets.y);
             }
             }
         }
+        if (states_pushed) m_dev->States()->Pop();
+    }
+    void Canvas::RenderStreamed(CameraBase& camera, const glm::mat3& transform_2d, const std::vector<Batch>& batches)
+    {
+        if (!m_tris_buf_valid) {
+            UploadData(m_tris_buf, m_tris, m_tris_uploaded);
+            UploadData(m_tris_ibuf, m_tris_indices, m_tris_indices_uploaded);
+            m_tris_buf_valid = true;
+        }
+        const int cFramesInFlight = 3;
+        uint64_t frame = m_dev->FrameIndex();
+        if (!m_text_ring) {
+            m_text_ring = std::make_unique<FrameRingBuffer>(FrameRingStorage_VB::Factory(m_dev, TextGlyphVertex3D::Layout()), 1024, cFramesInFlight);
+            m_lines_ring = std::make_unique<FrameRingBuffer>(FrameRingStorage_VB::Factory(m_dev, LineVertex::Layout()), 1024, cFramesInFlight);
+            m_ring_frame = frame;
+        }
+        //ring frames follow presented device frames, ranges older than cFramesInFlight presents are released
+        for (uint64_t i = m_ring_frame; i < glm::min(frame, m_ring_frame + cFramesInFlight); i++) {
+            m_text_ring->EndFrame();
+            m_lines_ring->EndFrame();
+        }
+        m_ring_frame = frame;
+
+        FrameRingRange text = m_text_ring->Push(m_text.data(), int(m_text.size()));
+        FrameRingRange lines = m_lines_ring->Push(m_lines.data(), int(m_lines.size()));
+        RenderBatches(camera, transform_2d, batches,
+                      static_cast<FrameRingStorage_VB*>(text.storage)->Buffer(), m_tris_buf, m_tris_ibuf,
+                      static_cast<FrameRingStorage_VB*>(lines.storage)->Buffer(), glm::ivec2(text.offset, lines.offset));
+    }
+    void Canvas::Render(CameraBase& camera, const glm::mat3& transform_2d)
+    {
+        const std::vector<Batch>& batches = m_reorder_batches ? ReorderBatches(transform_2d) : m_batches;
+        if (m_streamed) {
+            RenderStreamed(camera, transform_2d, batches);
+            return;
+        }
+        ValidateBuffers();
+        RenderBatches(camera, transform_2d, batches, m_text_buf, m_tris_buf, m_tris_ibuf, m_lines_buf);
     }
     void Canvas::Render(CameraBase& camera)
     {
@@ -396,9 +876,13 @@ namespace RA {
         const ProgramPtr& lines_out_prog) :
         m_glyphs_atlas(glyphs), 
         m_sprite_atlas(sprites),
+        m_canvas_common_object(nullptr),
         m_tris_out_prog(tris_out_prog),
         m_text_out_prog(text_out_prog),
         m_lines_out_prog(lines_out_prog),
+        m_reorder_batches(false),
+        m_streamed(false),
+        m_ring_frame(0),
         m_pos(0)
     {
         m_dev = dev;
@@ -407,6 +891,7 @@ namespace RA {
         m_text_buf_valid = true;
 
         m_tris_buf = m_dev->Create_VertexBuffer();
+        m_tris_ibuf = m_dev->Create_IndexBuffer();
         m_tris_buf_valid = true;
 
         m_lines_buf = m_dev->Create_VertexBuffer();
@@ -466,16 +951,181 @@ namespace RA {
     {
         m_penalign = align;
     }
-    Pen::Pen() : m_color(1), m_hinting(true), m_width(1), m_min_pix_width(1), m_penalign(PenAlign::right)
+    PenJoin Pen::GetJoin()
+    {
+        return m_join;
+    }
+    void Pen::SetJoin(PenJoin join)
+    {
+        m_join = join;
+    }
+    Pen::Pen() : m_color(1), m_hinting(true), m_width(1), m_min_pix_width(1), m_penalign(PenAlign::right), m_join(PenJoin::miter)
+    {
+    }
+    int CanvasPath::ContourStart() const
+    {
+        return m_contour_ends.size() ? m_contour_ends.back() : 0;
+    }
+    void CanvasPath::MoveTo(const glm::vec2& pt)
+    {
+        Close();
+        m_pts.push_back(pt);
+        m_hash_valid = false;
+    }
+    void CanvasPath::LineTo(const glm::vec2& pt)
+    {
+        if (int(m_pts.size()) == ContourStart()) {
+            MoveTo(pt);
+            return;
+        }
+        if (m_pts.back() == pt) return;
+        m_pts.push_back(pt);
+        m_hash_valid = false;
+    }
+    void CanvasPath::QuadTo(const glm::vec2& ctrl, const glm::vec2& pt)
+    {
+        if (int(m_pts.size()) == ContourStart()) MoveTo(ctrl);
+        glm::Bezier2_2d b;
+        b.pt[0] = m_pts.back();
+        b.pt[1] = ctrl;
+        b.pt[2] = pt;
+        b.Aprrox(m_tolerance, [this](const glm::vec2& v) {
+                LineTo(v);
+            }
+        );
+    }
+    void CanvasPath::Close()
+    {
+        int start = ContourStart();
+        if ((int(m_pts.size()) - start > 1) && (m_pts.back() == m_pts[start])) m_pts.pop_back();
+        if (int(m_pts.size()) - start < 3) {
+            //contours without area are dropped
+            m_pts.resize(start);
+        }
+        else {
+            m_contour_ends.push_back(int(m_pts.size()));
+        }
+        m_hash_valid = false;
+    }
+    void CanvasPath::Clear()
+    {
+        m_pts.clear();
+        m_contour_ends.clear();
+        m_hash_valid = false;
+    }
+    bool CanvasPath::Empty() const
+    {
+        return m_contour_ends.empty() && (int(m_pts.size()) < 3);
+    }
+    uint32_t CanvasPath::Hash() const
+    {
+        if (!m_hash_valid) {
+            m_hash = MurmurHash2(m_pts.data(), int(m_pts.size() * sizeof(glm::vec2)));
+            m_hash = MurmurHash2(m_contour_ends.data(), int(m_contour_ends.size() * sizeof(int)), m_hash);
+            m_hash_valid = true;
+        }
+        return m_hash;
+    }
+    CanvasPath::CanvasPath(float tolerance) : m_tolerance(tolerance), m_hash(0), m_hash_valid(false)
+    {
+    }
+
+    struct PathTessVertex {
+        glm::vec2 pos;
+        glm::dvec2 GetDPos() const { return glm::dvec2(pos); }
+    };
+    PathTessCache::TessellationPtr PathTessCache::Tessellate(const CanvasPath& path, FillRule rule)
+    {
+        Poly<PathTessVertex> poly;
+        int start = 0;
+        auto add_contour = [&poly, &path](int first, int last) {
+            poly.contours.emplace_back();
+            Contour<PathTessVertex>& cntr = poly.contours.back();
+            cntr.pts.reserve(size_t(last) - first);
+            for (int i = first; i < last; i++) {
+                cntr.pts.push_back({ path.m_pts[i] });
+            }
+        };
+        for (int end : path.m_contour_ends) {
+            add_contour(start, end);
+            start = end;
+        }
+        //the last contour isn't closed yet
+        if (int(path.m_pts.size()) - start >= 3) add_contour(start, int(path.m_pts.size()));
+
+        auto res = std::make_shared<Tessellation>();
+        if (poly.contours.empty()) return res;
+        Tris<PathTessVertex> tris = poly.Trinagulate(
+            [](const glm::dvec2& new_pos, const PathTessVertex&, const PathTessVertex&, const PathTessVertex&, const PathTessVertex&, const glm::vec4&) {
+                return PathTessVertex{ glm::vec2(new_pos) };
+            },
+            (rule == FillRule::EvenOdd) ? TessWinding::Odd : TessWinding::NonZero
+        );
+        res->vertices.reserve(tris.vertices.size());
+        for (const PathTessVertex& v : tris.vertices) {
+            res->vertices.push_back(v.pos);
+        }
+        //tessellator outputs counter clockwise triangles, canvas triangles are clockwise (y goes down)
+        res->indices.reserve(tris.indices.size());
+        for (size_t i = 0; i + 2 < tris.indices.size(); i += 3) {
+            res->indices.push_back(uint32_t(tris.indices[i]));
+            res->indices.push_back(uint32_t(tris.indices[i + 2]));
+            res->indices.push_back(uint32_t(tris.indices[i + 1]));
+        }
+        for (uint32_t idx : res->indices) {
+            res->bounds += res->vertices[idx];
+        }
+        return res;
+    }
+    PathTessCache::TessellationPtr PathTessCache::Obtain(const CanvasPath& path, FillRule rule)
+    {
+        uint32_t h = path.Hash() ^ uint32_t(rule);
+        auto range = m_entries.equal_range(h);
+        for (auto it = range.first; it != range.second; ++it) {
+            const Entry& e = *it->second;
+            if ((e.rule == rule) && (e.contour_ends == path.m_contour_ends) && (e.pts == path.m_pts)) {
+                m_lru.splice(m_lru.begin(), m_lru, it->second);
+                return e.tess;
+            }
+        }
+
+        Entry new_entry;
+        new_entry.hash = h;
+        new_entry.rule = rule;
+        new_entry.pts = path.m_pts;
+        new_entry.contour_ends = path.m_contour_ends;
+        new_entry.tess = Tessellate(path, rule);
+        m_lru.push_front(std::move(new_entry));
+        m_entries.emplace(h, m_lru.begin());
+
+        if (m_lru.size() > m_max_entries) {
+            auto last = std::prev(m_lru.end());
+            range = m_entries.equal_range(last->hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == last) {
+                    m_entries.erase(it);
+                    break;
+                }
+            }
+            m_lru.pop_back();
+        }
+        return m_lru.front().tess;
+    }
+    void PathTessCache::Clear()
     {
+        m_entries.clear();
+        m_lru.clear();
     }
+    PathTessCache::PathTessCache(size_t max_entries) : m_max_entries(max_entries)
+    {
+    }
+
     const Layout* Canvas::TrisVertex::Layout()
     {
         return LB()
             ->Add("coord", LayoutType::Float, 2)
             ->Add("texcoord", LayoutType::Float, 2)
-            ->Add("color", LayoutType::Float, 4)
-            ->Add("hinting", LayoutType::Float, 1)
+            ->Add("color", LayoutType::Byte, 4)
             ->Add("sprite_idx", LayoutType::UInt, 1)
             ->Finish();
     }
@@ -519,9 +1169,9 @@ namespace RA {
     {
         return LB()
             ->Add("coords", LayoutType::Float, 4)
-            ->Add("normals", LayoutType::Float, 4)
-            ->Add("color", LayoutType::Float, 4)
-            ->Add("width", LayoutType::Float, 2)
+            ->Add("normals", LayoutType::Word, 4)
+            ->Add("color", LayoutType::Byte, 4)
+            ->Add("width", LayoutType::Float, 1)
             ->Add("hinting", LayoutType::Float, 1)
             ->Finish();
     }
@@ -540,4 +1190,275 @@ namespace RA {
             ->Add("valign", LayoutType::Float, 1)
             ->Finish();
     }
+    CanvasItem::CanvasItem(RetainedCanvas* owner)
+    {
+        m_owner = owner;
+        m_idx = int(m_owner->m_items.size());
+        m_owner->m_items.push_back(this);
+    }
+    void CanvasItem::Translate(const glm::vec2& delta)
+    {
+        if (!m_owner) return;
+        if (const MemRangeIntf* r = m_ranges[int(BatchKind::Tris)].get()) {
+            RetainedCanvas::Arena& arena = m_owner->m_arenas[int(BatchKind::Tris)];
+            Canvas::TrisVertex* v = reinterpret_cast<Canvas::TrisVertex*>(arena.data.data()) + r->Offset();
+            for (int i = 0; i < r->Size(); i++) v[i].coord += delta;
+            m_owner->MarkDirty(arena, r->OffsetSize());
+        }
+        if (const MemRangeIntf* r = m_ranges[int(BatchKind::Lines)].get()) {
+            RetainedCanvas::Arena& arena = m_owner->m_arenas[int(BatchKind::Lines)];
+            Canvas::LineVertex* v = reinterpret_cast<Canvas::LineVertex*>(arena.data.data()) + r->Offset();
+            for (int i = 0; i < r->Size(); i++) v[i].coords += glm::vec4(delta, delta);
+            m_owner->MarkDirty(arena, r->OffsetSize());
+        }
+        if (const MemRangeIntf* r = m_ranges[int(BatchKind::Glyphs)].get()) {
+            RetainedCanvas::Arena& arena = m_owner->m_arenas[int(BatchKind::Glyphs)];
+            Canvas::TextGlyphVertex3D* v = reinterpret_cast<Canvas::TextGlyphVertex3D*>(arena.data.data()) + r->Offset();
+            for (int i = 0; i < r->Size(); i++) v[i].bounds2d += glm::vec4(delta, delta);
+            m_owner->MarkDirty(arena, r->OffsetSize());
+        }
+    }
+    void CanvasItem::SetColor(const glm::vec4& color)
+    {
+        if (!m_owner) return;
+        if (const MemRangeIntf* r = m_ranges[int(BatchKind::Tris)].get()) {
+            RetainedCanvas::Arena& arena = m_owner->m_arenas[int(BatchKind::Tris)];
+            Canvas::TrisVertex* v = reinterpret_cast<Canvas::TrisVertex*>(arena.data.data()) + r->Offset();
+            uint32_t packed = glm::packUnorm4x8(color);
+            for (int i = 0; i < r->Size(); i++) v[i].color = packed;
+            m_owner->MarkDirty(arena, r->OffsetSize());
+        }
+        if (const MemRangeIntf* r = m_ranges[int(BatchKind::Lines)].get()) {
+            RetainedCanvas::Arena& arena = m_owner->m_arenas[int(BatchKind::Lines)];
+            Canvas::LineVertex* v = reinterpret_cast<Canvas::LineVertex*>(arena.data.data()) + r->Offset();
+            uint32_t packed = glm::packUnorm4x8(color);
+            for (int i = 0; i < r->Size(); i++) v[i].color = packed;
+            m_owner->MarkDirty(arena, r->OffsetSize());
+        }
+        if (const MemRangeIntf* r = m_ranges[int(BatchKind::Glyphs)].get()) {
+            RetainedCanvas::Arena& arena = m_owner->m_arenas[int(BatchKind::Glyphs)];
+            Canvas::TextGlyphVertex3D* v = reinterpret_cast<Canvas::TextGlyphVertex3D*>(arena.data.data()) + r->Offset();
+            for (int i = 0; i < r->Size(); i++) v[i].v2d.color = color;
+            m_owner->MarkDirty(arena, r->OffsetSize());
+        }
+    }
+    CanvasItem::~CanvasItem()
+    {
+        //ranges are freed with the item, batches never cover free space, so the vertices stay in buffers as they are
+        if (!m_owner) return;
+        m_owner->m_items[m_idx] = nullptr;
+        m_owner->m_batches_valid = false;
+    }
+
+    void RetainedCanvas::InitArena(Arena& arena, const Layout* layout)
+    {
+        arena.layout = layout;
+        arena.stride = layout ? layout->stride : int(sizeof(uint32_t));
+        arena.man = Create_RangeManager(cInitialCapacity);
+        arena.data.resize(size_t(cInitialCapacity) * arena.stride, 0);
+        if (layout)
+            arena.buf = m_canvas->m_dev->Create_VertexBuffer();
+        else
+            arena.ibuf = m_canvas->m_dev->Create_IndexBuffer();
+        arena.dirty = { 0, 0 };
+        arena.buf_valid = false;
+    }
+    void RetainedCanvas::MarkDirty(Arena& arena, const glm::ivec2& offset_size)
+    {
+        if (arena.dirty.x >= arena.dirty.y) {
+            arena.dirty = { offset_size.x, offset_size.x + offset_size.y };
+        }
+        else {
+            arena.dirty.x = glm::min(arena.dirty.x, offset_size.x);
+            arena.dirty.y = glm::max(arena.dirty.y, offset_size.x + offset_size.y);
+        }
+    }
+    MemRangeIntfPtr RetainedCanvas::Store(Arena& arena, const void* data, int count)
+    {
+        MemRangeIntfPtr range = arena.man->Alloc(count);
+        while (!range) {
+            arena.man->AddSpace(glm::nextPowerOfTwo(arena.man->Size() + count) - arena.man->Size());
+            arena.data.resize(size_t(arena.man->Size()) * arena.stride, 0);
+            arena.buf_valid = false;
+            range = arena.man->Alloc(count);
+        }
+        memcpy(&arena.data[size_t(range->Offset()) * arena.stride], data, size_t(count) * arena.stride);
+        MarkDirty(arena, range->OffsetSize());
+        return range;
+    }
+    CanvasItemPtr RetainedCanvas::Record()
+    {
+        CanvasItemPtr item(new CanvasItem(this));
+        Canvas* c = m_canvas.get();
+        if (c->m_tris.size()) {
+            MemRangeIntfPtr& range = item->m_ranges[int(BatchKind::Tris)];
+            range = Store(m_arenas[int(BatchKind::Tris)], c->m_tris.data(), int(c->m_tris.size()));
+            for (uint32_t& idx : c->m_tris_indices) idx += uint32_t(range->Offset());
+            item->m_tris_indices = Store(m_tris_indices, c->m_tris_indices.data(), int(c->m_tris_indices.size()));
+        }
+        if (c->m_lines.size())
+            item->m_ranges[int(BatchKind::Lines)] = Store(m_arenas[int(BatchKind::Lines)], c->m_lines.data(), int(c->m_lines.size()));
+        if (c->m_text.size())
+            item->m_ranges[int(BatchKind::Glyphs)] = Store(m_arenas[int(BatchKind::Glyphs)], c->m_text.data(), int(c->m_text.size()));
+        item->m_used_sprites.swap(c->m_used_sprites);
+        c->Clear();
+        m_batches_valid = false;
+        return item;
+    }
+    void RetainedCanvas::UploadArena(Arena& arena)
+    {
+        if (!arena.buf_valid) {
+            if (arena.layout)
+                arena.buf->SetState(arena.layout, arena.man->Size(), arena.data.data());
+            else
+                arena.ibuf->SetState(arena.man->Size(), arena.data.data());
+            arena.buf_valid = true;
+        }
+        else if (arena.dirty.x < arena.dirty.y) {
+            const void* data = &arena.data[size_t(arena.dirty.x) * arena.stride];
+            if (arena.layout)
+                arena.buf->SetSubData(arena.dirty.x, arena.dirty.y - arena.dirty.x, data);
+            else
+                arena.ibuf->SetSubData(arena.dirty.x, arena.dirty.y - arena.dirty.x, data);
+        }
+        arena.dirty = { 0, 0 };
+    }
+    void RetainedCanvas::ValidateBatches()
+    {
+        if (m_batches_valid) return;
+        m_batches_valid = true;
+        //removed items leave holes, new items are appended, so compacting keeps the recording order
+        int count = 0;
+        for (CanvasItem* item : m_items) {
+            if (!item) continue;
+            item->m_idx = count;
+            m_items[count++] = item;
+        }
+        m_items.resize(count);
+
+        m_batches.clear();
+        for (CanvasItem* item : m_items) {
+            //kinds inside of an item are in the order Canvas records them for a single primitive
+            for (BatchKind kind : { BatchKind::Tris, BatchKind::Lines, BatchKind::Glyphs }) {
+                //tris are drawn by ranges of the index arena
+                const MemRangeIntf* r = (kind == BatchKind::Tris) ? item->m_tris_indices.get() : item->m_ranges[int(kind)].get();
+                if (!r) continue;
+                if (m_batches.size()) {
+                    Batch& last = m_batches.back();
+                    if ((last.kind == kind) && (last.ranges.x + last.ranges.y == r->Offset())) {
+                        last.ranges.y += r->Size();
+                        continue;
+                    }
+                }
+                Batch batch;
+                batch.kind = kind;
+                batch.ranges = r->OffsetSize();
+                m_batches.push_back(batch);
+            }
+        }
+    }
+    void RetainedCanvas::ValidateBuffers()
+    {
+        UploadArena(m_tris_indices);
+        for (BatchKind kind : { BatchKind::Tris, BatchKind::Lines, BatchKind::Glyphs })
+            UploadArena(m_arenas[int(kind)]);
+        ValidateBatches();
+    }
+    glm::vec3 RetainedCanvas::GetPos()
+    {
+        return m_canvas->GetPos();
+    }
+    void RetainedCanvas::SetPos(const glm::vec3& pt)
+    {
+        m_canvas->SetPos(pt);
+    }
+    RA::Pen& RetainedCanvas::Pen()
+    {
+        return m_canvas->Pen();
+    }
+    ITextBuilder* RetainedCanvas::TB()
+    {
+        return m_canvas->TB();
+    }
+    AtlasSpritePtr RetainedCanvas::GetSprite(const fs::path& filename)
+    {
+        return m_canvas->GetSprite(filename);
+    }
+    CanvasItemPtr RetainedCanvas::AddSprite(const glm::vec2& pos, const glm::vec2& origin, const glm::vec2& size, float rotation, const glm::ivec4& sprite_cliprect, const AtlasSpritePtr& sprite)
+    {
+        m_canvas->AddSprite(pos, origin, size, rotation, sprite_cliprect, sprite);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::AddSprite(const glm::vec2& pos, const glm::vec2& origin, const glm::vec2& size, const AtlasSpritePtr& sprite)
+    {
+        m_canvas->AddSprite(pos, origin, size, sprite);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::Add9Patch(const glm::AABR& rect, const glm::vec2& scale, int x1, int x2, int y1, int y2, const AtlasSpritePtr& sprite)
+    {
+        m_canvas->Add9Patch(rect, scale, x1, x2, y1, y2, sprite);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::AddLine(const glm::vec2& pt1, const glm::vec2& pt2)
+    {
+        m_canvas->AddLine(pt1, pt2);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::AddPolyline(const std::vector<glm::vec2>& pts, bool closed)
+    {
+        m_canvas->AddPolyline(pts, closed);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::AddRectangle(const glm::vec4& bounds)
+    {
+        m_canvas->AddRectangle(bounds);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::AddFillRect(const glm::vec4& bounds)
+    {
+        m_canvas->AddFillRect(bounds);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::AddPath(const CanvasPath& path, FillRule rule, const glm::vec2& offset)
+    {
+        m_canvas->AddPath(path, rule, offset);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::AddPolygon(const std::vector<glm::vec2>& pts, FillRule rule)
+    {
+        m_canvas->AddPolygon(pts, rule);
+        return Record();
+    }
+    CanvasItemPtr RetainedCanvas::AddText(const ITextLinesPtr& lines)
+    {
+        m_canvas->AddText(lines);
+        return Record();
+    }
+    void RetainedCanvas::Render(CameraBase& camera, const glm::mat3& transform_2d)
+    {
+        ValidateBuffers();
+        m_canvas->RenderBatches(camera, transform_2d, m_batches, 
+                                m_arenas[int(BatchKind::Glyphs)].buf, 
+                                m_arenas[int(BatchKind::Tris)].buf, 
+                                m_tris_indices.ibuf,
+                                m_arenas[int(BatchKind::Lines)].buf);
+    }
+    void RetainedCanvas::Render(CameraBase& camera)
+    {
+        Render(camera, glm::mat3(1.0f));
+    }
+    RetainedCanvas::RetainedCanvas(const CanvasCommonObject& canvas_common_object)
+    {
+        m_canvas = std::make_shared<Canvas>(canvas_common_object);
+        m_batches_valid = true;
+        InitArena(m_arenas[int(BatchKind::Tris)], Canvas::TrisVertex::Layout());
+        InitArena(m_tris_indices, nullptr);
+        InitArena(m_arenas[int(BatchKind::Lines)], Canvas::LineVertex::Layout());
+        InitArena(m_arenas[int(BatchKind::Glyphs)], Canvas::TextGlyphVertex3D::Layout());
+    }
+    RetainedCanvas::~RetainedCanvas()
+    {
+        for (CanvasItem* item : m_items)
+            if (item) item->m_owner = nullptr;
+    }
 }
\ No newline at end of file
@@ -1,38 +1,224 @@
 #include "pch.h"
 #include "RFonts.h"
-#include <functional>
+#include <algorithm>
 #include <Win.h>
 
 namespace RA {
     static const int cFontSize = 32;
 
-    void SplitString(const std::wstring& s, const std::wstring& separators, const std::function<void(std::wstring, wchar_t)>& callback) {
-        auto isSeparator = [&separators](wchar_t ch)->bool {
-            for (const auto& s : separators) {
-                if (s == ch) return true;
-            }
-            return false;
-        };
+    //pieces are views into s, callback is inlined instead of going through std::function
+    //works for both utf-8 and wide views, separators are ascii so they never hit a multibyte sequence
+    template<typename Str, typename F>
+    void SplitString(Str s, typename Str::value_type separator, F&& callback) {
         size_t start_i = 0;
         for (size_t i = 0; i < s.size(); i++) {
-            if (isSeparator(s[i])) {
+            if (s[i] == separator) {
                 callback(s.substr(start_i, i - start_i), s[i]);
                 start_i = i + 1;
             }
         }
         if (s.size() - start_i)
-            callback(s.substr(start_i, s.size() - start_i), 0);
+            callback(s.substr(start_i, s.size() - start_i), typename Str::value_type(0));
     }
 
-    const char* Atlas_GlyphsSDF::ObtainFontPtr(const char* font)
+    //UAX #14 line break classes, only the subset WriteWrapped needs
+    enum class LB : uint8_t { AL, BA, CL, CM, CP, EX, GL, HY, ID, IS, NS, NU, OP, QU, SP, WJ, ZW };
+    struct LBRange {
+        uint32_t first;
+        uint32_t last;
+        LB cls;
+    };
+    //hand-maintained subset of Unicode 15.0 LineBreak.txt for the classes above (sorted, non overlapping), everything missing is AL.
+    //printed by tools/gen_lb_table.py from its range list, edit the list there and regenerate
+    static const LBRange cLBRanges[] = {
+        { 0x00A0, 0x00A0, LB::GL }, { 0x00A1, 0x00A1, LB::OP }, { 0x00AB, 0x00AB, LB::QU }, { 0x00AD, 0x00AD, LB::BA }, { 0x00BB, 0x00BB, LB::QU },
+        { 0x00BF, 0x00BF, LB::OP }, { 0x0300, 0x036F, LB::CM }, { 0x0483, 0x0489, LB::CM }, { 0x0591, 0x05BD, LB::CM }, { 0x05BF, 0x05BF, LB::CM },
+        { 0x05C1, 0x05C2, LB::CM }, { 0x0610, 0x061A, LB::CM }, { 0x064B, 0x065F, LB::CM }, { 0x0670, 0x0670, LB::CM }, { 0x06D6, 0x06DC, LB::CM },
+        { 0x06DF, 0x06E4, LB::CM }, { 0x0F0C, 0x0F0C, LB::GL }, { 0x1100, 0x115F, LB::ID }, { 0x1160, 0x11FF, LB::CM }, { 0x1680, 0x1680, LB::BA },
+        { 0x2000, 0x2006, LB::BA }, { 0x2007, 0x2007, LB::GL }, { 0x2008, 0x200A, LB::BA }, { 0x200B, 0x200B, LB::ZW }, { 0x200C, 0x200F, LB::CM },
+        { 0x2010, 0x2010, LB::BA }, { 0x2011, 0x2011, LB::GL }, { 0x2012, 0x2014, LB::BA }, { 0x2018, 0x2019, LB::QU }, { 0x201C, 0x201D, LB::QU },
+        { 0x2024, 0x2026, LB::NS }, { 0x2027, 0x2027, LB::BA }, { 0x202F, 0x202F, LB::GL }, { 0x203C, 0x203D, LB::NS }, { 0x2047, 0x2049, LB::NS },
+        { 0x2060, 0x2060, LB::WJ }, { 0x20D0, 0x20F0, LB::CM }, { 0x2E80, 0x2FFF, LB::ID }, { 0x3000, 0x3000, LB::BA }, { 0x3001, 0x3002, LB::CL },
+        { 0x3003, 0x3004, LB::ID }, { 0x3005, 0x3005, LB::NS }, { 0x3006, 0x3007, LB::ID }, { 0x3008, 0x3008, LB::OP }, { 0x3009, 0x3009, LB::CL },
+        { 0x300A, 0x300A, LB::OP }, { 0x300B, 0x300B, LB::CL }, { 0x300C, 0x300C, LB::OP }, { 0x300D, 0x300D, LB::CL }, { 0x300E, 0x300E, LB::OP },
+        { 0x300F, 0x300F, LB::CL }, { 0x3010, 0x3010, LB::OP }, { 0x3011, 0x3011, LB::CL }, { 0x3012, 0x3013, LB::ID }, { 0x3014, 0x3014, LB::OP },
+        { 0x3015, 0x3015, LB::CL }, { 0x3016, 0x3016, LB::OP }, { 0x3017, 0x3017, LB::CL }, { 0x3018, 0x3018, LB::OP }, { 0x3019, 0x3019, LB::CL },
+        { 0x301A, 0x301A, LB::OP }, { 0x301B, 0x301B, LB::CL }, { 0x301C, 0x301C, LB::NS }, { 0x301D, 0x301D, LB::OP }, { 0x301E, 0x301F, LB::CL },
+        { 0x3020, 0x303A, LB::ID }, { 0x303B, 0x303C, LB::NS }, { 0x303D, 0x3040, LB::ID }, { 0x3041, 0x3041, LB::NS }, { 0x3042, 0x3042, LB::ID },
+        { 0x3043, 0x3043, LB::NS }, { 0x3044, 0x3044, LB::ID }, { 0x3045, 0x3045, LB::NS }, { 0x3046, 0x3046, LB::ID }, { 0x3047, 0x3047, LB::NS },
+        { 0x3048, 0x3048, LB::ID }, { 0x3049, 0x3049, LB::NS }, { 0x304A, 0x3062, LB::ID }, { 0x3063, 0x3063, LB::NS }, { 0x3064, 0x3082, LB::ID },
+        { 0x3083, 0x3083, LB::NS }, { 0x3084, 0x3084, LB::ID }, { 0x3085, 0x3085, LB::NS }, { 0x3086, 0x3086, LB::ID }, { 0x3087, 0x3087, LB::NS },
+        { 0x3088, 0x308D, LB::ID }, { 0x308E, 0x308E, LB::NS }, { 0x308F, 0x3094, LB::ID }, { 0x3095, 0x3096, LB::NS }, { 0x3097, 0x3098, LB::ID },
+        { 0x3099, 0x309A, LB::CM }, { 0x309B, 0x309E, LB::NS }, { 0x309F, 0x309F, LB::ID }, { 0x30A0, 0x30A1, LB::NS }, { 0x30A2, 0x30A2, LB::ID },
+        { 0x30A3, 0x30A3, LB::NS }, { 0x30A4, 0x30A4, LB::ID }, { 0x30A5, 0x30A5, LB::NS }, { 0x30A6, 0x30A6, LB::ID }, { 0x30A7, 0x30A7, LB::NS },
+        { 0x30A8, 0x30A8, LB::ID }, { 0x30A9, 0x30A9, LB::NS }, { 0x30AA, 0x30C2, LB::ID }, { 0x30C3, 0x30C3, LB::NS }, { 0x30C4, 0x30E2, LB::ID },
+        { 0x30E3, 0x30E3, LB::NS }, { 0x30E4, 0x30E4, LB::ID }, { 0x30E5, 0x30E5, LB::NS }, { 0x30E6, 0x30E6, LB::ID }, { 0x30E7, 0x30E7, LB::NS },
+        { 0x30E8, 0x30ED, LB::ID }, { 0x30EE, 0x30EE, LB::NS }, { 0x30EF, 0x30F4, LB::ID }, { 0x30F5, 0x30F6, LB::NS }, { 0x30F7, 0x30FA, LB::ID },
+        { 0x30FB, 0x30FE, LB::NS }, { 0x30FF, 0x31EF, LB::ID }, { 0x31F0, 0x31FF, LB::NS }, { 0x3200, 0x4DBF, LB::ID }, { 0x4E00, 0xA4CF, LB::ID },
+        { 0xAC00, 0xD7A3, LB::ID }, { 0xF900, 0xFAFF, LB::ID }, { 0xFE00, 0xFE0F, LB::CM }, { 0xFE30, 0xFE4F, LB::ID }, { 0xFE50, 0xFE50, LB::CL },
+        { 0xFE52, 0xFE52, LB::CL }, { 0xFEFF, 0xFEFF, LB::WJ }, { 0xFF01, 0xFF01, LB::EX }, { 0xFF02, 0xFF07, LB::ID }, { 0xFF08, 0xFF08, LB::OP },
+        { 0xFF09, 0xFF09, LB::CL }, { 0xFF0A, 0xFF0B, LB::ID }, { 0xFF0C, 0xFF0C, LB::CL }, { 0xFF0D, 0xFF0D, LB::ID }, { 0xFF0E, 0xFF0E, LB::CL },
+        { 0xFF0F, 0xFF19, LB::ID }, { 0xFF1A, 0xFF1B, LB::NS }, { 0xFF1C, 0xFF1E, LB::ID }, { 0xFF1F, 0xFF1F, LB::EX }, { 0xFF20, 0xFF3A, LB::ID },
+        { 0xFF3B, 0xFF3B, LB::OP }, { 0xFF3C, 0xFF3C, LB::ID }, { 0xFF3D, 0xFF3D, LB::CL }, { 0xFF3E, 0xFF5A, LB::ID }, { 0xFF5B, 0xFF5B, LB::OP },
+        { 0xFF5C, 0xFF5C, LB::ID }, { 0xFF5D, 0xFF5D, LB::CL }, { 0xFF5E, 0xFF5E, LB::ID }, { 0xFF5F, 0xFF5F, LB::OP }, { 0xFF60, 0xFF61, LB::CL },
+        { 0xFF62, 0xFF62, LB::OP }, { 0xFF63, 0xFF64, LB::CL }, { 0xFF65, 0xFF65, LB::NS }, { 0xFF66, 0xFF9D, LB::ID }, { 0xFF9E, 0xFF9F, LB::NS },
+        { 0xFFE0, 0xFFE6, LB::ID }, { 0x1B000, 0x1B2FF, LB::ID }, { 0x1F000, 0x1F3FA, LB::ID }, { 0x1F3FB, 0x1F3FF, LB::CM }, { 0x1F400, 0x1FAFF, LB::ID },
+        { 0x20000, 0x3FFFD, LB::ID }, { 0xE0001, 0xE007F, LB::CM }, { 0xE0100, 0xE01EF, LB::CM }
+    };
+    static LB LineBreakClass(uint32_t c) {
+        if (c < 0x80) {
+            if ((c >= '0') && (c <= '9')) return LB::NU;
+            switch (c) {
+                case ' ': return LB::SP;
+                case '\t': case '|': return LB::BA;
+                case '!': case '?': return LB::EX;
+                case '"': case '\'': return LB::QU;
+                case '(': case '[': case '{': return LB::OP;
+                case ')': case ']': return LB::CP;
+                case '}': return LB::CL;
+                case ',': case '.': case ':': case ';': return LB::IS;
+                case '-': return LB::HY;
+                default: return LB::AL;
+            }
+        }
+        auto it = std::upper_bound(std::begin(cLBRanges), std::end(cLBRanges), c, [](uint32_t v, const LBRange& r) { return v < r.first; });
+        if (it == std::begin(cLBRanges)) return LB::AL;
+        --it;
+        return (c <= it->last) ? it->cls : LB::AL;
+    }
+    //pair rules between two non-space classes, CM is resolved to the preceding class by the caller
+    static bool IsBreakAllowed(LB before, LB after) {
+        if (before == LB::ZW) return true;
+        if ((before == LB::WJ) || (after == LB::WJ) || (before == LB::GL) || (after == LB::GL)) return false;
+        if ((after == LB::CL) || (after == LB::CP) || (after == LB::EX) || (after == LB::IS) || (after == LB::NS) || (after == LB::CM)) return false;
+        if ((before == LB::OP) || (before == LB::QU) || (after == LB::QU)) return false;
+        if (before == LB::HY) return after != LB::NU;
+        if (before == LB::BA) return true;
+        if ((after == LB::BA) || (after == LB::HY)) return false;
+        return (before == LB::ID) || (after == LB::ID);
+    }
+    //words end at spaces and at UAX #14 break opportunities between two non-space characters.
+    //callback(word, spaces) gets spaces following the word, the last word always has at least one
+    template<typename Str, typename F>
+    static void ForEachWord(Str str, F&& callback) {
+        size_t word_start = 0;
+        size_t word_end = 0;
+        int spaces = 0;
+        LB prev = LB::SP;
+        for (size_t i = 0; i < str.size();) {
+            size_t pos = i;
+            LB cls = LineBreakClass(NextCodePoint(str, i));
+            if (cls == LB::SP) {
+                if (!spaces) word_end = pos;
+                spaces++;
+                continue;
+            }
+            if (spaces) {
+                callback(str.substr(word_start, word_end - word_start), spaces);
+                word_start = pos;
+                spaces = 0;
+            }
+            else if ((pos > word_start) && IsBreakAllowed(prev, cls)) {
+                callback(str.substr(word_start, pos - word_start), 0);
+                word_start = pos;
+            }
+            if (cls != LB::CM) prev = cls;
+        }
+        if (spaces)
+            callback(str.substr(word_start, word_end - word_start), spaces);
+        else if (str.size() > word_start)
+            callback(str.substr(word_start), 1); //last word keeps the trailing space it always had
+    }
+    template<typename Str>
+    static void SplitWrappedWordsInternal(Str str, std::vector<glm::ivec3>& words) {
+        words.clear();
+        ForEachWord(str, [str, &words](Str word, int spaces) {
+            words.push_back(glm::ivec3(int(word.data() - str.data()), int(word.size()), spaces));
+        });
+    }
+    void SplitWrappedWords(std::wstring_view str, std::vector<glm::ivec3>& words)
+    {
+        SplitWrappedWordsInternal(str, words);
+    }
+    void SplitWrappedWords(std::string_view str, std::vector<glm::ivec3>& words)
     {
-        for (const auto& s : m_fonts) {
-            if (s == font) {
-                return s.c_str();
+        SplitWrappedWordsInternal(str, words);
+    }
+    //strong direction of a code point: 1 - left-to-right, -1 - right-to-left, 0 - neutral
+    static int StrongDirection(uint32_t c, LB cls) {
+        if (((c >= 0x0590) && (c <= 0x08FF)) || ((c >= 0xFB1D) && (c <= 0xFDFF)) || ((c >= 0xFE70) && (c <= 0xFEFE)) || ((c >= 0x10800) && (c <= 0x10FFF)) || ((c >= 0x1E800) && (c <= 0x1EFFF)))
+            return (cls == LB::CM) ? 0 : -1;
+        if (c < 0x80) return (((c | 0x20) >= 'a') && ((c | 0x20) <= 'z')) ? 1 : 0;
+        return ((c >= 0xC0) && ((cls == LB::AL) || (cls == LB::ID))) ? 1 : 0;
+    }
+
+    std::atomic<Sprite_Glyph*>* Glyph_Font::ObtainSlot(uint32_t ch)
+    {
+        uint32_t page_idx = uint32_t(ch) >> cPageBits;
+        Page* page = m_pages[page_idx].load(std::memory_order_relaxed);
+        if (!page) {
+            m_pages_storage.push_back(std::make_unique<Page>());
+            page = m_pages_storage.back().get();
+            for (auto& slot : *page) slot.store(nullptr, std::memory_order_relaxed);
+            m_pages[page_idx].store(page, std::memory_order_release);
+        }
+        return &(*page)[uint32_t(ch) & (cPageSize - 1)];
+    }
+    void Glyph_Font::LoadKerning()
+    {
+        std::wstring wfont = UTF8ToWString(m_name);
+        HDC dc = CreateDC(TEXT("DISPLAY"), NULL, NULL, NULL);
+        HFONT hfont = CreateFontW(-cFontSize, 0, 0, 0, m_bold ? FW_BOLD : FW_NORMAL, m_italic, m_underline, m_strike, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, DEFAULT_QUALITY, FF_DONTCARE, wfont.c_str());
+        HGDIOBJ prev_font = SelectObject(dc, hfont);
+        DWORD pairs_count = GetKerningPairsW(dc, 0, nullptr);
+        if (pairs_count) {
+            std::vector<KERNINGPAIR> pairs(pairs_count);
+            pairs_count = GetKerningPairsW(dc, pairs_count, pairs.data());
+            m_kerning.reserve(pairs_count);
+            for (DWORD i = 0; i < pairs_count; i++) {
+                if (pairs[i].iKernAmount)
+                    m_kerning[(uint32_t(pairs[i].wFirst) << 16) | uint32_t(pairs[i].wSecond)] = float(pairs[i].iKernAmount);
             }
         }
-        m_fonts.emplace_back(font);
-        return m_fonts.back().c_str();
+        SelectObject(dc, prev_font);
+        DeleteObject(hfont);
+        DeleteDC(dc);
+    }
+    Glyph_Font::Glyph_Font(const char* name, bool bold, bool italic, bool underline, bool strike) :
+        m_name(name), m_bold(bold), m_italic(italic), m_underline(underline), m_strike(strike)
+    {
+        //the page table covers all code points, so it is never reallocated under readers. Pages are added by ObtainSlot
+        m_pages.reset(new std::atomic<Page*>[cPagesCount]);
+        for (int i = 0; i < cPagesCount; i++) m_pages[i].store(nullptr, std::memory_order_relaxed);
+    }
+    float Glyph_Font::Kerning(uint32_t first, uint32_t second)
+    {
+        //gdi kerning pairs are bmp only
+        if ((first > 0xFFFF) || (second > 0xFFFF)) return 0.0f;
+        std::call_once(m_kerning_loaded, [this]() { LoadKerning(); });
+        if (m_kerning.empty()) return 0.0f;
+        auto it = m_kerning.find((first << 16) | second);
+        return (it == m_kerning.end()) ? 0.0f : it->second;
+    }
+    const char* Glyph_Font::Name() const
+    {
+        return m_name.c_str();
+    }
+    bool Glyph_Font::Bold() const
+    {
+        return m_bold;
+    }
+    bool Glyph_Font::Italic() const
+    {
+        return m_italic;
+    }
+    bool Glyph_Font::Underline() const
+    {
+        return m_underline;
+    }
+    bool Glyph_Font::Strike() const
+    {
+        return m_strike;
     }
     void Atlas_GlyphsSDF::ValidateTexture()
     {
@@ -40,18 +226,18 @@ namespace RA {
             m_tex->SetState(m_tex->Format(), m_tex->Size(), 0, int(m_roots.size()), nullptr);
         m_gen_glyph_prog->CS_SetUAV(0, m_tex, 0, 0, int(m_roots.size()), true);
         //m_gen_glyph_prog->CS_ClearUAV(0, glm::vec4(100000000.0));
-        for (const auto& it : m_sprites) {
-            if (it.second->m_data.segments.size()) {
-                m_segments_sbo->SetState(sizeof(glm::vec4), int(it.second->m_data.segments.size() / 2), false, false, it.second->m_data.segments.data());
+        for (const auto& sprite : m_sprites) {
+            if (sprite->m_data.segments.size()) {
+                m_segments_sbo->SetState(sizeof(glm::vec4), int(sprite->m_data.segments.size() / 2), false, false, sprite->m_data.segments.data());
             }
             else {
                 m_segments_sbo->SetState(sizeof(glm::vec4), 1, false, false, nullptr);
             }
             m_gen_glyph_prog->SetResource("segments", m_segments_sbo);
-            m_gen_glyph_prog->SetValue("segments_count", int(it.second->m_data.segments.size() / 2));
-            m_gen_glyph_prog->SetValue("rect", glm::vec4(it.second->m_rect));
-            m_gen_glyph_prog->SetValue("slice", it.second->m_slice);
-            m_gen_glyph_prog->Dispatch({ (it.second->m_size.x + 31) / 32, (it.second->m_size.y + 31) / 32, 1 });
+            m_gen_glyph_prog->SetValue("segments_count", int(sprite->m_data.segments.size() / 2));
+            m_gen_glyph_prog->SetValue("rect", glm::vec4(sprite->m_rect));
+            m_gen_glyph_prog->SetValue("slice", sprite->m_slice);
+            m_gen_glyph_prog->Dispatch({ (sprite->m_size.x + 31) / 32, (sprite->m_size.y + 31) / 32, 1 });
         }
         m_gen_glyph_prog->CS_SetUAV(0, nullptr);
     }
@@ -66,35 +252,53 @@ namespace RA {
         m_tex->SetState(TextureFmt::R32f, glm::ivec2(512, 512));
         m_roots.push_back(std::make_unique<Node>(m_tex->Size()));
     }
-    Sprite_GlyphPtr Atlas_GlyphsSDF::ObtainSprite(const char* font, wchar_t ch, bool bold, bool italic, bool underline, bool strike)
-    {        
-        Glyph_Key k(ObtainFontPtr(font), ch, bold, italic, underline, strike);
-        auto it = m_sprites.find(k);
-        if (it == m_sprites.end()) {
-            std::shared_ptr<Sprite_Glyph> new_sprite(new Sprite_Glyph(this, Glyph_Data(k)));
-            m_sprites.emplace(k, new_sprite);
-            int slice = 0;
-            while (true) {
-                if (m_roots[slice]->Insert(new_sprite)) break;
-                slice++;
-                if (m_roots.size() == slice) {
-                    m_roots.push_back(std::make_unique<Node>(m_tex->Size()));
-                }
+    Glyph_Font* Atlas_GlyphsSDF::ObtainFont(const char* font, bool bold, bool italic, bool underline, bool strike)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& f : m_fonts) {
+            if ((f->m_bold == bold) && (f->m_italic == italic) && (f->m_underline == underline) && (f->m_strike == strike) && (f->m_name == font)) {
+                return f.get();
+            }
+        }
+        m_fonts.emplace_back(new Glyph_Font(font, bold, italic, underline, strike));
+        return m_fonts.back().get();
+    }
+    Sprite_Glyph* Atlas_GlyphsSDF::CreateSprite(Glyph_Font* font, uint32_t ch)
+    {
+        if (ch > 0x10FFFF) ch = 0xFFFD;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::atomic<Sprite_Glyph*>* slot = font->ObtainSlot(ch);
+        //another thread could create the glyph while this one was waiting for the lock
+        if (Sprite_Glyph* res = slot->load(std::memory_order_relaxed)) return res;
+
+        Glyph_Key k(font->Name(), ch, font->m_bold, font->m_italic, font->m_underline, font->m_strike);
+        std::shared_ptr<Sprite_Glyph> new_sprite(new Sprite_Glyph(this, Glyph_Data(k)));
+        m_sprites.push_back(new_sprite);
+        int slice = 0;
+        while (true) {
+            if (m_roots[slice]->Insert(new_sprite)) break;
+            slice++;
+            if (m_roots.size() == slice) {
+                m_roots.push_back(std::make_unique<Node>(m_tex->Size()));
             }
-            new_sprite->m_slice = slice;
-            InvalidateTex();
-            return new_sprite;
         }
-        return it->second;
+        new_sprite->m_slice = slice;
+        InvalidateTex();
+        slot->store(new_sprite.get(), std::memory_order_release);
+        return new_sprite.get();
+    }
+    Sprite_Glyph* Atlas_GlyphsSDF::ObtainSprite(const char* font, uint32_t ch, bool bold, bool italic, bool underline, bool strike)
+    {
+        return ObtainSprite(ObtainFont(font, bold, italic, underline, strike), ch);
     }
     Sprite_Glyph::Sprite_Glyph(BaseAtlas* owner, Glyph_Data data) : BaseAtlasSprite(owner, data.size), m_data(std::move(data))
     {
     }
-    glm::vec3 Sprite_Glyph::XXXMetricsScaled(float font_size)
+    glm::vec3 Sprite_Glyph::XXXMetricsScaled(float font_size) const
     {        
         return m_data.XXX * (font_size / cFontSize);
     }
-    glm::vec4 Sprite_Glyph::YYYYMetricsScaled(float font_size)
+    glm::vec4 Sprite_Glyph::YYYYMetricsScaled(float font_size) const
     {
         return m_data.YYYY * (font_size / cFontSize);
     }
@@ -110,9 +314,7 @@ namespace RA {
             return glm::vec2(FixedToFloat(pt.x), FixedToFloat(pt.y));
         };
 
-        std::wstring wfont;
-        wfont.resize(MultiByteToWideChar(CP_UTF8, 0, key.font, -1, NULL, 0));
-        MultiByteToWideChar(CP_UTF8, 0, key.font, -1, const_cast<wchar_t*>(wfont.c_str()), int(wfont.size()));
+        std::wstring wfont = UTF8ToWString(key.font);
         HDC dc = CreateDC(TEXT("DISPLAY"), NULL, NULL, NULL);
         HFONT hfont = CreateFontW(-cFontSize, 0, 0, 0, key.bold ? FW_BOLD : FW_NORMAL, key.italic, key.underline, key.strike, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, DEFAULT_QUALITY, FF_DONTCARE, wfont.c_str());
         SelectObject(dc, hfont);
@@ -128,11 +330,27 @@ namespace RA {
         transform.eM22.fract = 0;
         transform.eM22.value = 1;
 
-        int buf_size = GetGlyphOutlineW(dc, key.ch, GGO_NATIVE | GGO_UNHINTED, &gm, 0, nullptr, &transform);
+        //GetGlyphOutlineW takes a single utf-16 unit, so code points above bmp go through the glyph index
+        UINT glyph_ch = key.ch;
+        UINT ggo_format = GGO_NATIVE | GGO_UNHINTED;
+        if (key.ch > 0xFFFF) {
+            wchar_t pair[2] = { wchar_t(0xD800 + ((key.ch - 0x10000) >> 10)), wchar_t(0xDC00 + ((key.ch - 0x10000) & 0x3FF)) };
+            wchar_t indices[2] = { 0, 0 };
+            GCP_RESULTSW gcp = {};
+            gcp.lStructSize = sizeof(gcp);
+            gcp.lpGlyphs = indices;
+            gcp.nGlyphs = 2;
+            if (GetCharacterPlacementW(dc, pair, 2, 0, &gcp, 0) && gcp.nGlyphs) {
+                glyph_ch = UINT(indices[0]);
+                ggo_format |= GGO_GLYPH_INDEX;
+            }
+        }
+
+        int buf_size = GetGlyphOutlineW(dc, glyph_ch, ggo_format, &gm, 0, nullptr, &transform);
         if (buf_size == GDI_ERROR) RaiseLastOSError();
         std::vector<char> buffer;
         buffer.resize(buf_size);
-        GetGlyphOutlineW(dc, key.ch, GGO_NATIVE | GGO_UNHINTED, &gm, buf_size, buffer.data(), &transform);
+        GetGlyphOutlineW(dc, glyph_ch, ggo_format, &gm, buf_size, buffer.data(), &transform);
         static const float cToleranceScale = 0.0025f;
         float cTol = glm::max(gm.gmBlackBoxX, gm.gmBlackBoxY) * cToleranceScale;
 
@@ -242,7 +460,6 @@ namespace RA {
         float ypos = 0;
         float width = 0;
         glm::ivec2 glyphs = { 0,0 };
-        std::vector<glm::vec3> xxxmetrics;
     };
 
     class DefTextLines : public ITextLines {
@@ -262,6 +479,7 @@ namespace RA {
         int LinesCount() const override { return int(m_lines.size()); }
         glm::vec2 LineBounds(const int line_idx) const override { return glm::vec2(m_lines[line_idx].width, m_lines[line_idx].yymetrics.x + m_lines[line_idx].yymetrics.y); }
         glm::ivec2 LineGlyphs(const int line_idx) const override { return m_lines[line_idx].glyphs; }
+        float LineYPos(const int line_idx) const override { return m_lines[line_idx].ypos; }
         float MaxLineWidth() const override { return m_max_line_width; }
         float TotalHeight() const override { return m_total_height; }
         const std::vector<TextGlyphVertex>& AllGlyphs() const override { return m_glyphs; }
@@ -281,18 +499,68 @@ namespace RA {
         }
     };
 
+    //per caller bounds and valign over a layout shared through TextLayoutCache
+    class TextLinesView : public ITextLines {
+    private:
+        std::shared_ptr<const ITextLines> m_layout;
+        glm::vec4 m_bounds;
+        float m_valign;
+    public:
+        glm::vec4 GetBounds() const override { return m_bounds; }
+        void SetBounds(const glm::vec4& bounds) override { m_bounds = bounds; }
+        float GetVAlign() const override { return m_valign; }
+        void SetVAlign(float valign) override { m_valign = valign; }
+
+        int LinesCount() const override { return m_layout->LinesCount(); }
+        glm::vec2 LineBounds(const int line_idx) const override { return m_layout->LineBounds(line_idx); }
+        glm::ivec2 LineGlyphs(const int line_idx) const override { return m_layout->LineGlyphs(line_idx); }
+        float LineYPos(const int line_idx) const override { return m_layout->LineYPos(line_idx); }
+        float MaxLineWidth() const override { return m_layout->MaxLineWidth(); }
+        float TotalHeight() const override { return m_layout->TotalHeight(); }
+        const std::vector<TextGlyphVertex>& AllGlyphs() const override { return m_layout->AllGlyphs(); }
+
+        TextLinesView(std::shared_ptr<const ITextLines> layout) :
+            m_layout(std::move(layout))
+        {
+            m_bounds = m_layout->GetBounds();
+            m_valign = m_layout->GetVAlign();
+        }
+    };
+
     class DefTextBuilder : public ITextBuilder {
     private:
+        //range of glyphs inside the memo arrays
         struct WordInfo {
-            std::vector<TextGlyphVertex> glyphs;
-            std::vector<glm::vec3> xxxmetrics;
-            std::vector<glm::vec4> yyyymetrics;
-            glm::vec3 xxxspace;
+            int first;
+            int count;
+            int direction; //strong direction of the first strong character, see StrongDirection
+            glm::vec3 xxxspace; //spaces after the word, zero if it ends at a break opportunity without space
             float width;
             glm::vec2 yymetrics;
         };
+        //measured words of a single WriteWrapped call, reused while string and font state stay the same.
+        //Source bytes, words and glyph data of all runs live in the memo arrays, so the memo
+        //is a handful of vectors that are cleared but never shrunk
+        struct MeasuredRun {
+            uint32_t hash;
+            int str_first; //raw bytes of the source view in m_memo_chars, utf-8 or wide
+            int str_size;
+            bool utf8;
+            Glyph_Font* font;
+            glm::vec4 color;
+            float font_size;
+            float sdf_offset;
+            bool kerning;
+            bool bidi;
+            int words_first; //in m_memo_words
+            int words_count;
+        };
+        static const int cMaxMeasuredRuns = 256;
+        static const int cMaxMeasuredGlyphs = 65536;
+        static const int cMemoSlots = 1024; //open addressing table of run indices, a power of two
     private:
         Atlas_GlyphsSDF* m_atlas;
+        Glyph_Font* m_font;
         std::string m_fontname;
         glm::vec4 m_color;
         float m_font_size;
@@ -301,28 +569,54 @@ namespace RA {
         bool m_italic;
         bool m_underline;
         bool m_strikeout;
+        bool m_kerning;
+        bool m_bidi;
         LineAlign m_line_align;
 
         std::vector<TextGlyphVertex> m_glyphs;
         std::vector<LineInfo> m_lines;
 
         bool m_line_inited;
+        uint32_t m_prev_char;
         glm::vec2 m_pos;
         int m_line_start;
         LineInfo m_line_info;
         std::vector<glm::vec4> m_line_yyyy_metrics;
-        std::vector<WordInfo> m_wrapped_words;    
+        //scratch, cleared but never shrunk, so steady state layout doesn't touch the heap
+        std::vector<int> m_wrapped_words; //indices in m_memo_words
+        std::vector<glm::ivec2> m_wrapped_lines;
+        std::vector<int> m_wrapped_order;
+        std::vector<MeasuredRun> m_memo_runs;
+        std::vector<int> m_memo_slots; //-1 for empty slots
+        std::vector<char> m_memo_chars;
+        std::vector<WordInfo> m_memo_words;
+        std::vector<TextGlyphVertex> m_memo_glyphs;
+        std::vector<glm::vec3> m_memo_xxxmetrics;
+        std::vector<glm::vec4> m_memo_yyyymetrics;
 
-        Sprite_GlyphPtr ObtainSprite(wchar_t w);
+        Sprite_Glyph* ObtainSprite(uint32_t w);
+        glm::vec3 GlyphXXX(const Sprite_Glyph* glyph, uint32_t prev, uint32_t w);
         void InitLine();
-        glm::vec2 CalcBounds(const std::wstring& str);
-        void WriteWordInternal(const std::wstring& str);
-        void WriteInternal(const std::wstring& str);
+        //Str is std::string_view (utf-8) or std::wstring_view, decoded to code points with NextCodePoint
+        template<typename Str> glm::vec2 CalcBounds(Str str);
+        template<typename Str> uint32_t MeasuredRunHash(Str str) const;
+        template<typename Str> bool IsSameRun(const MeasuredRun& run, Str str) const;
+        template<typename Str> int ObtainMeasuredRun(Str str);
+        void ClearMeasuredRuns();
+        template<typename Str> void WriteWordInternal(Str str, int spaces);
+        template<typename Str> void MeasureWords(Str str);
+        const WordInfo& WrappedWord(int idx) const { return m_memo_words[m_wrapped_words[idx]]; }
+        void ReorderLine(int first, int count);
+        template<typename Str> void WriteInternal(Str str);
+        template<typename Str> void WriteWrappedInternal(Str str);
+        template<typename Str> void WriteWrappedMultilineInternal(Str str, float max_width, bool justify_align, float first_row_offset, float next_row_offset);
         void WriteLnInternal();
     public:
         void SetPenPos(glm::vec2 pen_pos) override { m_pos = pen_pos; }
 
         void Font_Set(const FontParams& params) override { 
+            m_font = nullptr;
+            m_prev_char = 0;
             m_fontname = params.name; 
             m_color = params.color; 
             m_font_size = params.size; 
@@ -331,29 +625,38 @@ namespace RA {
             m_italic = params.italic; 
             m_underline = params.underline; 
             m_strikeout = params.striked; }
-        void Font_SetName(const char* name) override { m_fontname = name; };
+        void Font_SetName(const char* name) override { m_font = nullptr; m_prev_char = 0; m_fontname = name; };
         void Font_SetColor(const glm::vec4& color) override { m_color = color; };
         void Font_SetSize(float size) override { m_font_size = size; };
         void Font_SetSDFOffset(float sdf_offset) override { m_sdf_offset = sdf_offset; };
-        void Font_SetStyle(bool bold, bool italic, bool underline, bool strikeout) override { m_bold = bold; m_italic = italic; m_underline = underline; m_strikeout = strikeout; };
+        void Font_SetStyle(bool bold, bool italic, bool underline, bool strikeout) override { m_font = nullptr; m_prev_char = 0; m_bold = bold; m_italic = italic; m_underline = underline; m_strikeout = strikeout; };
 
         void SetLineAlign(LineAlign la) override { m_line_align = la; };
+        void SetKerning(bool enable) override { m_kerning = enable; };
+        void SetBidi(bool enable) override { m_bidi = enable; };
 
         void WriteSpace(float space) override;
-        void Write(const std::wstring& str) override;
-        void WriteLine(const std::wstring& str) override;
-        void WriteMultiline(const std::wstring& str) override;
-        void WriteWrapped(const std::wstring& str) override;
+        void Write(std::wstring_view str) override;
+        void Write(std::string_view str) override;
+        void WriteLine(std::wstring_view str) override;
+        void WriteLine(std::string_view str) override;
+        void WriteMultiline(std::wstring_view str) override;
+        void WriteMultiline(std::string_view str) override;
+        void WriteWrapped(std::wstring_view str) override;
+        void WriteWrapped(std::string_view str) override;
         void WriteWrappedEnd(float max_width, bool justify_align = false, float first_row_offset = 0, float next_row_offset = 0) override;
-        void WriteWrappedMultiline(const std::wstring& str, float max_width, bool justify_align = false, float first_row_offset = 0, float next_row_offset = 0) override;
+        void WriteWrappedMultiline(std::wstring_view str, float max_width, bool justify_align = false, float first_row_offset = 0, float next_row_offset = 0) override;
+        void WriteWrappedMultiline(std::string_view str, float max_width, bool justify_align = false, float first_row_offset = 0, float next_row_offset = 0) override;
 
         ITextLinesPtr Finish() override;
 
         DefTextBuilder(Atlas_GlyphsSDF* atlas) : 
             m_atlas(atlas), 
+            m_font(nullptr),
             m_pos(0, 0),
             m_line_start(0),
             m_line_inited(false),
+            m_prev_char(0),
             m_color(1,1,1,1),
             m_font_size(32),
             m_sdf_offset(0),
@@ -361,40 +664,275 @@ namespace RA {
             m_italic(false),
             m_underline(false),
             m_strikeout(false),
+            m_kerning(true),
+            m_bidi(false),
             m_line_align(LineAlign::Left)
-        {};
+        {
+            m_memo_slots.assign(cMemoSlots, -1);
+        };
     };
 
     ITextBuilderPtr Create_TextBuilder(Atlas_GlyphsSDF* atlas)
     {
         return std::make_shared<DefTextBuilder>(atlas);
     }
+    uint32_t TextLayoutCache::Hash(std::wstring_view str, const FontParams& font, float max_width, LineAlign align, bool justify_align)
+    {
+        uint32_t h = MurmurHash2(str.data(), int(str.size() * sizeof(wchar_t)));
+        h = MurmurHash2(font.name.data(), int(font.name.size()), h);
+        const float params[7] = { font.color.x, font.color.y, font.color.z, font.color.w, font.size, font.sdf_offset, max_width };
+        h = MurmurHash2(params, sizeof(params), h);
+        uint32_t flags = (font.bold ? 1 : 0) | (font.italic ? 2 : 0) | (font.underline ? 4 : 0) | (font.striked ? 8 : 0) | (justify_align ? 16 : 0) | (uint32_t(align) << 5);
+        return MurmurHash2(&flags, sizeof(flags), h);
+    }
+    ITextLinesPtr TextLayoutCache::Obtain(std::wstring_view str, const FontParams& font, float max_width, LineAlign align, bool justify_align)
+    {
+        uint32_t h = Hash(str, font, max_width, align, justify_align);
+        auto range = m_entries.equal_range(h);
+        for (auto it = range.first; it != range.second; ++it) {
+            const Entry& e = *it->second;
+            if ((e.max_width == max_width) && (e.align == align) && (e.justify_align == justify_align) && (e.font == font) && (e.str == str)) {
+                m_lru.splice(m_lru.begin(), m_lru, it->second);
+                return std::make_shared<TextLinesView>(e.lines);
+            }
+        }
+
+        m_tb->Font_Set(font);
+        m_tb->SetLineAlign(align);
+        if (max_width > 0)
+            m_tb->WriteWrappedMultiline(str, max_width, justify_align);
+        else
+            m_tb->WriteMultiline(str);
+
+        Entry new_entry;
+        new_entry.hash = h;
+        new_entry.str = str;
+        new_entry.font = font;
+        new_entry.max_width = max_width;
+        new_entry.align = align;
+        new_entry.justify_align = justify_align;
+        new_entry.lines = m_tb->Finish();
+        m_lru.push_front(std::move(new_entry));
+        m_entries.emplace(h, m_lru.begin());
+
+        if (m_lru.size() > m_max_entries) {
+            auto last = std::prev(m_lru.end());
+            range = m_entries.equal_range(last->hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == last) {
+                    m_entries.erase(it);
+                    break;
+                }
+            }
+            m_lru.pop_back();
+        }
+        return std::make_shared<TextLinesView>(m_lru.front().lines);
+    }
+    void TextLayoutCache::Clear()
+    {
+        m_entries.clear();
+        m_lru.clear();
+    }
+    TextLayoutCache::TextLayoutCache(Atlas_GlyphsSDF* atlas, size_t max_entries) :
+        m_tb(Create_TextBuilder(atlas)),
+        m_max_entries(max_entries)
+    {
+    }
+    std::wstring_view VirtualTextLines::Line(int idx) const
+    {
+        size_t start = m_line_starts[idx];
+        size_t end = (idx + 1 < int(m_line_starts.size())) ? m_line_starts[size_t(idx) + 1] : m_text.size();
+        return std::wstring_view(m_text.data() + start, end - start);
+    }
+    void VirtualTextLines::LayoutChunk(Chunk& chunk)
+    {
+        m_tb->Font_Set(m_font);
+        m_tb->SetLineAlign(m_align);
+        for (int i = chunk.first_line; i < chunk.first_line + chunk.lines_count; i++) {
+            if (m_max_width > 0)
+                m_tb->WriteWrappedMultiline(Line(i), m_max_width);
+            else
+                m_tb->WriteMultiline(Line(i));
+        }
+        chunk.layout = m_tb->Finish();
+        m_layouts_count++;
+
+        float height = chunk.layout->TotalHeight();
+        chunk.measured = true;
+        if (height != chunk.height) {
+            chunk.height = height;
+            m_index_valid = false;
+        }
+        if (chunk.lines_count) m_line_height = height / chunk.lines_count;
+    }
+    void VirtualTextLines::ValidateIndex()
+    {
+        if (m_index_valid) return;
+        m_chunk_ypos.resize(m_chunks.size() + 1);
+        float y = 0;
+        for (size_t i = 0; i < m_chunks.size(); i++) {
+            if (!m_chunks[i].measured) m_chunks[i].height = m_chunks[i].lines_count * m_line_height;
+            m_chunk_ypos[i] = y;
+            y += m_chunks[i].height;
+        }
+        m_chunk_ypos.back() = y;
+        m_index_valid = true;
+    }
+    void VirtualTextLines::EvictLayouts()
+    {
+        while (m_layouts_count > m_max_layouts) {
+            Chunk* oldest = nullptr;
+            for (Chunk& chunk : m_chunks) {
+                if (chunk.layout && (chunk.last_used != m_frame) && (!oldest || (chunk.last_used < oldest->last_used)))
+                    oldest = &chunk;
+            }
+            if (!oldest) break;
+            //measured height stays, so the index doesn't move
+            oldest->layout = nullptr;
+            m_layouts_count--;
+        }
+    }
+    void VirtualTextLines::AppendLine(std::wstring_view line)
+    {
+        m_line_starts.push_back(m_text.size());
+        m_text.append(line);
+        if (m_chunks.empty() || (m_chunks.back().lines_count == cChunkLines)) {
+            Chunk new_chunk;
+            new_chunk.first_line = int(m_line_starts.size()) - 1;
+            new_chunk.lines_count = 0;
+            new_chunk.height = 0;
+            new_chunk.measured = false;
+            new_chunk.last_used = 0;
+            m_chunks.push_back(new_chunk);
+        }
+        Chunk& chunk = m_chunks.back();
+        chunk.lines_count++;
+        chunk.measured = false;
+        if (chunk.layout) {
+            chunk.layout = nullptr;
+            m_layouts_count--;
+        }
+        m_index_valid = false;
+    }
+    void VirtualTextLines::Clear()
+    {
+        m_text.clear();
+        m_line_starts.clear();
+        m_chunks.clear();
+        m_visible.clear();
+        m_layouts_count = 0;
+        m_index_valid = false;
+    }
+    int VirtualTextLines::LinesCount() const
+    {
+        return int(m_line_starts.size());
+    }
+    float VirtualTextLines::MaxWidth() const
+    {
+        return m_max_width;
+    }
+    float VirtualTextLines::TotalHeight()
+    {
+        ValidateIndex();
+        return m_chunk_ypos.back();
+    }
+    const std::vector<VirtualTextLines::Span>& VirtualTextLines::Visible(float y_min, float y_max)
+    {
+        m_visible.clear();
+        m_frame++;
+        ValidateIndex();
+
+        auto it = std::upper_bound(m_chunk_ypos.begin(), m_chunk_ypos.end() - 1, y_min);
+        int ci = glm::max(int(it - m_chunk_ypos.begin()) - 1, 0);
+        for (; (ci < int(m_chunks.size())) && (m_chunk_ypos[ci] < y_max); ci++) {
+            Chunk& chunk = m_chunks[ci];
+            if (!chunk.layout) {
+                LayoutChunk(chunk);
+                ValidateIndex();
+            }
+            chunk.last_used = m_frame;
+
+            const ITextLines* lines = chunk.layout.get();
+            float local_min = y_min - m_chunk_ypos[ci];
+            float local_max = y_max - m_chunk_ypos[ci];
+            int lines_count = lines->LinesCount();
+            //lines are sorted by y, so both ends of the visible range are binary searched
+            int first = 0;
+            int last = lines_count;
+            while (first < last) {
+                int mid = (first + last) / 2;
+                if (lines->LineYPos(mid) <= local_min) first = mid + 1; else last = mid;
+            }
+            last = lines_count;
+            int lo = first;
+            while (lo < last) {
+                int mid = (lo + last) / 2;
+                if (lines->LineYPos(mid) - lines->LineBounds(mid).y < local_max) lo = mid + 1; else last = mid;
+            }
+            if (first >= last) continue;
+
+            Span span;
+            span.lines = lines;
+            span.ypos = m_chunk_ypos[ci];
+            span.glyphs.x = lines->LineGlyphs(first).x;
+            span.glyphs.y = lines->LineGlyphs(last - 1).y - span.glyphs.x;
+            if (span.glyphs.y) m_visible.push_back(span);
+        }
+        EvictLayouts();
+        return m_visible;
+    }
+    VirtualTextLines::VirtualTextLines(Atlas_GlyphsSDF* atlas, const FontParams& font, float max_width, LineAlign align, int max_layouts) :
+        m_tb(Create_TextBuilder(atlas)),
+        m_font(font),
+        m_max_width(max_width),
+        m_align(align),
+        m_max_layouts(max_layouts),
+        m_index_valid(false),
+        m_line_height(font.size),
+        m_frame(0),
+        m_layouts_count(0)
+    {
+    }
     void RegisterFont(const std::filesystem::path& fname)
     {
         AddFontResourceExW(fname.c_str(), FR_PRIVATE, 0);
     }
-    Sprite_GlyphPtr DefTextBuilder::ObtainSprite(wchar_t w)
+    Sprite_Glyph* DefTextBuilder::ObtainSprite(uint32_t w)
     {
-        return m_atlas->ObtainSprite(m_fontname.c_str(), w, m_bold, m_italic, m_underline, m_strikeout);
+        if (!m_font) m_font = m_atlas->ObtainFont(m_fontname.c_str(), m_bold, m_italic, m_underline, m_strikeout);
+        return m_atlas->ObtainSprite(m_font, w);
+    }
+    glm::vec3 DefTextBuilder::GlyphXXX(const Sprite_Glyph* glyph, uint32_t prev, uint32_t w)
+    {
+        glm::vec3 xxx = glyph->XXXMetricsScaled(m_font_size);
+        if (m_kerning && prev) {
+            //pair adjustment is folded into the left bearing, so all width/advance math below picks it up
+            xxx.x += m_font->Kerning(prev, w) * (m_font_size / cFontSize);
+        }
+        return xxx;
     }
     void DefTextBuilder::InitLine()
     {
         if (!m_line_inited) {
             m_line_inited = true;
+            m_prev_char = 0;
             m_line_start = int(m_glyphs.size());
             m_line_info.align = m_line_align;
             m_line_info.width = 0;
             m_line_info.glyphs = { m_glyphs.size(), m_glyphs.size() };
-            m_line_info.xxxmetrics.clear();
         }
     }
-    glm::vec2 DefTextBuilder::CalcBounds(const std::wstring& str)
+    template<typename Str>
+    glm::vec2 DefTextBuilder::CalcBounds(Str str)
     {
         glm::vec2 result = { 0,0 };
         glm::vec2 yy = { 0,0 };
-        for (const auto& w : str) {
-            Sprite_GlyphPtr glyph = ObtainSprite(w);
-            glm::vec3 xxx = glyph->XXXMetricsScaled(m_font_size);
+        uint32_t prev = 0;
+        for (size_t i = 0; i < str.size();) {
+            uint32_t w = NextCodePoint(str, i);
+            Sprite_Glyph* glyph = ObtainSprite(w);
+            glm::vec3 xxx = GlyphXXX(glyph, prev, w);
+            prev = w;
             glm::vec4 yyyy = glyph->YYYYMetricsScaled(m_font_size);
             yy = glm::max(yy, glm::vec2(yyyy.x + yyyy.y, yyyy.z + yyyy.w));
             result.x = result.x + xxx.x + xxx.y + xxx.z;
@@ -402,28 +940,99 @@ namespace RA {
         result.y = yy.x + yy.y;
         return result;
     }
-    void DefTextBuilder::WriteWordInternal(const std::wstring& str)
+    template<typename Str>
+    uint32_t DefTextBuilder::MeasuredRunHash(Str str) const
+    {
+        uint32_t h = MurmurHash2(str.data(), int(str.size() * sizeof(typename Str::value_type)));
+        const float params[6] = { m_color.x, m_color.y, m_color.z, m_color.w, m_font_size, m_sdf_offset };
+        h = MurmurHash2(params, sizeof(params), h);
+        return h ^ uint32_t(std::hash<const void*>()(m_font)) ^ (m_kerning ? 1u : 0u) ^ (m_bidi ? 2u : 0u);
+    }
+    template<typename Str>
+    bool DefTextBuilder::IsSameRun(const MeasuredRun& run, Str str) const
+    {
+        constexpr bool utf8 = std::is_same_v<Str, std::string_view>;
+        return (run.utf8 == utf8) &&
+               (run.font == m_font) &&
+               (run.color == m_color) &&
+               (run.font_size == m_font_size) &&
+               (run.sdf_offset == m_sdf_offset) &&
+               (run.kerning == m_kerning) &&
+               (run.bidi == m_bidi) &&
+               (std::string_view(m_memo_chars.data() + run.str_first, run.str_size) ==
+                std::string_view((const char*)str.data(), str.size() * sizeof(typename Str::value_type)));
+    }
+    template<typename Str>
+    int DefTextBuilder::ObtainMeasuredRun(Str str)
+    {
+        uint32_t h = MeasuredRunHash(str);
+        const uint32_t mask = cMemoSlots - 1;
+        uint32_t slot = h & mask;
+        for (; m_memo_slots[slot] >= 0; slot = (slot + 1) & mask) {
+            const MeasuredRun& run = m_memo_runs[m_memo_slots[slot]];
+            if ((run.hash == h) && IsSameRun(run, str)) return m_memo_slots[slot];
+        }
+        MeasuredRun run;
+        run.hash = h;
+        run.str_first = int(m_memo_chars.size());
+        run.str_size = int(str.size() * sizeof(typename Str::value_type));
+        m_memo_chars.insert(m_memo_chars.end(), (const char*)str.data(), (const char*)str.data() + run.str_size);
+        run.utf8 = std::is_same_v<Str, std::string_view>;
+        run.font = m_font;
+        run.color = m_color;
+        run.font_size = m_font_size;
+        run.sdf_offset = m_sdf_offset;
+        run.kerning = m_kerning;
+        run.bidi = m_bidi;
+        run.words_first = int(m_memo_words.size());
+        MeasureWords(str);
+        run.words_count = int(m_memo_words.size()) - run.words_first;
+        //the table is at most half full, runs of a paragraph past that are measured but not remembered
+        if (int(m_memo_runs.size()) < cMemoSlots / 2)
+            m_memo_slots[slot] = int(m_memo_runs.size());
+        m_memo_runs.push_back(run);
+        return int(m_memo_runs.size()) - 1;
+    }
+    void DefTextBuilder::ClearMeasuredRuns()
+    {
+        m_memo_runs.clear();
+        std::fill(m_memo_slots.begin(), m_memo_slots.end(), -1);
+        m_memo_chars.clear();
+        m_memo_words.clear();
+        m_memo_glyphs.clear();
+        m_memo_xxxmetrics.clear();
+        m_memo_yyyymetrics.clear();
+    }
+    template<typename Str>
+    void DefTextBuilder::WriteWordInternal(Str str, int spaces)
     {
         WordInfo word;
+        word.first = int(m_memo_glyphs.size());
+        word.direction = 0;
         word.yymetrics = { 0,0 };
         word.xxxspace = { 0,0,0 };
         word.width = 0;
 
-        Sprite_GlyphPtr dummy = ObtainSprite(' ');
-        glm::vec3 xxx = dummy->XXXMetricsScaled(m_font_size);
-        glm::vec4 yyyy = dummy->YYYYMetricsScaled(m_font_size);
-        word.xxxspace = xxx;
+        if (spaces) {
+            Sprite_Glyph* dummy = ObtainSprite(' ');
+            word.xxxspace = dummy->XXXMetricsScaled(m_font_size);
+            word.xxxspace.z += (spaces - 1) * (word.xxxspace.x + word.xxxspace.y + word.xxxspace.z);
+        }
 
         float posx = 0;
-        for (wchar_t w : str) {
-            Sprite_GlyphPtr glyph = ObtainSprite(w);
-            glm::vec3 xxx = glyph->XXXMetricsScaled(m_font_size);
+        uint32_t prev = 0;
+        for (size_t i = 0; i < str.size();) {
+            uint32_t w = NextCodePoint(str, i);
+            if (!word.direction) word.direction = StrongDirection(w, LineBreakClass(w));
+            Sprite_Glyph* glyph = ObtainSprite(w);
+            glm::vec3 xxx = GlyphXXX(glyph, prev, w);
+            prev = w;
             glm::vec4 yyyy = glyph->YYYYMetricsScaled(m_font_size);
 
             TextGlyphVertex gv;
-            word.yyyymetrics.push_back(yyyy);
+            m_memo_yyyymetrics.push_back(yyyy);
             word.width = word.width + xxx.x + xxx.y + xxx.z;
-            word.xxxmetrics.push_back(xxx);
+            m_memo_xxxmetrics.push_back(xxx);
 
             posx += xxx.x + xxx.y * 0.5f;
             gv.pos.x = posx;
@@ -442,20 +1051,63 @@ namespace RA {
 
             word.yymetrics = glm::max(word.yymetrics, glm::vec2(yyyy.x + yyyy.y, yyyy.z + yyyy.w));
 
-            word.glyphs.push_back(gv);
+            m_memo_glyphs.push_back(gv);
+        }
+        word.count = int(m_memo_glyphs.size()) - word.first;
+        if (m_bidi && (word.direction < 0)) {
+            //visual order of a right-to-left word is mirrored, glyph positions are centers
+            for (int k = word.first; k < word.first + word.count; k++)
+                m_memo_glyphs[k].pos.x = word.width - m_memo_glyphs[k].pos.x;
         }
-        m_wrapped_words.push_back(std::move(word));
+        m_memo_words.push_back(word);
+    }
+    template<typename Str>
+    void DefTextBuilder::MeasureWords(Str str)
+    {
+        ForEachWord(str, [this](Str word, int spaces) { WriteWordInternal(word, spaces); });
     }
-    void DefTextBuilder::WriteInternal(const std::wstring& str)
+    void DefTextBuilder::ReorderLine(int first, int count)
+    {
+        m_wrapped_order.clear();
+        for (int j = 0; j < count; j++)
+            m_wrapped_order.push_back(first + j);
+        if (!m_bidi) return;
+
+        //simplified UBA with left-to-right base direction: neutral words between two
+        //right-to-left words join them, then every right-to-left run is reversed
+        auto IsRTL = [this, first, count](int j)->bool {
+            int dir = WrappedWord(first + j).direction;
+            if (dir) return dir < 0;
+            int prev_dir = 0;
+            for (int k = j - 1; (k >= 0) && !prev_dir; k--) prev_dir = WrappedWord(first + k).direction;
+            int next_dir = 0;
+            for (int k = j + 1; (k < count) && !next_dir; k++) next_dir = WrappedWord(first + k).direction;
+            return (prev_dir < 0) && (next_dir < 0);
+        };
+        int j = 0;
+        while (j < count) {
+            if (!IsRTL(j)) {
+                j++;
+                continue;
+            }
+            int run_end = j + 1;
+            while ((run_end < count) && IsRTL(run_end)) run_end++;
+            std::reverse(m_wrapped_order.begin() + j, m_wrapped_order.begin() + run_end);
+            j = run_end;
+        }
+    }
+    template<typename Str>
+    void DefTextBuilder::WriteInternal(Str str)
     {
         InitLine();
-        for (wchar_t w : str) {
-            Sprite_GlyphPtr glyph = ObtainSprite(w);
-            glm::vec3 xxx = glyph->XXXMetricsScaled(m_font_size);
+        for (size_t i = 0; i < str.size();) {
+            uint32_t w = NextCodePoint(str, i);
+            Sprite_Glyph* glyph = ObtainSprite(w);
+            glm::vec3 xxx = GlyphXXX(glyph, m_prev_char, w);
+            m_prev_char = w;
             glm::vec4 yyyy = glyph->YYYYMetricsScaled(m_font_size);
             m_line_yyyy_metrics.push_back(yyyy);
             m_line_info.width += xxx.x + xxx.y + xxx.z;
-            m_line_info.xxxmetrics.push_back(xxx);
 
             TextGlyphVertex gv;
             m_pos.x += xxx.x + xxx.y * 0.5f;
@@ -510,7 +1162,7 @@ namespace RA {
             m_line_info.glyphs.y = int(m_glyphs.size());
             m_line_info.ypos = m_pos.y + m_line_info.yymetrics.x + m_line_info.yymetrics.y;
             m_pos.y += m_line_info.yymetrics.x + m_line_info.yymetrics.y;
-            m_lines.push_back(std::move(m_line_info));
+            m_lines.push_back(m_line_info);
             m_line_info.yymetrics = { 0,0 };
             m_line_yyyy_metrics.clear();
         }
@@ -520,30 +1172,57 @@ namespace RA {
     void DefTextBuilder::WriteSpace(float space)
     {
         InitLine();
+        m_prev_char = 0;
         m_line_info.width += space;
         m_pos.x += space;
     }
-    void DefTextBuilder::Write(const std::wstring& str)
+    void DefTextBuilder::Write(std::wstring_view str)
+    {
+        WriteInternal(str);
+    }
+    void DefTextBuilder::Write(std::string_view str)
+    {
+        WriteInternal(str);
+    }
+    void DefTextBuilder::WriteLine(std::wstring_view str)
     {
         WriteInternal(str);
+        WriteLnInternal();
     }
-    void DefTextBuilder::WriteLine(const std::wstring& str)
+    void DefTextBuilder::WriteLine(std::string_view str)
     {
         WriteInternal(str);
         WriteLnInternal();
     }
-    void DefTextBuilder::WriteMultiline(const std::wstring& str)
+    void DefTextBuilder::WriteMultiline(std::wstring_view str)
     {
-        SplitString(str, L"\n", [this](std::wstring line, wchar_t sep) {
+        SplitString(str, L'\n', [this](std::wstring_view line, wchar_t sep) {
                 WriteLine(line);
             });
     }
-    void DefTextBuilder::WriteWrapped(const std::wstring& str)
+    void DefTextBuilder::WriteMultiline(std::string_view str)
     {
-        SplitString(str, L" ", [this](std::wstring line, wchar_t sep) {
-                WriteWordInternal(line);
+        SplitString(str, '\n', [this](std::string_view line, char sep) {
+                WriteLine(line);
             });
     }
+    void DefTextBuilder::WriteWrapped(std::wstring_view str)
+    {
+        WriteWrappedInternal(str);
+    }
+    void DefTextBuilder::WriteWrapped(std::string_view str)
+    {
+        WriteWrappedInternal(str);
+    }
+    template<typename Str>
+    void DefTextBuilder::WriteWrappedInternal(Str str)
+    {
+        if (!m_font) m_font = m_atlas->ObtainFont(m_fontname.c_str(), m_bold, m_italic, m_underline, m_strikeout);
+
+        const MeasuredRun& run = m_memo_runs[ObtainMeasuredRun(str)];
+        for (int i = run.words_first; i < run.words_first + run.words_count; i++)
+            m_wrapped_words.push_back(i);
+    }
     void DefTextBuilder::WriteWrappedEnd(float max_width, bool justify_align, float first_row_offset, float next_row_offset)
     {
         if (m_line_inited)
@@ -553,19 +1232,23 @@ namespace RA {
             next_row_offset = 0;
         }
 
-        std::vector<glm::ivec2> lines;
+        std::vector<glm::ivec2>& lines = m_wrapped_lines;
+        lines.clear();
         float remain_width = 0;
+        glm::vec3 prev_space = { 0,0,0 };
         for (size_t i = 0; i < m_wrapped_words.size(); i++) {
-            const WordInfo& word = m_wrapped_words[i];
+            const WordInfo& word = WrappedWord(int(i));
             bool is_new_line = false;
-            if (remain_width < word.width + word.xxxspace.x + word.xxxspace.y * 0.5) {
+            //leading spaces give an empty first word, so the first line is opened unconditionally
+            if (lines.empty() || (remain_width < word.width + prev_space.x + prev_space.y * 0.5f)) {
                 remain_width = max_width - ((i > 0) ? next_row_offset : first_row_offset);
                 lines.push_back(glm::ivec2(i, 0));
                 is_new_line = true;
             }
             remain_width -= (is_new_line)
                                 ? (word.width + word.xxxspace.y * 0.5f + word.xxxspace.z)
-                                : (word.width + word.xxxspace.x + word.xxxspace.y + word.xxxspace.z);
+                                : (prev_space.x + prev_space.y * 0.5f + word.width + word.xxxspace.y * 0.5f + word.xxxspace.z);
+            prev_space = word.xxxspace;
             lines.back() += glm::ivec2(0, 1);
         }
 
@@ -577,29 +1260,29 @@ namespace RA {
             if (justify_align) {
                 float curr_line_width = 0;
                 for (int j = 0; j < lines[i].y; j++)
-                    curr_line_width += m_wrapped_words[lines[i].x + j].width;                    
+                    curr_line_width += WrappedWord(lines[i].x + j).width;
                 justify_space = (max_width - offset - curr_line_width) / (lines[i].y - 1.0f) * 0.5f;
             }
 
+            ReorderLine(lines[i].x, lines[i].y);
             const WordInfo* pw = nullptr;
             WriteSpace(offset);
             for (int j = 0; j < lines[i].y; j++) {
                 if (pw) {
                     WriteSpace(justify_align ? justify_space : (pw->xxxspace.x + pw->xxxspace.y * 0.5f));
                 }
-                pw = &m_wrapped_words[lines[i].x + j];
+                pw = &WrappedWord(m_wrapped_order[j]);
                 float xoffset = m_pos.x;
-                for (size_t k = 0; k < pw->glyphs.size(); k++) {
-                    TextGlyphVertex glyph = pw->glyphs[k];
+                for (int k = pw->first; k < pw->first + pw->count; k++) {
+                    TextGlyphVertex glyph = m_memo_glyphs[k];
                     glyph.pos.x = glyph.pos.x + xoffset;
                     m_glyphs.push_back(glyph);
 
-                    glm::vec4 yyyy = pw->yyyymetrics[k];
-                    glm::vec3 xxx = pw->xxxmetrics[k];
+                    glm::vec4 yyyy = m_memo_yyyymetrics[k];
+                    glm::vec3 xxx = m_memo_xxxmetrics[k];
 
                     m_line_yyyy_metrics.push_back(yyyy);
                     m_line_info.width += xxx.x + xxx.y + xxx.z;
-                    m_line_info.xxxmetrics.push_back(xxx);
                     m_pos.x += xxx.x + xxx.y + xxx.z;
                     m_line_info.yymetrics = glm::max(m_line_info.yymetrics, { yyyy.x + yyyy.y, yyyy.z + yyyy.w });
                 }
@@ -610,10 +1293,23 @@ namespace RA {
             WriteLnInternal();
         }
         m_wrapped_words.clear();
+        //words are referenced by index until here, so the memo may only be dropped after the paragraph is out.
+        //Clearing keeps the capacity, refilling it allocates nothing
+        if ((int(m_memo_runs.size()) > cMaxMeasuredRuns) || (int(m_memo_glyphs.size()) > cMaxMeasuredGlyphs))
+            ClearMeasuredRuns();
+    }
+    void DefTextBuilder::WriteWrappedMultiline(std::wstring_view str, float max_width, bool justify_align, float first_row_offset, float next_row_offset)
+    {
+        WriteWrappedMultilineInternal(str, max_width, justify_align, first_row_offset, next_row_offset);
+    }
+    void DefTextBuilder::WriteWrappedMultiline(std::string_view str, float max_width, bool justify_align, float first_row_offset, float next_row_offset)
+    {
+        WriteWrappedMultilineInternal(str, max_width, justify_align, first_row_offset, next_row_offset);
     }
-    void DefTextBuilder::WriteWrappedMultiline(const std::wstring& str, float max_width, bool justify_align, float first_row_offset, float next_row_offset)
+    template<typename Str>
+    void DefTextBuilder::WriteWrappedMultilineInternal(Str str, float max_width, bool justify_align, float first_row_offset, float next_row_offset)
     {
-        SplitString(str, L"\n", [this, max_width, justify_align, first_row_offset, next_row_offset](std::wstring line, wchar_t sep) {
+        SplitString(str, '\n', [this, max_width, justify_align, first_row_offset, next_row_offset](Str line, typename Str::value_type sep) {
             WriteWrapped(line);
             WriteWrappedEnd(max_width, justify_align, first_row_offset, next_row_offset);
             });
@@ -621,9 +1317,14 @@ namespace RA {
     ITextLinesPtr DefTextBuilder::Finish()
     {
         if (m_line_inited) WriteLnInternal();
+        //glyphs and lines are owned by the result, reserve what this layout needed for the next one
+        size_t glyphs_count = m_glyphs.size();
+        size_t lines_count = m_lines.size();
         ITextLinesPtr res = std::make_shared<DefTextLines>(std::move(m_glyphs), std::move(m_lines));
         m_glyphs.clear();
         m_lines.clear();
+        m_glyphs.reserve(glyphs_count);
+        m_lines.reserve(lines_count);
         m_line_inited = false;
         m_line_start = 0;
         m_line_yyyy_metrics.clear();
@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "RSystems.h"
+#include <cstring>
 
 namespace RA {
     MeshCollection::AVMScene::AVMScene(const fs::path& p)
@@ -93,6 +94,103 @@ namespace RA {
         }
         return it->second->SPtr();
     }
+    static void PushSortItem(std::vector<MCDrawSortItem>& items, uint64_t key, uint32_t idx)
+    {
+        //instances of one mesh usually come in runs, so they are merged before sorting
+        if (items.size()) {
+            MCDrawSortItem& last = items.back();
+            if ((last.key == key) && (last.first_instance + last.instances_count == idx)) {
+                last.instances_count++;
+                return;
+            }
+        }
+        items.push_back({ key, idx, 1 });
+    }
+    static void RadixSort(std::vector<MCDrawSortItem>& items, std::vector<MCDrawSortItem>& tmp)
+    {
+        //lsd radix sort, stable, so the input order is kept for equal keys.
+        //keys are compacted first: in every field (mesh, albedo, group) bits above and below the ones 
+        //that differ between keys are dropped, so there are one or two digits to sort usually.
+        //the first histogram is built while compacting, original keys are restored by the last scatter
+        const int cDigitBits = 11;
+        const uint64_t cDigitMask = (1 << cDigitBits) - 1;
+        uint32_t n = uint32_t(items.size());
+        if (n < 2) return;
+        uint64_t key_or = 0;
+        uint64_t key_and = ~uint64_t(0);
+        for (const auto& item : items) {
+            key_or |= item.key;
+            key_and &= item.key;
+        }
+        uint64_t diff = key_or ^ key_and;
+        if (!diff) return;
+
+        const int cFieldShift[3] = { 0, 16, 32 };
+        const int cFieldBits[3] = { 16, 16, 32 };
+        int shift[3];    //first varying bit of the field in the key
+        uint64_t mask[3];
+        int pos[3];      //first bit of the field in the compacted key
+        int total_bits = 0;
+        uint64_t spans_mask = 0;
+        for (int f = 0; f < 3; f++) {
+            uint64_t d = (diff >> cFieldShift[f]) & ((uint64_t(1) << cFieldBits[f]) - 1);
+            int lo = 0;
+            int hi = -1;
+            if (d) {
+                while (!((d >> lo) & 1)) lo++;
+                hi = cFieldBits[f] - 1;
+                while (!((d >> hi) & 1)) hi--;
+            }
+            shift[f] = cFieldShift[f] + lo;
+            mask[f] = (uint64_t(1) << (hi - lo + 1)) - 1;
+            pos[f] = total_bits;
+            total_bits += hi - lo + 1;
+            spans_mask |= mask[f] << shift[f];
+        }
+        const uint64_t const_bits = key_and & ~spans_mask; //the same in all keys
+
+        uint32_t hist[1 << cDigitBits] = {};
+        for (auto& item : items) {
+            uint64_t k = item.key;
+            k = (((k >> shift[0]) & mask[0]) << pos[0]) | 
+                (((k >> shift[1]) & mask[1]) << pos[1]) | 
+                (((k >> shift[2]) & mask[2]) << pos[2]);
+            item.key = k;
+            hist[k & cDigitMask]++;
+        }
+        tmp.resize(n);
+        for (int digit = 0; digit < total_bits; digit += cDigitBits) {
+            if (digit) {
+                memset(hist, 0, sizeof(hist));
+                for (const auto& item : items) {
+                    hist[(item.key >> digit) & cDigitMask]++;
+                }
+            }
+            uint32_t sum = 0;
+            for (uint32_t i = 0; i <= cDigitMask; i++) {
+                uint32_t c = hist[i];
+                hist[i] = sum;
+                sum += c;
+            }
+            if (digit + cDigitBits < total_bits) {
+                for (const auto& item : items) {
+                    tmp[hist[(item.key >> digit) & cDigitMask]++] = item;
+                }
+            }
+            else {
+                for (const auto& item : items) {
+                    uint64_t k = item.key;
+                    MCDrawSortItem& dst = tmp[hist[(k >> digit) & cDigitMask]++];
+                    dst = item;
+                    dst.key = const_bits | 
+                              (((k >> pos[0]) & mask[0]) << shift[0]) | 
+                              (((k >> pos[1]) & mask[1]) << shift[1]) | 
+                              (((k >> pos[2]) & mask[2]) << shift[2]);
+                }
+            }
+            items.swap(tmp);
+        }
+    }
     void MeshCollection::PrepareBuffers(MeshCollectionBuffers* bufs, MeshCollectionDrawCommands* draw_commands)
     {
         PrepareBuffers(m_instances, bufs, draw_commands);
@@ -100,22 +198,26 @@ namespace RA {
     void MeshCollection::PrepareBuffers(const std::vector<MCMeshInstance*>& instances, MeshCollectionBuffers* bufs, MeshCollectionDrawCommands* draw_commands)
     {
         ValidateArmatures();
+        ValidateInstances();
+        ValidateBindTransforms();
         FillBuffers(bufs);
+        draw_commands->sort_items.clear();
         for (const auto& inst : instances) {
-            RA::Texture2DPtr albedo_tex;
-            auto cmd = GetDrawCommand(inst, albedo_tex);
-            draw_commands->commands[inst->GetGroupID()][albedo_tex].push_back(cmd);
+            PushSortItem(draw_commands->sort_items, inst->DrawSortKey(), uint32_t(inst->m_idx));
         }
+        BuildDrawCommands(draw_commands);
     }
     void MeshCollection::PrepareBuffers(const std::vector<MCMeshInstancePtr>& instances, MeshCollectionBuffers* bufs, MeshCollectionDrawCommands* draw_commands)
     {
         ValidateArmatures();
+        ValidateInstances();
+        ValidateBindTransforms();
         FillBuffers(bufs);
+        draw_commands->sort_items.clear();
         for (const auto& inst : instances) {
-            RA::Texture2DPtr albedo_tex;
-            auto cmd = GetDrawCommand(inst.get(), albedo_tex);
-            draw_commands->commands[inst->GetGroupID()][albedo_tex].push_back(cmd);
+            PushSortItem(draw_commands->sort_items, inst->DrawSortKey(), uint32_t(inst->m_idx));
         }
+        BuildDrawCommands(draw_commands);
     }
     MCArmaturePtr MeshCollection::Create_Armature(const fs::path& filename, const std::string& armature_name)
     {
@@ -166,6 +268,151 @@ namespace RA {
         }
         m_dirty_armatures.clear();
     }
+    void MeshCollection::AddInstance(MCMeshInstance* inst)
+    {
+        inst->m_idx = int(m_instances.size());
+        m_instances.push_back(inst);
+        m_inst_transforms.emplace_back(1.0f);
+        m_inst_offsets.emplace_back(-1, 0, 0, 0);
+        m_inst_dirty.resize((m_instances.size() + 63) / 64, 0);
+        if (int(m_instances.size()) > m_inst_vbuf->VertexCount()) m_inst_vbuf_valid = false;
+    }
+    void MeshCollection::RemoveInstance(MCMeshInstance* inst)
+    {
+        int idx = inst->m_idx;
+        int last = int(m_instances.size()) - 1;
+        ReleaseBindTransform(m_inst_offsets[idx].x);
+        if (idx != last) {
+            m_instances[idx] = m_instances[last];
+            m_instances[idx]->m_idx = idx;
+            m_inst_transforms[idx] = m_inst_transforms[last];
+            m_inst_offsets[idx] = m_inst_offsets[last];
+            MarkInstanceDirty(idx);
+        }
+        m_inst_dirty[last >> 6] &= ~(uint64_t(1) << (last & 63));
+        m_instances.pop_back();
+        m_inst_transforms.pop_back();
+        m_inst_offsets.pop_back();
+        m_inst_dirty.resize((m_instances.size() + 63) / 64);
+    }
+    void MeshCollection::MarkInstanceDirty(int idx)
+    {
+        m_inst_dirty[idx >> 6] |= uint64_t(1) << (idx & 63);
+    }
+    void MeshCollection::ValidateInstances()
+    {
+        int count = int(m_instances.size());
+        int first = count;
+        int last = -1;
+        if (!m_inst_vbuf_valid) {
+            first = 0;
+            last = count - 1;
+        }
+        else {
+            //one upload of the span between the first and the last dirty instances
+            int words = int(m_inst_dirty.size());
+            int w = 0;
+            while ((w < words) && !m_inst_dirty[w]) w++;
+            if (w == words) return;
+            first = w * 64;
+            while (!(m_inst_dirty[w] & (uint64_t(1) << (first & 63)))) first++;
+            w = words - 1;
+            while (!m_inst_dirty[w]) w--;
+            last = w * 64 + 63;
+            while (!(m_inst_dirty[w] & (uint64_t(1) << (last & 63)))) last--;
+        }
+        std::fill(m_inst_dirty.begin(), m_inst_dirty.end(), 0);
+        if (last < first) return;
+
+        if (m_half_instances) {
+            m_inst_staging.resize(size_t(last - first + 1) * sizeof(MCMeshInstanceVertexHalf));
+            MCMeshInstanceVertexHalf* verts = (MCMeshInstanceVertexHalf*)m_inst_staging.data();
+            for (int i = first; i <= last; i++) {
+                MCMeshInstanceVertexHalf& v = verts[i - first];
+                v.transform = MCAffineHalf::Pack(m_inst_transforms[i]);
+                v.bind_idx = m_inst_offsets[i].x;
+                v.materials_offset = m_inst_offsets[i].y;
+                v.bone_offset = m_inst_offsets[i].z;
+                v.bone_remap_offset = m_inst_offsets[i].w;
+            }
+        }
+        else {
+            m_inst_staging.resize(size_t(last - first + 1) * sizeof(MCMeshInstanceVertex));
+            MCMeshInstanceVertex* verts = (MCMeshInstanceVertex*)m_inst_staging.data();
+            for (int i = first; i <= last; i++) {
+                MCMeshInstanceVertex& v = verts[i - first];
+                v.transform = MCAffine::Pack(m_inst_transforms[i]);
+                v.bind_idx = m_inst_offsets[i].x;
+                v.materials_offset = m_inst_offsets[i].y;
+                v.bone_offset = m_inst_offsets[i].z;
+                v.bone_remap_offset = m_inst_offsets[i].w;
+            }
+        }
+        if (!m_inst_vbuf_valid) {
+            m_inst_vbuf_valid = true;
+            int capacity = m_inst_vbuf->VertexCount();
+            if (capacity < count) {
+                m_inst_vbuf->SetState(m_inst_vbuf->GetLayout(), glm::nextPowerOfTwo(count), nullptr);
+            }
+        }
+        m_inst_vbuf->SetSubData(first, last - first + 1, m_inst_staging.data());
+    }
+    int MeshCollection::AcquireBindTransform(const glm::mat4& m)
+    {
+        auto it = m_bind_lookup.find(m);
+        if (it != m_bind_lookup.end()) {
+            m_bind_transforms[it->second].refs++;
+            return it->second;
+        }
+        int idx;
+        if (m_bind_free.size()) {
+            idx = m_bind_free.back();
+            m_bind_free.pop_back();
+        }
+        else {
+            idx = int(m_bind_transforms.size());
+            m_bind_transforms.emplace_back();
+        }
+        m_bind_transforms[idx].m = m;
+        m_bind_transforms[idx].refs = 1;
+        m_bind_lookup.insert({ m, idx });
+        m_bind_buf_valid = false;
+        return idx;
+    }
+    void MeshCollection::ReleaseBindTransform(int idx)
+    {
+        if (idx < 0) return;
+        BindTransform& bt = m_bind_transforms[idx];
+        if (--bt.refs) return;
+        m_bind_lookup.erase(bt.m);
+        m_bind_free.push_back(idx);
+    }
+    void MeshCollection::ValidateBindTransforms()
+    {
+        //the table is as small as the number of armatures, so it's uploaded as a whole
+        if (m_bind_buf_valid) return;
+        m_bind_buf_valid = true;
+        std::vector<MCAffine> data;
+        data.reserve(m_bind_transforms.size());
+        for (const auto& bt : m_bind_transforms) {
+            data.push_back(MCAffine::Pack(bt.m));
+        }
+        m_bind_buf->SetState(sizeof(MCAffine), int(data.size()), false, false, data.size() ? data.data() : nullptr);
+    }
+    const Layout* MeshCollection::InstanceLayout() const
+    {
+        return m_inst_vbuf->GetLayout();
+    }
+    void MeshCollection::SetTransforms(MCMeshInstance* const* instances, const glm::mat4* transforms, int count)
+    {
+        for (int i = 0; i < count; i++) {
+            MCMeshInstance* inst = instances[i];
+            assert(inst->m_sys == this);
+            inst->m_inst->SetTransform(transforms[i]);
+            m_inst_transforms[inst->m_idx] = transforms[i];
+            MarkInstanceDirty(inst->m_idx);
+        }
+    }
     void MeshCollection::FillBuffers(MeshCollectionBuffers* bufs)
     {
         bufs->vertices = &m_mesh_vbuf;
@@ -174,6 +421,7 @@ namespace RA {
         bufs->instances = &m_inst_vbuf;
         bufs->bones = &m_bones;
         bufs->bones_remap = &m_bone_remap;
+        bufs->bind_transforms = &m_bind_buf;
     }
     RA::Texture2DPtr MeshCollection::ObtainTexture(const std::filesystem::path& path, bool srgb)
     {
@@ -191,6 +439,71 @@ namespace RA {
         }        
         return it->second;
     }
+    uint32_t MeshCollection::AcquireMeshSortID(const Texture2DPtr& albedo)
+    {
+        //ids are 16 bit fields of the draw sort key
+        Texture2D* tex = albedo ? albedo.get() : m_tex_white_pixel.get();
+        auto it = m_sort_tex_ids.find(tex);
+        uint32_t tex_id;
+        if (it == m_sort_tex_ids.end()) {
+            tex_id = uint32_t(m_sort_textures.size());
+            if (tex_id > 0xFFFF) throw std::runtime_error("too many albedo textures in mesh collection");
+            m_sort_tex_ids.insert({ tex, tex_id });
+            m_sort_textures.push_back(albedo ? albedo : m_tex_white_pixel);
+        }
+        else {
+            tex_id = it->second;
+        }
+        uint32_t mesh_id;
+        if (m_sort_mesh_free.size()) {
+            mesh_id = m_sort_mesh_free.back();
+            m_sort_mesh_free.pop_back();
+        }
+        else {
+            if (m_sort_mesh_next > 0xFFFF) throw std::runtime_error("too many meshes in mesh collection");
+            mesh_id = m_sort_mesh_next++;
+        }
+        return (tex_id << 16) | mesh_id;
+    }
+    void MeshCollection::ReleaseMeshSortID(uint32_t sort_id)
+    {
+        m_sort_mesh_free.push_back(sort_id & 0xFFFF);
+    }
+    void MeshCollection::BuildDrawCommands(MeshCollectionDrawCommands* draw_commands)
+    {
+        auto& items = draw_commands->sort_items;
+        auto& cmds = draw_commands->commands;
+        auto& batches = draw_commands->batches;
+        RadixSort(items, draw_commands->sort_tmp);
+        cmds.clear();
+        batches.clear();
+        uint64_t cmd_key = ~uint64_t(0);
+        uint64_t batch_key = ~uint64_t(0);
+        for (const auto& item : items) {
+            if (item.key == cmd_key) {
+                //same mesh, only instances differ
+                DrawIndexedCmd& cmd = cmds.back();
+                if (cmd.BaseInstance + cmd.InstanceCount == item.first_instance) {
+                    cmd.InstanceCount += item.instances_count;
+                }
+                else {
+                    cmds.push_back(cmd);
+                    cmds.back().BaseInstance = item.first_instance;
+                    cmds.back().InstanceCount = item.instances_count;
+                    batches.back().commands_count++;
+                }
+                continue;
+            }
+            cmd_key = item.key;
+            if ((item.key >> 16) != batch_key) {
+                batch_key = item.key >> 16;
+                batches.push_back({ uint32_t(item.key >> 32), m_sort_textures[batch_key & 0xFFFF], int(cmds.size()), 0 });
+            }
+            cmds.push_back(GetDrawCommand(m_instances[item.first_instance]));
+            cmds.back().InstanceCount = item.instances_count;
+            batches.back().commands_count++;
+        }
+    }
     DrawIndexedCmd MeshCollection::GetDrawCommand(MCMeshInstance* inst)
     {
         DrawIndexedCmd cmd;
@@ -201,12 +514,6 @@ namespace RA {
         cmd.InstanceCount = 1;        
         return cmd;
     }
-    DrawIndexedCmd MeshCollection::GetDrawCommand(MCMeshInstance* inst, Texture2DPtr& albedo)
-    {
-        albedo = inst->m_mesh->Albedo();
-        if (albedo == nullptr) albedo = m_tex_white_pixel;
-        return GetDrawCommand(inst);
-    }
     float MeshCollection::HitTest(const glm::Ray& ray, MCMeshInstance*& hit_inst)
     {
         float t = 1.0f;
@@ -255,13 +562,15 @@ namespace RA {
         for (const auto& it : scene->instances)
             cb(it.first);
     }
-    MeshCollection::MeshCollection(const DevicePtr& dev)
+    MeshCollection::MeshCollection(const DevicePtr& dev, bool half_instances)
     {
         m_dev = dev;
+        m_half_instances = half_instances;
 
         glm::u8vec4 white = { 255,255,255,255 };
         m_tex_white_pixel = m_dev->Create_Texture2D();
         m_tex_white_pixel->SetState(RA::TextureFmt::RGBA8, { 1,1 }, 0, 1, &white);
+        m_sort_mesh_next = 0;
 
         m_bones_ranges = Create_RangeManager(256);
         m_bones = m_dev->Create_StructuredBuffer();
@@ -284,7 +593,12 @@ namespace RA {
         m_bone_remap->SetState(sizeof(int32_t), m_bone_remap_ranges->Size());
 
         m_inst_vbuf = m_dev->Create_VertexBuffer();
-        m_inst_vbuf->SetState(MCMeshInstanceVertex::Layout(), 128);
+        m_inst_vbuf->SetState(m_half_instances ? MCMeshInstanceVertexHalf::Layout() : MCMeshInstanceVertex::Layout(), 128);
+        m_inst_vbuf_valid = true;
+
+        m_bind_buf = m_dev->Create_StructuredBuffer();
+        m_bind_buf->SetState(sizeof(MCAffine), 1);
+        m_bind_buf_valid = true;
     }
     MeshCollection::~MeshCollection()
     {
@@ -362,13 +676,15 @@ namespace RA {
     }
     void MCMeshInstance::UpdateInstanceVertex()
     {
-        MCMeshInstanceVertex new_vert;
-        new_vert.bind_transform = GetBindTransform();
-        new_vert.transform = GetTransform();
-        new_vert.materials_offset = m_mesh ? m_mesh->m_materials->OffsetSize().x : 0;
-        new_vert.bone_offset = m_arm ? m_arm->BufOffset() : -1;
-        new_vert.bone_remap_offset = m_remap_range->OffsetSize().x;
-        m_sys->m_inst_vbuf->SetSubData(m_idx, 1, &new_vert);
+        m_sys->m_inst_transforms[m_idx] = GetTransform();
+        glm::ivec4& offsets = m_sys->m_inst_offsets[m_idx];
+        int bind_idx = m_sys->AcquireBindTransform(GetBindTransform());
+        m_sys->ReleaseBindTransform(offsets.x);
+        offsets.x = bind_idx;
+        offsets.y = m_mesh ? m_mesh->m_materials->OffsetSize().x : 0;
+        offsets.z = m_arm ? m_arm->BufOffset() : -1;
+        offsets.w = m_remap_range->OffsetSize().x;
+        m_sys->MarkInstanceDirty(m_idx);
     }
     const MeshPtr& MCMeshInstance::MeshData() const {
         return m_mesh->MeshData();
@@ -376,6 +692,10 @@ namespace RA {
     const MeshInstancePtr& MCMeshInstance::InstanceData() const {
         return m_inst;
     }
+    uint64_t MCMeshInstance::DrawSortKey() const
+    {
+        return (uint64_t(m_group_id) << 32) | m_mesh->m_sort_id;
+    }
     uint32_t MCMeshInstance::GetGroupID()
     {
         return m_group_id;
@@ -419,39 +739,25 @@ namespace RA {
     void MCMeshInstance::SetTransform(const glm::mat4 m)
     {
         m_inst->SetTransform(m);
-        UpdateInstanceVertex();
+        if (!m_sys) return;
+        m_sys->m_inst_transforms[m_idx] = m;
+        m_sys->MarkInstanceDirty(m_idx);
     }
     MCMeshInstance::MCMeshInstance(MeshCollection* system, const MCMeshPtr& mesh, const MeshInstancePtr& instance, MemRangeIntfPtr remap_range) noexcept
     {
         m_group_id = 0;
         m_sys = system;
-        m_sys->m_instances.push_back(this);
-        m_idx = int(m_sys->m_instances.size() - 1);
         m_mesh = mesh;
         m_inst = instance;
         m_remap_range = std::move(remap_range);
 
-        if (m_idx > m_sys->m_inst_vbuf->VertexCount()) {
-            m_sys->m_inst_vbuf->SetState(m_sys->m_inst_vbuf->GetLayout(), m_sys->m_inst_vbuf->VertexCount() * 2);
-            for (const auto& inst : m_sys->m_instances)
-                inst->UpdateInstanceVertex();
-        }
-        else {
-            UpdateInstanceVertex();
-        }
+        m_sys->AddInstance(this);
+        UpdateInstanceVertex();
     }
     MCMeshInstance::~MCMeshInstance()
     {
         if (m_sys) {
-            if (m_idx == m_sys->m_instances.size() - 1) {
-                m_sys->m_instances.pop_back();
-            } 
-            else {
-                m_sys->m_instances[m_idx] = m_sys->m_instances[m_sys->m_instances.size() - 1];
-                m_sys->m_instances[m_idx]->m_idx = m_idx;
-                m_sys->m_instances.pop_back();
-                m_sys->m_instances[m_idx]->UpdateInstanceVertex();
-            }
+            m_sys->RemoveInstance(this);
         }
     }
     RA::Texture2DPtr MCMesh::Albedo() const
@@ -489,6 +795,7 @@ namespace RA {
             m_albedo(albedo)
     {
         m_sys = system;
+        m_sort_id = m_sys->AcquireMeshSortID(albedo);
         m_sys->m_meshes.insert({ mesh, this });
 
         m_mesh = mesh;
@@ -505,19 +812,61 @@ namespace RA {
     {
         if (m_sys) {
             m_sys->m_meshes.erase(m_mesh);
+            m_sys->ReleaseMeshSortID(m_sort_id);
         }
     }
+    MCAffine MCAffine::Pack(const glm::mat4& m)
+    {
+        MCAffine res;
+        res.row0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+        res.row1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+        res.row2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+        return res;
+    }
+    glm::mat4 MCAffine::Unpack() const
+    {
+        return glm::transpose(glm::mat4(row0, row1, row2, glm::vec4(0, 0, 0, 1)));
+    }
+    MCAffineHalf MCAffineHalf::Pack(const glm::mat4& m)
+    {
+        MCAffineHalf res;
+        res.row0 = glm::packHalf(glm::vec4(m[0][0], m[1][0], m[2][0], 0));
+        res.row1 = glm::packHalf(glm::vec4(m[0][1], m[1][1], m[2][1], 0));
+        res.row2 = glm::packHalf(glm::vec4(m[0][2], m[1][2], m[2][2], 0));
+        res.translation = glm::vec3(m[3]);
+        return res;
+    }
+    glm::mat4 MCAffineHalf::Unpack() const
+    {
+        glm::vec4 r0 = glm::unpackHalf(row0);
+        glm::vec4 r1 = glm::unpackHalf(row1);
+        glm::vec4 r2 = glm::unpackHalf(row2);
+        r0.w = translation.x;
+        r1.w = translation.y;
+        r2.w = translation.z;
+        return glm::transpose(glm::mat4(r0, r1, r2, glm::vec4(0, 0, 0, 1)));
+    }
+
     const Layout* MCMeshInstanceVertex::Layout()
     {        
         return LB()
-            ->Add("bind_trow0_", LayoutType::Float, 4)
-            ->Add("bind_trow1_", LayoutType::Float, 4)
-            ->Add("bind_trow2_", LayoutType::Float, 4)
-            ->Add("bind_trow3_", LayoutType::Float, 4)
             ->Add("trow0_", LayoutType::Float, 4)
             ->Add("trow1_", LayoutType::Float, 4)
             ->Add("trow2_", LayoutType::Float, 4)
-            ->Add("trow3_", LayoutType::Float, 4)
+            ->Add("bind_idx", LayoutType::UInt, 1, false)
+            ->Add("materials_offset", LayoutType::UInt, 1, false)
+            ->Add("bone_offset", LayoutType::UInt, 1, false)
+            ->Add("bone_remap_offset", LayoutType::UInt, 1, false)
+            ->Finish();
+    }
+    const Layout* MCMeshInstanceVertexHalf::Layout()
+    {
+        return LB()
+            ->Add("trow0_", LayoutType::Half, 4)
+            ->Add("trow1_", LayoutType::Half, 4)
+            ->Add("trow2_", LayoutType::Half, 4)
+            ->Add("tpos_", LayoutType::Float, 3)
+            ->Add("bind_idx", LayoutType::UInt, 1, false)
             ->Add("materials_offset", LayoutType::UInt, 1, false)
             ->Add("bone_offset", LayoutType::UInt, 1, false)
             ->Add("bone_remap_offset", LayoutType::UInt, 1, false)
@@ -1,8 +1,12 @@
 #include "pch.h"
 #include "RUtils.h"
 #include "stb_image_bindings.h"
-#include <map>
-#include <unordered_set>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include <Win.h>
 
 namespace RA {
@@ -224,18 +228,14 @@ namespace RA {
     {
         return &gvTexManager;
     }
-    RangeManagerIntfPtr Create_RangeManager()
-    {
-        return RangeManagerIntfPtr();
-    }
-
     class RangeManager;
 
+    //handle of an allocated block, offset and size are cached so the range stays readable after the manager is gone
     class MemRange : public MemRangeIntf {
         friend class RangeManager;
     private:
         RangeManager* m_man;
-        int m_idx;
+        int m_block;
         glm::ivec2 m_offset_size;
     public:
         int Offset() const override {
@@ -247,84 +247,291 @@ namespace RA {
         glm::ivec2 OffsetSize() const override {
             return m_offset_size;
         }
-        MemRange(RangeManager* man, const glm::ivec2& offset_size);
+        MemRange(RangeManager* man, int block, const glm::ivec2& offset_size);
         ~MemRange() override;
     };
 
+    static int BitScanMsb(uint32_t v) {
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanReverse(&idx, v);
+        return int(idx);
+#else
+        return 31 - __builtin_clz(v);
+#endif
+    }
+    static int BitScanLsb(uint32_t v) {
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanForward(&idx, v);
+        return int(idx);
+#else
+        return __builtin_ctz(v);
+#endif
+    }
+
+    //two-level segregated fit allocator. Blocks live in a pooled array and are linked by indices
+    //into a list of physical neighbours and into free lists of size classes, so Alloc and free are O(1)
     class RangeManager : public RangeManagerIntf {
         friend class MemRange;
+    private:
+        static const int cSLBits = 4;
+        static const int cSLCount = 1 << cSLBits;
+        static const int cFLCount = 32 - cSLBits;
+        struct Block {
+            int offset;
+            int size;
+            int prev_phys;  //-1 for the first block
+            int next_phys;  //-1 for the last block
+            int prev_free;
+            int next_free;  //also links unused pool items
+            bool free;
+            int pad;        //alignment padding at the beginning of an allocated block, the range starts after it
+            int align;
+            MemRange* owner;
+        };
     private:
         int m_size;
-        int m_allocated_space;
-        std::vector<MemRange*> m_allocated;
-
-        std::map<int, std::unordered_set<int>> m_free_chunks; //key - chunk size, value - chunk offsets
-        std::unordered_map<int, int> m_free_ranges; //chunk points (start offset, end offset)
-
-        void FreeRange(const glm::ivec2& offset_size) {
-            m_allocated_space -= offset_size.y;
-            int seg_offset = offset_size.x;
-            int seg_end = seg_offset + offset_size.y;
-            auto it = m_free_ranges.find(seg_offset);
-            if (it != m_free_ranges.end()) { //merge with prev segment
-                int seg_prev_offset = it->second;
-                m_free_ranges.erase(seg_prev_offset);
-                m_free_ranges.erase(seg_offset);
-                auto it2 = m_free_chunks.find(seg_offset - seg_prev_offset);
-                it2->second.erase(seg_prev_offset);
-                if (!it2->second.size())
-                    m_free_chunks.erase(it2->first);
-                seg_offset = seg_prev_offset;
-            }
-            it = m_free_ranges.find(seg_end);
-            if (it != m_free_ranges.end()) { //merge with next segment
-                int seg_next_end = it->second;
-                m_free_ranges.erase(seg_end);
-                m_free_ranges.erase(seg_next_end);
-                auto it2 = m_free_chunks.find(seg_next_end - seg_end);
-                it2->second.erase(seg_end);
-                if (!it2->second.size())
-                    m_free_chunks.erase(it2->first);
-                seg_end = seg_next_end;
-            }
+        int m_allocated_space;  //padding included
+        int m_padding_space;
+        std::vector<Block> m_blocks;
+        int m_unused_block;  //head of unused pool items
+        int m_first_block;   //block at offset 0
+        int m_last_block;    //block with the highest offset
+
+        uint32_t m_fl_bitmap;
+        uint32_t m_sl_bitmap[cFLCount];
+        int m_free_heads[cFLCount][cSLCount];
 
-            int new_size = seg_end - seg_offset;
-            auto it3 = m_free_chunks.find(new_size);
-            if (it3 == m_free_chunks.end()) {
-                m_free_chunks.insert({ new_size, std::unordered_set({seg_offset}) });
+        static void Mapping(uint32_t size, int& fl, int& sl) {
+            if (size < uint32_t(cSLCount)) {
+                fl = 0;
+                sl = int(size);
             }
             else {
-                it3->second.insert(seg_offset);
+                int msb = BitScanMsb(size);
+                fl = msb - cSLBits + 1;
+                sl = int(size >> (msb - cSLBits)) - cSLCount;
             }
-            m_free_ranges[seg_offset] = seg_end;
-            m_free_ranges[seg_end] = seg_offset;
         }
-    public:
-        MemRangeIntfPtr Alloc(int size) override {
-            if (size <= 0) return MemRangeIntfPtr(new MemRange(nullptr, glm::ivec2(0, 0)));
-
-            auto it = m_free_chunks.upper_bound(size);
-            if (it == m_free_chunks.end()) return nullptr;
-            int seg_offset = *(it->second.begin());
-            it->second.erase(seg_offset);
-            if (!it->second.size()) {
-                m_free_chunks.erase(it->first);
+        //rounds size up to the next size class, so any block of the class found is large enough
+        static void MappingSearch(uint32_t size, int& fl, int& sl) {
+            if (size >= uint32_t(cSLCount)) size += (1u << (BitScanMsb(size) - cSLBits)) - 1;
+            Mapping(size, fl, sl);
+        }
+        int NewBlock() {
+            if (m_unused_block < 0) {
+                m_blocks.emplace_back();
+                return int(m_blocks.size()) - 1;
+            }
+            int res = m_unused_block;
+            m_unused_block = m_blocks[res].next_free;
+            return res;
+        }
+        void DeleteBlock(int idx) {
+            m_blocks[idx].next_free = m_unused_block;
+            m_unused_block = idx;
+        }
+        void InsertFree(int idx) {
+            Block& b = m_blocks[idx];
+            int fl, sl;
+            Mapping(uint32_t(b.size), fl, sl);
+            b.free = true;
+            b.owner = nullptr;
+            b.prev_free = -1;
+            b.next_free = m_free_heads[fl][sl];
+            if (b.next_free >= 0) m_blocks[b.next_free].prev_free = idx;
+            m_free_heads[fl][sl] = idx;
+            m_fl_bitmap |= 1u << fl;
+            m_sl_bitmap[fl] |= 1u << sl;
+        }
+        void RemoveFree(int idx) {
+            Block& b = m_blocks[idx];
+            int fl, sl;
+            Mapping(uint32_t(b.size), fl, sl);
+            if (b.prev_free >= 0) m_blocks[b.prev_free].next_free = b.next_free;
+            else m_free_heads[fl][sl] = b.next_free;
+            if (b.next_free >= 0) m_blocks[b.next_free].prev_free = b.prev_free;
+            if (m_free_heads[fl][sl] < 0) {
+                m_sl_bitmap[fl] &= ~(1u << sl);
+                if (!m_sl_bitmap[fl]) m_fl_bitmap &= ~(1u << fl);
+            }
+            b.free = false;
+        }
+        static int AlignUp(int offset, int align) {
+            return (offset + align - 1) / align * align;
+        }
+        bool Fits(int idx, int size, int align) const {
+            const Block& b = m_blocks[idx];
+            return AlignUp(b.offset, align) + size <= b.offset + b.size;
+        }
+        //smallest fitting block of the first size class having one, blocks of the next classes are larger anyway
+        int FindBest(int size, int align) const {
+            int fl, sl;
+            Mapping(uint32_t(size), fl, sl);
+            uint32_t sl_map = m_sl_bitmap[fl] & (~0u << sl);
+            while (true) {
+                while (sl_map) {
+                    int res = -1;
+                    for (int idx = m_free_heads[fl][BitScanLsb(sl_map)]; idx >= 0; idx = m_blocks[idx].next_free) {
+                        if (Fits(idx, size, align) && ((res < 0) || (m_blocks[idx].size < m_blocks[res].size))) res = idx;
+                    }
+                    if (res >= 0) return res;
+                    sl_map &= sl_map - 1;
+                }
+                uint32_t fl_map = (fl + 1 < cFLCount) ? m_fl_bitmap & (~0u << (fl + 1)) : 0;
+                if (!fl_map) return -1;
+                fl = BitScanLsb(fl_map);
+                sl_map = m_sl_bitmap[fl];
             }
+        }
+        int FindFirst(int size, int align) const {
+            for (int idx = m_first_block; idx >= 0; idx = m_blocks[idx].next_phys) {
+                if (m_blocks[idx].free && Fits(idx, size, align)) return idx;
+            }
+            return -1;
+        }
+        int FindFree(int size, int align) const {
+            int fl, sl;
+            //the last freed block of the size class is checked first, so freed ranges are reused by same sized ones
+            Mapping(uint32_t(size), fl, sl);
+            int head = m_free_heads[fl][sl];
+            if ((head >= 0) && Fits(head, size, align)) return head;
+
+            MappingSearch(uint32_t(size) + uint32_t(align - 1), fl, sl);
+            if (fl < cFLCount) {
+                uint32_t sl_map = m_sl_bitmap[fl] & (~0u << sl);
+                if (!sl_map) {
+                    uint32_t fl_map = (fl + 1 < cFLCount) ? m_fl_bitmap & (~0u << (fl + 1)) : 0;
+                    if (fl_map) {
+                        fl = BitScanLsb(fl_map);
+                        sl_map = m_sl_bitmap[fl];
+                    }
+                }
+                if (sl_map) return m_free_heads[fl][BitScanLsb(sl_map)];
+            }
+            //the class of size itself can still have large enough blocks, it's checked before the space is grown
+            Mapping(uint32_t(size), fl, sl);
+            for (int idx = m_free_heads[fl][sl]; idx >= 0; idx = m_blocks[idx].next_free) {
+                if (Fits(idx, size, align)) return idx;
+            }
+            return -1;
+        }
+        //splits the tail of the block after size into a new free block
+        void SplitTail(int idx, int size) {
+            int rest = m_blocks[idx].size - size;
+            if (rest <= 0) return;
+            int tail = NewBlock();
+            Block& b = m_blocks[idx];
+            Block& t = m_blocks[tail];
+            t.offset = b.offset + size;
+            t.size = rest;
+            t.prev_phys = idx;
+            t.next_phys = b.next_phys;
+            if (t.next_phys >= 0) m_blocks[t.next_phys].prev_phys = tail;
+            else m_last_block = tail;
+            b.next_phys = tail;
+            b.size = size;
+            InsertFree(tail);
+        }
+        //merges block with the next physical one, the next block has to be out of free lists
+        void MergeNext(int idx) {
+            Block& b = m_blocks[idx];
+            int next = b.next_phys;
+            Block& n = m_blocks[next];
+            b.size += n.size;
+            b.next_phys = n.next_phys;
+            if (b.next_phys >= 0) m_blocks[b.next_phys].prev_phys = idx;
+            else m_last_block = idx;
+            DeleteBlock(next);
+        }
+        //moves the allocated block right after the free one down to the free block offset (realigned), 
+        //the free space moves up and merges with the next free block. The hole is gone if it was smaller than alignment
+        void MoveDown(int free_idx, const RangeRelocatedCallback& relocated) {
+            Block& f = m_blocks[free_idx];
+            int idx = f.next_phys;
+            Block& b = m_blocks[idx];
+            int prev = f.prev_phys;
+            int next = b.next_phys;
+            int old_offset = b.offset + b.pad;
+            int range_size = b.size - b.pad;
+            int end = b.offset + b.size;
+            int pad = AlignUp(f.offset, b.align) - f.offset;
+            RemoveFree(free_idx);
+            m_allocated_space += pad - b.pad;
+            m_padding_space += pad - b.pad;
+            b.offset = f.offset;
+            b.pad = pad;
+            b.size = pad + range_size;
+            b.prev_phys = prev;
+            if (prev >= 0) m_blocks[prev].next_phys = idx;
+            else m_first_block = idx;
 
-            int seg_end = m_free_ranges[seg_offset];
-            m_free_ranges.erase(seg_offset);
-            m_free_ranges.erase(seg_end);
+            int rest = end - (b.offset + b.size);
+            if (rest > 0) {
+                f.offset = b.offset + b.size;
+                f.size = rest;
+                f.prev_phys = idx;
+                f.next_phys = next;
+                b.next_phys = free_idx;
+                if (next >= 0) m_blocks[next].prev_phys = free_idx;
+                else m_last_block = free_idx;
+                if ((next >= 0) && m_blocks[next].free) {
+                    RemoveFree(next);
+                    MergeNext(free_idx);
+                }
+                InsertFree(free_idx);
+            }
+            else {
+                b.next_phys = next;
+                if (next >= 0) m_blocks[next].prev_phys = idx;
+                else m_last_block = idx;
+                DeleteBlock(free_idx);
+            }
 
-            MemRangeIntfPtr res(new MemRange(this, glm::ivec2(seg_offset, size)) );
+            MemRange* owner = m_blocks[idx].owner;
+            owner->m_offset_size.x = m_blocks[idx].offset + m_blocks[idx].pad;
+            if (relocated && (owner->m_offset_size.x != old_offset)) relocated(owner, old_offset);
+        }
+        void FreeBlock(int idx) {
+            m_allocated_space -= m_blocks[idx].size;
+            m_padding_space -= m_blocks[idx].pad;
+            int next = m_blocks[idx].next_phys;
+            if ((next >= 0) && m_blocks[next].free) {
+                RemoveFree(next);
+                MergeNext(idx);
+            }
+            int prev = m_blocks[idx].prev_phys;
+            if ((prev >= 0) && m_blocks[prev].free) {
+                RemoveFree(prev);
+                MergeNext(prev);
+                idx = prev;
+            }
+            InsertFree(idx);
+        }
+    public:
+        MemRangeIntfPtr Alloc(int size, int align, RangeFit fit) override {
+            if (size <= 0) return MemRangeIntfPtr(new MemRange(nullptr, -1, glm::ivec2(0, 0)));
+            align = glm::max(align, 1);
 
-            seg_offset += size;
-            if (seg_offset < seg_end) {
-                m_free_ranges[seg_offset] = seg_end;
-                m_free_ranges[seg_end] = seg_offset;
-                m_free_chunks[seg_end - seg_offset].insert(seg_offset);
+            int idx;
+            switch (fit) {
+                case RangeFit::Best: idx = FindBest(size, align); break;
+                case RangeFit::First: idx = FindFirst(size, align); break;
+                default: idx = FindFree(size, align);
             }
-            m_allocated_space += size;
-            return res;
+            if (idx < 0) return nullptr;
+            RemoveFree(idx);
+            Block& b = m_blocks[idx];
+            b.pad = AlignUp(b.offset, align) - b.offset;
+            b.align = align;
+            SplitTail(idx, b.pad + size);
+            m_allocated_space += m_blocks[idx].size;
+            m_padding_space += m_blocks[idx].pad;
+
+            MemRange* res = new MemRange(this, idx, glm::ivec2(m_blocks[idx].offset + m_blocks[idx].pad, size));
+            m_blocks[idx].owner = res;
+            return MemRangeIntfPtr(res);
         }
         int Size() const override {
             return m_size;
@@ -335,63 +542,174 @@ namespace RA {
         int FreeSpace() const override {
             return m_size - m_allocated_space;
         }
+        RangeManagerStats Stats() const override {
+            RangeManagerStats res = {};
+            int free_space = 0;
+            for (int idx = m_first_block; idx >= 0; idx = m_blocks[idx].next_phys) {
+                const Block& b = m_blocks[idx];
+                if (!b.free) {
+                    res.used_end = b.offset + b.size;
+                    continue;
+                }
+                res.free_chunks++;
+                res.largest_free = glm::max(res.largest_free, b.size);
+                free_space += b.size;
+            }
+            res.holes = res.used_end - m_allocated_space;
+            res.fragmentation = free_space ? 1.0f - float(res.largest_free) / float(free_space) : 0.0f;
+            res.padding = m_padding_space;
+            return res;
+        }
+        bool Defrag(int budget, const RangeRelocatedCallback& relocated) override {
+            int moved = 0;
+            int idx = m_first_block;
+            while (true) {
+                while ((idx >= 0) && !m_blocks[idx].free) idx = m_blocks[idx].next_phys;
+                if (idx < 0) return true;
+                int next = m_blocks[idx].next_phys;
+                if (next < 0) return true; //only the tail is free
+                if (moved && (moved + m_blocks[next].size - m_blocks[next].pad > budget)) return false;
+                moved += m_blocks[next].size - m_blocks[next].pad;
+                MoveDown(idx, relocated);
+                idx = next; //the hole is right after the moved block now or absorbed into its padding
+            }
+        }
         void AddSpace(int new_space) override {
-            FreeRange(glm::ivec2(m_size, new_space));
+            if (new_space <= 0) return;
+            int last = m_last_block;
+            if ((last >= 0) && m_blocks[last].free) {
+                RemoveFree(last);
+                m_blocks[last].size += new_space;
+            }
+            else {
+                int idx = NewBlock();
+                Block& b = m_blocks[idx];
+                b.offset = m_size;
+                b.size = new_space;
+                b.prev_phys = last;
+                b.next_phys = -1;
+                if (last >= 0) m_blocks[last].next_phys = idx;
+                else m_first_block = idx;
+                m_last_block = idx;
+                last = idx;
+            }
+            InsertFree(last);
             m_size += new_space;
         }
-        //void Defrag() override { }
-        RangeManager(int new_space) {
+        int RemoveSpace(int space) override {
+            int last = m_last_block;
+            if ((space <= 0) || (last < 0) || !m_blocks[last].free) return 0;
+            RemoveFree(last);
+            int removed = glm::min(space, m_blocks[last].size);
+            m_blocks[last].size -= removed;
+            m_size -= removed;
+            if (m_blocks[last].size) {
+                InsertFree(last);
+            }
+            else {
+                int prev = m_blocks[last].prev_phys;
+                if (prev >= 0) m_blocks[prev].next_phys = -1;
+                else m_first_block = -1;
+                m_last_block = prev;
+                DeleteBlock(last);
+            }
+            return removed;
+        }
+        RangeManager(int new_space) :
+            m_size(0),
+            m_allocated_space(0),
+            m_padding_space(0),
+            m_unused_block(-1),
+            m_first_block(-1),
+            m_last_block(-1),
+            m_fl_bitmap(0)
+        {
+            for (int i = 0; i < cFLCount; i++) {
+                m_sl_bitmap[i] = 0;
+                for (int j = 0; j < cSLCount; j++)
+                    m_free_heads[i][j] = -1;
+            }
             AddSpace(new_space);
         }
         ~RangeManager() {
-            for (auto& m : m_allocated) {
-                m->m_man = nullptr;
+            for (int idx = m_last_block; idx >= 0; idx = m_blocks[idx].prev_phys) {
+                if (!m_blocks[idx].free) m_blocks[idx].owner->m_man = nullptr;
             }
         }
     };
-    using RangeManagerIntfPtr = std::unique_ptr<RangeManagerIntf>;
 
-    MemRange::MemRange(RangeManager* man, const glm::ivec2& offset_size) {
+    MemRange::MemRange(RangeManager* man, int block, const glm::ivec2& offset_size) {
         m_man = man;
-        if (m_man) {
-            m_man->m_allocated.push_back(this);
-            m_idx = int(m_man->m_allocated.size()) - 1;
-        }
-        else {
-            m_idx = -1;
-        }
+        m_block = block;
         m_offset_size = offset_size;
     }
     MemRange::~MemRange() {
-        if (m_man) {
-            m_man->m_allocated[m_idx] = m_man->m_allocated[m_man->m_allocated.size() - 1];
-            m_man->m_allocated[m_idx]->m_idx = m_idx;
-            m_man->m_allocated.pop_back();
-            m_man->FreeRange(m_offset_size);
-        }
+        if (m_man) m_man->FreeBlock(m_block);
     }
 
     RangeManagerIntfPtr Create_RangeManager(int size) {
         return std::make_unique<RangeManager>(size);
     }
-    std::wstring UTF8ToWString(const std::string& utf8)
+    static void AppendCodePoint(std::wstring& res, uint32_t c)
+    {
+        if constexpr (sizeof(wchar_t) == 2) {
+            if (c > 0xFFFF) {
+                c -= 0x10000;
+                res.push_back(wchar_t(0xD800 + (c >> 10)));
+                res.push_back(wchar_t(0xDC00 + (c & 0x3FF)));
+                return;
+            }
+        }
+        res.push_back(wchar_t(c));
+    }
+    static void AppendCodePoint(std::string& res, uint32_t c)
+    {
+        if (c < 0x80) {
+            res.push_back(char(c));
+        }
+        else if (c < 0x800) {
+            res.push_back(char(0xC0 | (c >> 6)));
+            res.push_back(char(0x80 | (c & 0x3F)));
+        }
+        else if (c < 0x10000) {
+            res.push_back(char(0xE0 | (c >> 12)));
+            res.push_back(char(0x80 | ((c >> 6) & 0x3F)));
+            res.push_back(char(0x80 | (c & 0x3F)));
+        }
+        else {
+            res.push_back(char(0xF0 | (c >> 18)));
+            res.push_back(char(0x80 | ((c >> 12) & 0x3F)));
+            res.push_back(char(0x80 | ((c >> 6) & 0x3F)));
+            res.push_back(char(0x80 | (c & 0x3F)));
+        }
+    }
+    std::wstring UTF8ToWString(std::string_view utf8)
     {
         std::wstring res;
-        if (utf8.empty()) return res;
-        auto size = MultiByteToWideChar(CP_UTF8, 0, utf8.data(), int(utf8.size()), nullptr, 0);
-        if (size <= 0) return res;
-        res.resize(size_t(size));
-        MultiByteToWideChar(CP_UTF8, 0, utf8.data(), int(utf8.size()), res.data(), size);
+        res.reserve(utf8.size());
+        size_t i = 0;
+        while (i < utf8.size()) {
+            //ascii runs are checked 8 bytes at a time
+            while (i + 8 <= utf8.size()) {
+                uint64_t chunk;
+                memcpy(&chunk, utf8.data() + i, sizeof(chunk));
+                if (chunk & 0x8080808080808080ull) break;
+                for (int k = 0; k < 8; k++)
+                    res.push_back(wchar_t(utf8[i + k]));
+                i += 8;
+            }
+            if (i >= utf8.size()) break;
+            AppendCodePoint(res, NextCodePoint(utf8, i));
+        }
         return res;
     }
-    std::string WStringToUTF8(const std::wstring& wstr)
+    std::string WStringToUTF8(std::wstring_view wstr)
     {
         std::string res;
-        if (wstr.empty()) return res;
-        int size = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), int(wstr.size()), NULL, 0, NULL, NULL);
-        if (size <= 0) return res;
-        res.resize(size_t(size));
-        WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), int(wstr.size()), res.data(), size, NULL, NULL);
+        res.reserve(wstr.size());
+        size_t i = 0;
+        while (i < wstr.size())
+            AppendCodePoint(res, NextCodePoint(wstr, i));
         return res;
     }
     uint64_t QPC::TimeMcS() const
@@ -564,12 +882,34 @@ namespace RA {
     }
     void ManagedSBO::ValidateBuffer()
     {
-        if (m_buffer_valid) return;
+        if (m_buffer_valid) {
+            FlushDirty();
+            return;
+        }
         m_buffer_valid = true;
-        m_buffer->SetState(m_buffer->Stride(), m_man->Size());
-        for (const auto& r : m_ranges) {
-            r->UpdateSBOData();
+        m_buffer->SetState(m_buffer->Stride(), m_man->Size(), false, false, m_shadow.data());
+        m_dirty.clear();
+    }
+    void ManagedSBO::FlushDirty()
+    {
+        if (m_dirty.empty()) return;
+        //gaps between dirty ranges are uploaded too if they are small, the shadow has valid data there
+        const int cMaxGapBytes = 4096;
+        int stride = m_buffer->Stride();
+        int max_gap = cMaxGapBytes / stride;
+        std::sort(m_dirty.begin(), m_dirty.end(), [](const glm::ivec2& a, const glm::ivec2& b) {
+            return a.x < b.x;
+        });
+        glm::ivec2 run = m_dirty[0];
+        for (size_t i = 1; i <= m_dirty.size(); i++) {
+            if ((i < m_dirty.size()) && (m_dirty[i].x <= run.x + run.y + max_gap)) {
+                run.y = glm::max(run.y, m_dirty[i].x + m_dirty[i].y - run.x);
+                continue;
+            }
+            m_buffer->SetSubData(run.x, run.y, &m_shadow[size_t(run.x) * stride]);
+            if (i < m_dirty.size()) run = m_dirty[i];
         }
+        m_dirty.clear();
     }
     ManagedSBO_RangePtr ManagedSBO::Alloc(int vertex_count)
     {
@@ -577,6 +917,7 @@ namespace RA {
         if (!range) {            
             m_man->AddSpace(glm::nextPowerOfTwo(m_man->Size() + vertex_count) - m_man->Size());
             range = m_man->Alloc(vertex_count);
+            m_shadow.resize(size_t(m_man->Size()) * m_buffer->Stride());
             m_buffer_valid = false;
         }
         return std::make_unique<ManagedSBO_Range>(this, std::move(range));
@@ -586,17 +927,44 @@ namespace RA {
         ValidateBuffer();
         return m_buffer;
     }
-    ManagedSBO::ManagedSBO(const DevicePtr& dev, int stride_size) : m_man(Create_RangeManager(32))
+    int ManagedSBO::Capacity() const
     {
-        m_buffer = dev->Create_StructuredBuffer();
-        m_buffer->SetState(stride_size, m_man->Size());
-        m_buffer_valid = false;
+        return m_man->Size();
+    }
+    int ManagedSBO::Allocated() const
+    {
+        return m_man->Allocated();
     }
-    void ManagedSBO_Range::UpdateSBOData()
+    float ManagedSBO::Utilization() const
     {
-        if (m_sbo->m_buffer_valid) {
-            m_sbo->m_buffer->SetSubData(m_range->Offset(), m_range->Size(), m_data.data());
+        return float(m_man->Allocated()) / float(m_man->Size());
+    }
+    bool ManagedSBO::Trim(float min_utilization)
+    {
+        if ((m_man->Size() <= m_min_size) || (Utilization() >= min_utilization)) return false;
+        int stride = m_buffer->Stride();
+        bool moved = false;
+        m_man->Defrag(m_man->Size(), [this, stride, &moved](const MemRangeIntf* range, int old_offset) {
+            memmove(&m_shadow[size_t(range->Offset()) * stride], &m_shadow[size_t(old_offset) * stride], size_t(range->Size()) * stride);
+            moved = true;
+        });
+        int new_size = glm::max(m_min_size, glm::nextPowerOfTwo(m_man->Stats().used_end));
+        bool shrunk = new_size < m_man->Size();
+        if (shrunk) {
+            m_man->RemoveSpace(m_man->Size() - new_size);
+            m_shadow.resize(size_t(m_man->Size()) * stride);
+            m_shadow.shrink_to_fit();
         }
+        //moved ranges are uploaded with the whole buffer
+        if (moved || shrunk) m_buffer_valid = false;
+        return shrunk;
+    }
+    ManagedSBO::ManagedSBO(const DevicePtr& dev, int stride_size) : m_man(Create_RangeManager(32)), m_min_size(32)
+    {
+        m_buffer = dev->Create_StructuredBuffer();
+        m_buffer->SetState(stride_size, m_man->Size());
+        m_shadow.resize(size_t(m_man->Size()) * stride_size);
+        m_buffer_valid = false;
     }
     int ManagedSBO_Range::Offset() const
     {
@@ -608,24 +976,15 @@ namespace RA {
     }
     void ManagedSBO_Range::SetData(const void* data)
     {
-        memcpy(m_data.data(), data, m_data.size());
-        UpdateSBOData();
+        if (!m_range->Size()) return;
+        int stride = m_sbo->m_buffer->Stride();
+        memcpy(&m_sbo->m_shadow[size_t(m_range->Offset()) * stride], data, size_t(m_range->Size()) * stride);
+        if (m_sbo->m_buffer_valid) m_sbo->m_dirty.push_back(m_range->OffsetSize());
     }
     ManagedSBO_Range::ManagedSBO_Range(ManagedSBO* owner, MemRangeIntfPtr range)
     {
         m_sbo = owner;
-        m_idx = int(m_sbo->m_ranges.size());
-        m_sbo->m_ranges.push_back(this);
         m_range = std::move(range);
-        m_data.resize(size_t(m_range->Size() * m_sbo->m_buffer->Stride()));
-    }
-    ManagedSBO_Range::~ManagedSBO_Range()
-    {
-        m_sbo->m_ranges[m_idx] = m_sbo->m_ranges.back();
-        m_sbo->m_ranges[m_idx]->m_idx = m_idx;
-        m_sbo->m_ranges.pop_back();
-        if (m_idx != m_sbo->m_ranges.size())
-            m_sbo->m_ranges[m_idx]->UpdateSBOData();
     }
 
     MemRangeIntfPtr ManagedTexSlices::Alloc(int slices_count, bool* tex_reallocated)
@@ -633,8 +992,9 @@ namespace RA {
         *tex_reallocated = false;
         MemRangeIntfPtr range = m_man->Alloc(slices_count);
         if (!range) {
-            m_man->AddSpace(glm::nextPowerOfTwo(m_man->Size() + slices_count));
+            m_man->AddSpace(glm::nextPowerOfTwo(m_man->Size() + slices_count) - m_man->Size());
             range = m_man->Alloc(slices_count);
+            m_tex->SetState(m_tex->Format(), m_tex->Size(), 0, m_man->Size());
             *tex_reallocated = true;
         }
         return range;
@@ -644,11 +1004,237 @@ namespace RA {
     {
         return m_tex;
     }
+    int ManagedTexSlices::Capacity() const
+    {
+        return m_man->Size();
+    }
+    int ManagedTexSlices::Allocated() const
+    {
+        return m_man->Allocated();
+    }
+    float ManagedTexSlices::Utilization() const
+    {
+        return float(m_man->Allocated()) / float(m_man->Size());
+    }
+    bool ManagedTexSlices::Trim(float min_utilization)
+    {
+        if ((m_man->Size() <= m_min_size) || (Utilization() >= min_utilization)) return false;
+        //nothing is moved if the compacted slices can't fit into a smaller texture
+        if (glm::max(m_min_size, glm::nextPowerOfTwo(m_man->Allocated())) >= m_man->Size()) return false;
+        bool moved = false;
+        m_man->Defrag(m_man->Size(), [&moved](const MemRangeIntf*, int) { moved = true; });
+        int new_size = glm::max(m_min_size, glm::nextPowerOfTwo(m_man->Stats().used_end));
+        bool shrunk = new_size < m_man->Size();
+        if (shrunk) {
+            m_man->RemoveSpace(m_man->Size() - new_size);
+            m_tex->SetState(m_tex->Format(), m_tex->Size(), 0, m_man->Size());
+        }
+        return moved || shrunk;
+    }
 
-    ManagedTexSlices::ManagedTexSlices(const DevicePtr& dev, TextureFmt fmt, const glm::ivec2& tex_size) : m_man(Create_RangeManager(8)) {
+    ManagedTexSlices::ManagedTexSlices(const DevicePtr& dev, TextureFmt fmt, const glm::ivec2& tex_size) : m_man(Create_RangeManager(8)), m_min_size(8) {
         m_tex = dev->Create_Texture2D();
         m_tex->SetState(fmt, tex_size, 0, m_man->Size());
     }
+    int FrameRingStorage_VB::Stride() const
+    {
+        return m_buf->GetLayout()->stride;
+    }
+    int FrameRingStorage_VB::Capacity() const
+    {
+        return m_buf->VertexCount();
+    }
+    void* FrameRingStorage_VB::Map(int offset, int count, bool discard)
+    {
+        return m_buf->Map(offset, count, discard);
+    }
+    void FrameRingStorage_VB::Unmap()
+    {
+        m_buf->Unmap();
+    }
+    const VertexBufferPtr& FrameRingStorage_VB::Buffer() const
+    {
+        return m_buf;
+    }
+    FrameRingStorage_VB::FrameRingStorage_VB(const DevicePtr& dev, const Layout* layout, int capacity)
+    {
+        m_buf = dev->Create_VertexBuffer();
+        m_buf->SetStateDynamic(layout, capacity);
+    }
+    FrameRingStorageFactory FrameRingStorage_VB::Factory(const DevicePtr& dev, const Layout* layout)
+    {
+        return [dev, layout](int capacity) { return std::make_shared<FrameRingStorage_VB>(dev, layout, capacity); };
+    }
+
+    int FrameRingStorage_SBO::Stride() const
+    {
+        return m_buf->Stride();
+    }
+    int FrameRingStorage_SBO::Capacity() const
+    {
+        return m_buf->VertexCount();
+    }
+    void* FrameRingStorage_SBO::Map(int offset, int count, bool discard)
+    {
+        return m_buf->Map(offset, count, discard);
+    }
+    void FrameRingStorage_SBO::Unmap()
+    {
+        m_buf->Unmap();
+    }
+    const StructuredBufferPtr& FrameRingStorage_SBO::Buffer() const
+    {
+        return m_buf;
+    }
+    FrameRingStorage_SBO::FrameRingStorage_SBO(const DevicePtr& dev, int stride, int capacity)
+    {
+        m_buf = dev->Create_StructuredBuffer();
+        m_buf->SetStateDynamic(stride, capacity);
+    }
+    FrameRingStorageFactory FrameRingStorage_SBO::Factory(const DevicePtr& dev, int stride)
+    {
+        return [dev, stride](int capacity) { return std::make_shared<FrameRingStorage_SBO>(dev, stride, capacity); };
+    }
+
+    int FrameRingStorage_CPU::Stride() const
+    {
+        return m_stride;
+    }
+    int FrameRingStorage_CPU::Capacity() const
+    {
+        return int(m_data.size() / m_stride);
+    }
+    void* FrameRingStorage_CPU::Map(int offset, int count, bool discard)
+    {
+        assert(offset + count <= Capacity());
+        //content is undefined after discard, it's filled with garbage so reads of discarded data are caught
+        if (discard) std::fill(m_data.begin(), m_data.end(), char(0xCD));
+        return &m_data[size_t(offset) * m_stride];
+    }
+    void FrameRingStorage_CPU::Unmap()
+    {
+    }
+    const void* FrameRingStorage_CPU::Data() const
+    {
+        return m_data.data();
+    }
+    FrameRingStorage_CPU::FrameRingStorage_CPU(int stride, int capacity)
+    {
+        m_stride = stride;
+        m_data.resize(size_t(stride) * capacity);
+    }
+    FrameRingStorageFactory FrameRingStorage_CPU::Factory(int stride)
+    {
+        return [stride](int capacity) { return std::make_shared<FrameRingStorage_CPU>(stride, capacity); };
+    }
+
+    int FrameRingBuffer::Reserve(int count)
+    {
+        int cap = m_storage->Capacity();
+        if (!m_used) {
+            m_head = 0;
+            m_tail = 0;
+        }
+        int offset = -1;
+        if (m_used < cap) {
+            if (m_head >= m_tail) {
+                if (m_head + count <= cap) {
+                    offset = m_head;
+                }
+                else if (count <= m_tail) {
+                    //the end of the buffer is skipped, it's released with the frame
+                    m_frame.size += cap - m_head;
+                    m_used += cap - m_head;
+                    offset = 0;
+                }
+            }
+            else if (m_head + count <= m_tail) {
+                offset = m_head;
+            }
+        }
+        if (offset < 0) {
+            //frames in flight keep using the old storage, the new one is empty
+            m_frame.retired.push_back(std::move(m_storage));
+            m_storage = m_factory(glm::nextPowerOfTwo(glm::max(cap * 2, count)));
+            m_fresh = true;
+            for (auto& f : m_frames) {
+                f.size = 0;
+            }
+            m_frame.size = 0;
+            m_used = 0;
+            m_tail = 0;
+            offset = 0;
+        }
+        m_head = offset + count;
+        m_frame.size += count;
+        m_used += count;
+        m_frame_pushed += count;
+        return offset;
+    }
+    void* FrameRingBuffer::Map(int count, FrameRingRange* range)
+    {
+        int offset = Reserve(glm::max(count, 1));
+        range->storage = m_storage.get();
+        range->offset = offset;
+        void* res = m_storage->Map(offset, glm::max(count, 1), m_fresh);
+        m_fresh = false;
+        return res;
+    }
+    void FrameRingBuffer::Unmap()
+    {
+        m_storage->Unmap();
+    }
+    FrameRingRange FrameRingBuffer::Push(const void* data, int count)
+    {
+        if (count <= 0) return { m_storage.get(), 0 };
+        FrameRingRange res;
+        void* dest = Map(count, &res);
+        memcpy(dest, data, size_t(count) * m_storage->Stride());
+        Unmap();
+        return res;
+    }
+    void FrameRingBuffer::EndFrame()
+    {
+        m_peak = glm::max(m_peak, m_frame_pushed);
+        m_frame_pushed = 0;
+        m_frames.push_back(std::move(m_frame));
+        m_frame = Frame();
+        int cap = m_storage->Capacity();
+        while (int(m_frames.size()) > m_frames_in_flight) {
+            m_tail = (m_tail + m_frames.front().size) % cap;
+            m_used -= m_frames.front().size;
+            m_frames.pop_front();
+        }
+    }
+    FrameRingStorage* FrameRingBuffer::Storage()
+    {
+        return m_storage.get();
+    }
+    int FrameRingBuffer::Capacity() const
+    {
+        return m_storage->Capacity();
+    }
+    int FrameRingBuffer::Used() const
+    {
+        return m_used;
+    }
+    int FrameRingBuffer::PeakFrameUsage() const
+    {
+        return glm::max(m_peak, m_frame_pushed);
+    }
+    FrameRingBuffer::FrameRingBuffer(const FrameRingStorageFactory& factory, int capacity, int frames_in_flight)
+    {
+        m_factory = factory;
+        m_storage = m_factory(glm::max(capacity, 1));
+        m_frames_in_flight = frames_in_flight;
+        m_head = 0;
+        m_tail = 0;
+        m_used = 0;
+        m_fresh = true;
+        m_frame_pushed = 0;
+        m_peak = 0;
+    }
+
     CameraBase::CameraBase(const DevicePtr& device)
     {
         m_ubo = device->Create_UniformBuffer();
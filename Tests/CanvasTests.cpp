@@ -0,0 +1,297 @@
+#include "Tests.h"
+#include "RCanvas.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace RA;
+
+namespace {
+    CanvasCommonObjectPtr Common() {
+        static CanvasCommonObjectPtr res;
+        if (!res) res = std::make_shared<CanvasCommonObject>(RATest::Device());
+        return res;
+    }
+    int InstancesCount(Canvas& canvas, BatchKind kind) {
+        int res = 0;
+        for (const Batch& b : *canvas.GetBuffers().batches)
+            if (b.kind == kind) res += b.ranges.y;
+        return res;
+    }
+    //noisy line chart, most joins are sharp enough to need wedges
+    std::vector<glm::vec2> ChartPoints(int count) {
+        std::mt19937 rnd(1);
+        std::uniform_real_distribution<float> noise(-10.0f, 10.0f);
+        std::vector<glm::vec2> res(count);
+        for (int i = 0; i < count; i++)
+            res[i] = glm::vec2(float(i) * 0.02f, 300.0f + 200.0f * std::sin(float(i) * 0.001f) + noise(rnd));
+        return res;
+    }
+    ITextLinesPtr Label(Canvas& canvas, std::string_view str, const glm::vec4& bounds) {
+        canvas.TB()->Write(str);
+        ITextLinesPtr res = canvas.TB()->Finish();
+        res->SetBounds(bounds);
+        res->SetVAlign(0.5f);
+        return res;
+    }
+    //frame, title and rows of filled edit boxes with text inside, rows don't touch each other
+    void RecordDialog(Canvas& canvas, int rows) {
+        canvas.Pen().SetWidth(1.0f);
+        canvas.AddRectangle(glm::vec4(10, 10, 410, 60 + rows * 30));
+        canvas.AddText(Label(canvas, "Settings", glm::vec4(20, 14, 400, 36)));
+        for (int i = 0; i < rows; i++) {
+            glm::vec4 box(20, 44 + i * 30, 400, 68 + i * 30);
+            canvas.Pen().SetColor(glm::vec4(0.2f, 0.2f, 0.2f, 1.0f));
+            canvas.AddFillRect(box);
+            canvas.AddText(Label(canvas, "value " + std::to_string(i), box + glm::vec4(4, 0, -4, 0)));
+        }
+    }
+    //latin, greek and cyrillic letters in chunks of 40, chunk order is rotated by start
+    std::vector<std::wstring> GlyphChunks(int start) {
+        std::wstring all;
+        for (wchar_t c = 0x21; c < 0x7F; c++) all.push_back(c);
+        for (wchar_t c = 0xC0; c < 0x250; c++) all.push_back(c);
+        for (wchar_t c = 0x391; c < 0x3CA; c++) all.push_back(c);
+        for (wchar_t c = 0x410; c < 0x450; c++) all.push_back(c);
+        std::vector<std::wstring> res;
+        for (size_t i = 0; i < all.size(); i += 40)
+            res.push_back(all.substr(i, 40));
+        std::rotate(res.begin(), res.begin() + (start % res.size()), res.end());
+        return res;
+    }
+    bool SameGlyphs(const std::vector<TextGlyphVertex>& a, const std::vector<TextGlyphVertex>& b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); i++) {
+            if ((a[i].pos != b[i].pos) || (a[i].size != b[i].size)) return false;
+            if ((a[i].sprite_xy != b[i].sprite_xy) || (a[i].sprite_size != b[i].sprite_size)) return false;
+            if (a[i].slice_idx != b[i].slice_idx) return false;
+        }
+        return true;
+    }
+}
+
+RA_TEST(Canvas_DialogDrawCalls)
+{
+    const int rows = 8;
+    DevicePtr dev = RATest::Device();
+    dev->BeginFrame();
+    UICamera camera(dev);
+    camera.UpdateFromWnd();
+    Canvas canvas(*Common());
+    RecordDialog(canvas, rows);
+    RA_CHECK(InstancesCount(canvas, BatchKind::Glyphs) > 0);
+
+    //recording order: frame, title, then a box and its text for every row
+    canvas.SetBatchReordering(false);
+    dev->ResetStats();
+    canvas.Render(camera);
+    RA_CHECK(dev->Stats().draw_calls == canvas.GetBuffers().batches->size());
+    RA_CHECK(dev->Stats().draw_calls == uint64_t(2 + 2 * rows));
+
+    //boxes merge into one batch and texts into another. Texts can't join the title glyphs,
+    //the first box is drawn between them and under the first text, so it is frame, title, boxes, texts
+    canvas.SetBatchReordering(true);
+    dev->ResetStats();
+    canvas.Render(camera);
+    RA_CHECK(dev->Stats().draw_calls == 4);
+}
+
+RA_BENCH(Canvas_ChartPolyline)
+{
+    std::vector<glm::vec2> pts = ChartPoints(100000);
+    Canvas canvas(*Common());
+    const char* join_names[] = { "miter", "round", "bevel" };
+    for (PenJoin join : { PenJoin::miter, PenJoin::bevel, PenJoin::round }) {
+        canvas.Pen().SetJoin(join);
+        canvas.Pen().SetWidth(3.0f);
+        double best = 1e9;
+        for (int i = 0; i < 20; i++) {
+            canvas.Clear();
+            RATest::Timer t;
+            canvas.AddPolyline(pts);
+            best = std::min(best, t.ElapsedMS());
+        }
+        int instances = InstancesCount(canvas, BatchKind::Lines);
+        printf("    %d points, %s join: %d line instances (%.2f per point), build %.2f ms\n",
+               int(pts.size()), join_names[int(join)], instances, double(instances) / double(pts.size()), best);
+    }
+}
+
+RA_TEST(Canvas_ThreadedRecording)
+{
+    //workers record on their own canvases and race on the same glyphs of a fresh atlas,
+    //every glyph has to end up with one sprite whichever thread created it
+    const int threads_count = 8;
+    DevicePtr dev = RATest::Device();
+    CanvasCommonObject common(dev);
+    std::vector<std::unique_ptr<Canvas>> canvases;
+    std::vector<std::vector<std::vector<TextGlyphVertex>>> recorded(threads_count);
+    for (int t = 0; t < threads_count; t++)
+        canvases.push_back(std::make_unique<Canvas>(common));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_count; t++) {
+        threads.emplace_back([&, t]() {
+            Canvas& canvas = *canvases[t];
+            for (int round = 0; round < 4; round++) {
+                canvas.TB()->Font_SetSize(float(12 + round * 4));
+                for (const std::wstring& chunk : GlyphChunks(t)) {
+                    canvas.TB()->Write(chunk);
+                    ITextLinesPtr lines = canvas.TB()->Finish();
+                    recorded[t].push_back(lines->AllGlyphs());
+                    canvas.AddText(lines);
+                }
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    //the atlas is warm now, a single threaded pass has to give the same sprites
+    Canvas check(common);
+    int glyphs = 0;
+    for (int t = 0; t < threads_count; t++) {
+        size_t idx = 0;
+        for (int round = 0; round < 4; round++) {
+            check.TB()->Font_SetSize(float(12 + round * 4));
+            for (const std::wstring& chunk : GlyphChunks(t)) {
+                check.TB()->Write(chunk);
+                RA_CHECK(idx < recorded[t].size());
+                RA_CHECK(SameGlyphs(check.TB()->Finish()->AllGlyphs(), recorded[t][idx]));
+                glyphs += int(recorded[t][idx].size());
+                idx++;
+            }
+        }
+    }
+
+    //workers' canvases are merged and drawn on this thread
+    Canvas merged(common);
+    for (const auto& c : canvases) merged.Append(*c);
+    RA_CHECK(InstancesCount(merged, BatchKind::Glyphs) == glyphs);
+    dev->BeginFrame();
+    UICamera camera(dev);
+    camera.UpdateFromWnd();
+    merged.Render(camera);
+}
+
+RA_TEST(Canvas_StreamedRendering)
+{
+    DevicePtr dev = RATest::Device();
+    UICamera camera(dev);
+    camera.UpdateFromWnd();
+    Canvas retained(*Common());
+    Canvas streamed(*Common());
+    streamed.SetStreamed(true);
+    for (int frame = 0; frame < 10; frame++) {
+        dev->BeginFrame();
+        //the streamed canvas is rebuilt every frame as immediate mode ui would do
+        streamed.Clear();
+        RecordDialog(streamed, 8);
+        if (!frame) RecordDialog(retained, 8);
+
+        dev->ResetStats();
+        retained.Render(camera);
+        DeviceStats rs = dev->Stats();
+        dev->ResetStats();
+        streamed.Render(camera);
+        DeviceStats ss = dev->Stats();
+        RA_CHECK(ss.draw_calls == rs.draw_calls);
+        if (frame) {
+            //same program constants, plus one map of glyphs and one of lines
+            RA_CHECK(ss.uploads == rs.uploads + 2);
+        }
+        dev->PresentToWnd();
+    }
+    RA_CHECK(dev->FrameIndex() >= 10);
+}
+
+RA_TEST(RetainedCanvas_RecordingOrder)
+{
+    DevicePtr dev = RATest::Device();
+    dev->BeginFrame();
+    UICamera camera(dev);
+    camera.UpdateFromWnd();
+    RetainedCanvas canvas(*Common());
+    auto draws = [&]() {
+        dev->ResetStats();
+        canvas.Render(camera);
+        return int(dev->Stats().draw_calls);
+    };
+    auto label = [&](const char* str) {
+        canvas.TB()->Write(std::string_view(str));
+        return canvas.TB()->Finish();
+    };
+    //text recorded between two fills stays between them
+    CanvasItemPtr a = canvas.AddFillRect(glm::vec4(0, 0, 100, 20));
+    CanvasItemPtr b = canvas.AddText(label("over a"));
+    CanvasItemPtr c = canvas.AddFillRect(glm::vec4(0, 0, 100, 20));
+    RA_CHECK(draws() == 3);
+    //adjacent fills merge once nothing is drawn between them
+    b = nullptr;
+    RA_CHECK(draws() == 1);
+    CanvasItemPtr d = canvas.AddFillRect(glm::vec4(0, 30, 100, 50));
+    RA_CHECK(draws() == 1);
+    CanvasItemPtr e = canvas.AddText(label("over d"));
+    RA_CHECK(draws() == 2);
+    //a fill recorded after the text is drawn after it, wherever its vertices are
+    a = nullptr;
+    CanvasItemPtr f = canvas.AddFillRect(glm::vec4(0, 0, 100, 20));
+    RA_CHECK(draws() == 3);
+}
+
+RA_BENCH(RetainedCanvas_10kItems)
+{
+    //table of 5000 cells, cell backgrounds first, then their labels
+    const int cells = 5000;
+    DevicePtr dev = RATest::Device();
+    UICamera camera(dev);
+    camera.UpdateFromWnd();
+    Canvas canvas(*Common());
+    RetainedCanvas retained(*Common());
+    std::vector<glm::vec4> rects(cells);
+    std::vector<ITextLinesPtr> labels(cells);
+    for (int i = 0; i < cells; i++) {
+        rects[i] = glm::vec4((i % 50) * 40, (i / 50) * 20, (i % 50) * 40 + 38, (i / 50) * 20 + 18);
+        labels[i] = Label(canvas, std::to_string(i), rects[i]);
+    }
+    auto record = [&](float dx) {
+        canvas.Clear();
+        for (int i = 0; i < cells; i++) canvas.AddFillRect(rects[i] + glm::vec4(dx, 0, dx, 0));
+        for (int i = 0; i < cells; i++) canvas.AddText(labels[i]);
+    };
+    std::vector<CanvasItemPtr> items;
+    for (int i = 0; i < cells; i++) items.push_back(retained.AddFillRect(rects[i]));
+    for (int i = 0; i < cells; i++) items.push_back(retained.AddText(labels[i]));
+    record(0);
+    dev->BeginFrame();
+    canvas.Render(camera);
+    retained.Render(camera);
+
+    //every frame ten backgrounds move
+    double best_rebuild = 1e9;
+    double best_retained = 1e9;
+    DeviceStats rebuild_stats;
+    DeviceStats retained_stats;
+    for (int frame = 1; frame <= 20; frame++) {
+        dev->BeginFrame();
+        dev->ResetStats();
+        RATest::Timer t;
+        record(float(frame % 2));
+        canvas.Render(camera);
+        best_rebuild = std::min(best_rebuild, t.ElapsedMS());
+        rebuild_stats = dev->Stats();
+
+        dev->ResetStats();
+        RATest::Timer t2;
+        for (int i = 0; i < cells; i += cells / 10)
+            items[i]->Translate(glm::vec2((frame % 2) ? 1.0f : -1.0f, 0));
+        retained.Render(camera);
+        best_retained = std::min(best_retained, t2.ElapsedMS());
+        retained_stats = dev->Stats();
+    }
+    printf("    %d items, 10 moved per frame\n", cells * 2);
+    printf("    rebuild:  %.3f ms, %d draws, %d kb uploaded\n", best_rebuild,
+           int(rebuild_stats.draw_calls), int(rebuild_stats.upload_bytes / 1024));
+    printf("    retained: %.3f ms, %d draws, %d kb uploaded\n", best_retained,
+           int(retained_stats.draw_calls), int(retained_stats.upload_bytes / 1024));
+}
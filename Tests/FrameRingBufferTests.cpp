@@ -0,0 +1,115 @@
+#include "Tests.h"
+#include "RUtils.h"
+#include <deque>
+#include <random>
+
+using namespace RA;
+
+namespace {
+    struct Pushed {
+        FrameRingRange range;
+        int count;
+        int tag;
+    };
+    bool HasTag(const Pushed& p) {
+        const int* data = (const int*)static_cast<FrameRingStorage_CPU*>(p.range.storage)->Data() + p.range.offset;
+        for (int i = 0; i < p.count; i++)
+            if (data[i] != p.tag) return false;
+        return true;
+    }
+    //factory of cpu storages that remembers every storage it made
+    FrameRingStorageFactory TrackedFactory(std::vector<std::weak_ptr<FrameRingStorage>>& made) {
+        FrameRingStorageFactory cpu = FrameRingStorage_CPU::Factory(sizeof(int));
+        return [cpu, &made](int capacity) {
+            FrameRingStoragePtr res = cpu(capacity);
+            made.push_back(res);
+            return res;
+        };
+    }
+}
+
+RA_TEST(FrameRing_LiveRangesKeepData)
+{
+    //random pushes across wraps and growth, every range of the frames in flight keeps its data
+    std::mt19937 rnd(1);
+    for (int frames_in_flight : { 1, 2, 3 }) {
+        FrameRingBuffer ring(FrameRingStorage_CPU::Factory(sizeof(int)), 64, frames_in_flight);
+        std::deque<std::vector<Pushed>> frames;
+        for (int f = 0; f < 3000; f++) {
+            int scale = (f < 1000) ? 20 : ((f < 2000) ? 200 : 30);
+            int pushes = 1 + int(rnd() % 8);
+            std::vector<Pushed> cur;
+            for (int p = 0; p < pushes; p++) {
+                int count = 1 + int(rnd() % scale);
+                std::vector<int> data(count, f * 16 + p);
+                cur.push_back({ ring.Push(data.data(), count), count, f * 16 + p });
+            }
+            for (const auto& p : cur) RA_CHECK(HasTag(p));
+            for (const auto& fr : frames)
+                for (const auto& p : fr) RA_CHECK(HasTag(p));
+            ring.EndFrame();
+            frames.push_back(std::move(cur));
+            while (int(frames.size()) > frames_in_flight) frames.pop_front();
+        }
+        RA_CHECK(ring.Used() <= ring.Capacity());
+    }
+}
+
+RA_TEST(FrameRing_SteadyStateWraps)
+{
+    //(frames_in_flight + 1) frames fit, so the ring wraps around without growing
+    std::vector<std::weak_ptr<FrameRingStorage>> made;
+    FrameRingBuffer ring(TrackedFactory(made), 64, 2);
+    std::vector<int> data(16, 7);
+    for (int f = 0; f < 100; f++) {
+        FrameRingRange r = ring.Push(data.data(), 16);
+        RA_CHECK(r.offset == (f % 4) * 16);
+        RA_CHECK(ring.Used() <= 48);
+        ring.EndFrame();
+    }
+    RA_CHECK(made.size() == 1);
+    RA_CHECK(ring.Capacity() == 64);
+    RA_CHECK(ring.PeakFrameUsage() == 16);
+}
+
+RA_TEST(FrameRing_GrowthKeepsOldStorage)
+{
+    std::vector<std::weak_ptr<FrameRingStorage>> made;
+    FrameRingBuffer ring(TrackedFactory(made), 64, 2);
+    std::vector<int> a(40, 1);
+    std::vector<int> b(40, 2);
+    Pushed pa{ ring.Push(a.data(), 40), 40, 1 };
+    Pushed pb{ ring.Push(b.data(), 40), 40, 2 };
+    //the second push doesn't fit, it goes to a new storage and the first range stays where it was
+    RA_CHECK(made.size() == 2);
+    RA_CHECK(pa.range.storage != pb.range.storage);
+    RA_CHECK(pb.range.storage == ring.Storage());
+    RA_CHECK(ring.Capacity() >= 128);
+    RA_CHECK(HasTag(pa) && HasTag(pb));
+    RA_CHECK(ring.PeakFrameUsage() == 80);
+
+    //the old storage lives until the frame that used it leaves flight
+    for (int f = 0; f < 2; f++) {
+        ring.EndFrame();
+        RA_CHECK(!made[0].expired());
+        RA_CHECK(HasTag(pa));
+    }
+    ring.EndFrame();
+    RA_CHECK(made[0].expired());
+    RA_CHECK(!made[1].expired());
+}
+
+RA_TEST(FrameRing_EndOfBufferIsSkipped)
+{
+    FrameRingBuffer ring(FrameRingStorage_CPU::Factory(sizeof(int)), 64, 1);
+    std::vector<int> data(40, 3);
+    RA_CHECK(ring.Push(data.data(), 40).offset == 0);
+    ring.EndFrame();
+    //24 elements left at the end are not enough, the range wraps to the start once the first frame is released
+    RA_CHECK(ring.Push(data.data(), 20).offset == 40);
+    ring.EndFrame();
+    Pushed p{ ring.Push(data.data(), 30), 30, 3 };
+    RA_CHECK(p.range.offset == 0);
+    RA_CHECK(ring.Capacity() == 64);
+    RA_CHECK(HasTag(p));
+}
@@ -0,0 +1,99 @@
+#include "Tests.h"
+#include "RFonts.h"
+
+using namespace RA;
+
+namespace {
+    //words of SplitWrappedWords as strings, spaces after the word are appended as '_'
+    template <typename Str>
+    std::vector<std::string> Words(Str str) {
+        std::vector<glm::ivec3> words;
+        SplitWrappedWords(str, words);
+        std::vector<std::string> res;
+        for (const auto& w : words) {
+            RA_CHECK((w.x >= 0) && (w.y >= 0) && (w.x + w.y <= int(str.size())));
+            std::string s;
+            for (int i = w.x; i < w.x + w.y; i++)
+                s.push_back((uint32_t(str[i]) < 0x80) ? char(str[i]) : '#');
+            res.push_back(s + std::string(w.z, '_'));
+        }
+        return res;
+    }
+    using WL = std::vector<std::string>;
+}
+
+RA_TEST(LineBreak_Spaces)
+{
+    RA_CHECK(Words(std::string_view("")).empty());
+    RA_CHECK(Words(std::string_view("hello world")) == WL({ "hello_", "world_" }));
+    RA_CHECK(Words(std::string_view("a  b   ")) == WL({ "a__", "b___" }));
+    //leading spaces give an empty first word
+    RA_CHECK(Words(std::string_view("   hello")) == WL({ "___", "hello_" }));
+    RA_CHECK(Words(std::string_view("  ")) == WL({ "__" }));
+}
+
+RA_TEST(LineBreak_Punctuation)
+{
+    //break after hyphens, except in front of numbers
+    RA_CHECK(Words(std::string_view("well-known")) == WL({ "well-", "known_" }));
+    RA_CHECK(Words(std::string_view("x -5")) == WL({ "x_", "-5_" }));
+    //no break before closing punctuation, after opening one and around quotes
+    RA_CHECK(Words(std::string_view("f(x)!?")) == WL({ "f(x)!?_" }));
+    RA_CHECK(Words(std::string_view("wait...")) == WL({ "wait..._" }));
+    RA_CHECK(Words(std::string_view("\"quoted\"")) == WL({ "\"quoted\"_" }));
+    RA_CHECK(Words(std::string_view("a|b")) == WL({ "a|", "b_" }));
+}
+
+RA_TEST(LineBreak_Unicode)
+{
+    //no-break space and word joiner glue, zero width space breaks
+    RA_CHECK(Words(std::string_view("a\xC2\xA0" "b")) == WL({ "a##b_" }));
+    RA_CHECK(Words(std::string_view("a\xE2\x81\xA0" "b")) == WL({ "a###b_" }));
+    RA_CHECK(Words(std::string_view("a\xE2\x80\x8B" "b")) == WL({ "a###", "b_" }));
+    //ideographs break between each other, but not before ideographic full stop
+    RA_CHECK(Words(std::wstring_view(L"\x65E5\x672C\x8A9E")) == WL({ "#", "#", "#_" }));
+    RA_CHECK(Words(std::wstring_view(L"\x65E5\x672C\x3002")) == WL({ "#", "##_" }));
+    //combining marks stay with the base and take its class
+    RA_CHECK(Words(std::string_view("e\xCC\x81-x")) == WL({ "e##-", "x_" }));
+    RA_CHECK(Words(std::wstring_view(L"\x65E5\x0301\x672C")) == WL({ "##", "#_" }));
+}
+
+RA_TEST(LineBreak_SurrogatePairs)
+{
+    //utf-16 offsets are in code units, pairs are never split
+    if constexpr (sizeof(wchar_t) == 2) {
+        std::vector<glm::ivec3> words;
+        SplitWrappedWords(std::wstring_view(L"\xD83D\xDE00\xD83D\xDE00 a"), words);
+        RA_CHECK(words.size() == 3);
+        RA_CHECK(words[0] == glm::ivec3(0, 2, 0));
+        RA_CHECK(words[1] == glm::ivec3(2, 2, 1));
+        RA_CHECK(words[2] == glm::ivec3(5, 1, 1));
+    }
+    std::vector<glm::ivec3> words;
+    SplitWrappedWords(std::string_view("\xF0\x9F\x98\x80\xF0\x9F\x98\x80"), words);
+    RA_CHECK(words.size() == 2);
+    RA_CHECK(words[0] == glm::ivec3(0, 4, 0));
+    RA_CHECK(words[1] == glm::ivec3(4, 4, 1));
+}
+
+RA_TEST(LineBreak_WrappedLeadingSpaces)
+{
+    Atlas_GlyphsSDF atlas(RATest::Device());
+    ITextBuilderPtr tb = Create_TextBuilder(&atlas);
+    //the first word is empty, it used to leave the line list empty
+    tb->WriteWrappedMultiline(std::string_view("   hello world"), 10000.0f);
+    ITextLinesPtr lines = tb->Finish();
+    RA_CHECK(lines->LinesCount() == 1);
+
+    //every word wider than the line gets its own line, the empty one included
+    tb->WriteWrappedMultiline(std::string_view("   hello world"), 1.0f);
+    lines = tb->Finish();
+    RA_CHECK(lines->LinesCount() == 3);
+    int glyphs = 0;
+    for (int i = 0; i < lines->LinesCount(); i++)
+        glyphs += lines->LineGlyphs(i).y;
+    RA_CHECK(glyphs == int(lines->AllGlyphs().size()));
+
+    tb->WriteWrappedMultiline(std::string_view("hello world"), 1.0f);
+    RA_CHECK(tb->Finish()->LinesCount() == 2);
+}
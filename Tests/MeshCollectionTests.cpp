@@ -0,0 +1,297 @@
+#include "Tests.h"
+#include "RSystems.h"
+#include <algorithm>
+#include <cstddef>
+#include <random>
+#include <string>
+
+using namespace RA;
+
+namespace {
+    glm::mat4 RandomTransform(std::mt19937& rnd) {
+        std::uniform_real_distribution<float> d(-1.0f, 1.0f);
+        glm::vec3 axis = glm::vec3(d(rnd), d(rnd), d(rnd)) + glm::vec3(0.01f, 0, 0);
+        glm::mat4 m = glm::translate(glm::mat4(1.0f), glm::vec3(d(rnd), d(rnd), d(rnd)) * 1000.0f);
+        m = glm::rotate(m, d(rnd) * 3.14f, glm::normalize(axis));
+        return glm::scale(m, glm::vec3(0.1f) + glm::abs(glm::vec3(d(rnd), d(rnd), d(rnd))) * 4.0f);
+    }
+    float MaxDiff(const glm::vec4& a, const glm::vec4& b) {
+        glm::vec4 d = glm::abs(a - b);
+        return glm::max(glm::max(d.x, d.y), glm::max(d.z, d.w));
+    }
+    float MaxDiff(const glm::mat4& a, const glm::mat4& b) {
+        float res = 0;
+        for (int i = 0; i < 4; i++)
+            res = glm::max(res, MaxDiff(a[i], b[i]));
+        return res;
+    }
+    void CheckField(const Layout* l, int idx, const char* name, int offset) {
+        RA_CHECK(l->fields[idx].name == name);
+        RA_CHECK(l->fields[idx].offset == offset);
+    }
+
+    //avm scene of single triangle meshes "m<i>" with one instance "i<i>" of each, no armatures
+    fs::path WriteTestScene(int meshes_count) {
+        fs::path path = fs::temp_directory_path() / ("radopt_tests_" + std::to_string(meshes_count) + ".avm");
+        File f(path, true);
+        RA_CHECK(f.Good());
+        f.Write(int32_t(0));
+        f.Write(int32_t(meshes_count));
+        for (int i = 0; i < meshes_count; i++) {
+            f.WriteString("m" + std::to_string(i));
+            f.Write(int32_t(1));
+            f.Write(char(1));
+            f.Write(glm::vec4(1.0f)); //albedo, metallic, roughness, emission, emission strength, alpha
+            f.Write(0.0f);
+            f.Write(0.5f);
+            f.Write(glm::vec4(0.0f));
+            f.Write(0.0f);
+            f.Write(1.0f);
+            for (int k = 0; k < 5; k++) f.WriteString(""); //no maps
+            f.Write(int32_t(0));
+            f.Write(int32_t(3));
+            for (int k = 0; k < 3; k++) {
+                f.Write(glm::vec3(float(k == 1), float(k == 2), float(i)));
+                f.Write(glm::vec3(0, 0, 1));
+                f.Write(int32_t(0));
+            }
+            f.Write(int32_t(1));
+            f.Write(int32_t(0));
+            f.Write(char(1));
+            f.Write(glm::vec3(0, 0, 1));
+            for (int k = 0; k < 3; k++) {
+                f.Write(int32_t(k));
+                f.Write(glm::vec2(0.0f));
+            }
+        }
+        f.Write(int32_t(meshes_count));
+        for (int i = 0; i < meshes_count; i++) {
+            f.WriteString("i" + std::to_string(i));
+            f.WriteString("");
+            f.Write(glm::mat4(1.0f));
+            f.WriteString("m" + std::to_string(i));
+        }
+        return path;
+    }
+    //count instances of the scene meshes in runs of up to max_run, groups are random in [0, groups)
+    std::vector<MCMeshInstancePtr> CloneInstances(MeshCollection& mc, const fs::path& scene, int meshes_count,
+                                                  int count, int max_run, int groups, unsigned seed) {
+        std::mt19937 rnd(seed);
+        std::vector<MCMeshInstancePtr> res;
+        res.reserve(count);
+        while (int(res.size()) < count) {
+            std::string name = "i" + std::to_string(rnd() % meshes_count);
+            int run = 1 + int(rnd() % max_run);
+            uint32_t group = rnd() % groups;
+            for (int k = 0; (k < run) && (int(res.size()) < count); k++) {
+                res.push_back(mc.Clone_MeshInstance(scene, name));
+                RA_CHECK(res.back());
+                res.back()->SetGroupID(group);
+            }
+        }
+        return res;
+    }
+}
+
+RA_TEST(MCAffine_PackUnpack)
+{
+    std::mt19937 rnd(7);
+    for (int i = 0; i < 1000; i++) {
+        glm::mat4 m = RandomTransform(rnd);
+        MCAffine a = MCAffine::Pack(m);
+        //floats are only moved around, so the round trip is exact
+        RA_CHECK(a.Unpack() == m);
+        //rows are what the shader dots with float4(pos, 1)
+        glm::vec4 p(1.5f, -2.0f, 3.25f, 1.0f);
+        glm::vec4 w = m * p;
+        RA_CHECK(glm::abs(glm::dot(a.row0, p) - w.x) <= 1e-3f);
+        RA_CHECK(glm::abs(glm::dot(a.row1, p) - w.y) <= 1e-3f);
+        RA_CHECK(glm::abs(glm::dot(a.row2, p) - w.z) <= 1e-3f);
+    }
+    RA_CHECK(MCAffine::Pack(glm::mat4(1.0f)).Unpack() == glm::mat4(1.0f));
+}
+
+RA_TEST(MCAffineHalf_PackUnpack)
+{
+    std::mt19937 rnd(8);
+    for (int i = 0; i < 1000; i++) {
+        glm::mat4 m = RandomTransform(rnd);
+        MCAffineHalf a = MCAffineHalf::Pack(m);
+        glm::mat4 u = a.Unpack();
+        //translation stays in floats, the rest is within half precision
+        RA_CHECK(u[3] == m[3]);
+        glm::mat3 rs = glm::mat3(m);
+        glm::mat3 urs = glm::mat3(u);
+        for (int c = 0; c < 3; c++)
+            for (int r = 0; r < 3; r++)
+                RA_CHECK(glm::abs(urs[c][r] - rs[c][r]) <= glm::max(glm::abs(rs[c][r]) * 1e-3f, 1e-4f));
+        RA_CHECK((a.row0.w == 0) && (a.row1.w == 0) && (a.row2.w == 0));
+        //the shader adds translation after the half rows, far away translations keep float precision
+        glm::vec3 p(1.5f, -2.0f, 3.25f);
+        glm::vec3 w = glm::vec3(m * glm::vec4(p, 1.0f));
+        glm::vec3 hw = glm::vec3(glm::dot(glm::vec3(glm::unpackHalf(a.row0)), p),
+                                 glm::dot(glm::vec3(glm::unpackHalf(a.row1)), p),
+                                 glm::dot(glm::vec3(glm::unpackHalf(a.row2)), p)) + a.translation;
+        RA_CHECK(MaxDiff(glm::vec4(hw, 0), glm::vec4(w, 0)) <= 0.05f);
+    }
+    RA_CHECK(MaxDiff(MCAffineHalf::Pack(glm::mat4(1.0f)).Unpack(), glm::mat4(1.0f)) == 0);
+}
+
+RA_TEST(MCMeshInstanceVertex_Layouts)
+{
+    const Layout* l = MCMeshInstanceVertex::Layout();
+    RA_CHECK(l->stride == sizeof(MCMeshInstanceVertex));
+    CheckField(l, 0, "trow0_", offsetof(MCMeshInstanceVertex, transform.row0));
+    CheckField(l, 2, "trow2_", offsetof(MCMeshInstanceVertex, transform.row2));
+    CheckField(l, 3, "bind_idx", offsetof(MCMeshInstanceVertex, bind_idx));
+    CheckField(l, 6, "bone_remap_offset", offsetof(MCMeshInstanceVertex, bone_remap_offset));
+
+    const Layout* lh = MCMeshInstanceVertexHalf::Layout();
+    RA_CHECK(lh->stride == sizeof(MCMeshInstanceVertexHalf));
+    RA_CHECK(sizeof(MCMeshInstanceVertexHalf) < sizeof(MCMeshInstanceVertex));
+    CheckField(lh, 0, "trow0_", offsetof(MCMeshInstanceVertexHalf, transform.row0));
+    CheckField(lh, 2, "trow2_", offsetof(MCMeshInstanceVertexHalf, transform.row2));
+    CheckField(lh, 3, "tpos_", offsetof(MCMeshInstanceVertexHalf, transform.translation));
+    CheckField(lh, 4, "bind_idx", offsetof(MCMeshInstanceVertexHalf, bind_idx));
+    CheckField(lh, 7, "bone_remap_offset", offsetof(MCMeshInstanceVertexHalf, bone_remap_offset));
+}
+
+RA_TEST(MeshCollection_DrawCommandsCoverInstances)
+{
+    const int meshes_count = 20;
+    fs::path scene = WriteTestScene(meshes_count);
+    MeshCollection mc(RATest::Device());
+    std::vector<MCMeshInstancePtr> insts = CloneInstances(mc, scene, meshes_count, 2000, 16, 3, 1);
+    MeshCollectionBuffers bufs;
+    MeshCollectionDrawCommands dc;
+    for (int frame = 0; frame < 2; frame++) {
+        mc.PrepareBuffers(&bufs, &dc);
+        //instances are indexed in creation order in a fresh collection
+        std::vector<int> drawn(insts.size(), 0);
+        int commands = 0;
+        for (size_t b = 0; b < dc.batches.size(); b++) {
+            const MeshCollectionDrawBatch& batch = dc.batches[b];
+            if (b) RA_CHECK(dc.batches[b - 1].group_id <= batch.group_id);
+            RA_CHECK(batch.albedo);
+            RA_CHECK(batch.first_command == commands);
+            commands += batch.commands_count;
+            for (int c = batch.first_command; c < batch.first_command + batch.commands_count; c++) {
+                const DrawIndexedCmd& cmd = dc.commands[c];
+                RA_CHECK(cmd.IndexCount == 3);
+                RA_CHECK(cmd.BaseInstance + cmd.InstanceCount <= insts.size());
+                for (UINT k = cmd.BaseInstance; k < cmd.BaseInstance + cmd.InstanceCount; k++) {
+                    drawn[k]++;
+                    RA_CHECK(insts[k]->GetGroupID() == batch.group_id);
+                    RA_CHECK(insts[k]->MeshData() == insts[cmd.BaseInstance]->MeshData());
+                }
+            }
+        }
+        RA_CHECK(commands == int(dc.commands.size()));
+        RA_CHECK(std::all_of(drawn.begin(), drawn.end(), [](int d) { return d == 1; }));
+        //runs of one mesh are merged, so there are a lot less commands than instances
+        RA_CHECK(dc.commands.size() < insts.size() / 2);
+    }
+}
+
+RA_BENCH(MeshCollection_PrepareBuffers50k)
+{
+    const int meshes_count = 500;
+    fs::path scene = WriteTestScene(meshes_count);
+    for (int max_run : { 200, 1 }) {
+        MeshCollection mc(RATest::Device());
+        std::vector<MCMeshInstancePtr> insts = CloneInstances(mc, scene, meshes_count, 50000, max_run, 4, 2);
+        MeshCollectionBuffers bufs;
+        MeshCollectionDrawCommands dc;
+        mc.PrepareBuffers(&bufs, &dc);
+        double best = 1e9;
+        for (int i = 0; i < 50; i++) {
+            RATest::Timer t;
+            mc.PrepareBuffers(&bufs, &dc);
+            best = std::min(best, t.ElapsedMS());
+        }
+        printf("    50000 instances, %s: %.3f ms, %d commands, %d batches\n",
+               (max_run > 1) ? "runs of one mesh" : "random meshes", best, int(dc.commands.size()), int(dc.batches.size()));
+    }
+}
+
+RA_TEST(MeshCollection_DirtyInstancesSpan)
+{
+    const int meshes_count = 20;
+    fs::path scene = WriteTestScene(meshes_count);
+    DevicePtr dev = RATest::Device();
+    for (bool half : { false, true }) {
+        MeshCollection mc(dev, half);
+        std::vector<MCMeshInstancePtr> insts = CloneInstances(mc, scene, meshes_count, 1000, 16, 1, 3);
+        uint64_t stride = uint64_t(mc.InstanceLayout()->stride);
+        MeshCollectionBuffers bufs;
+        MeshCollectionDrawCommands dc;
+        mc.PrepareBuffers(&bufs, &dc);
+
+        dev->ResetStats();
+        mc.PrepareBuffers(&bufs, &dc);
+        RA_CHECK(dev->Stats().uploads == 0);
+
+        //dirty instances in different bit words go up as one span from the first to the last
+        std::mt19937 rnd(4);
+        insts[700]->SetTransform(RandomTransform(rnd));
+        insts[130]->SetTransform(RandomTransform(rnd));
+        dev->ResetStats();
+        mc.PrepareBuffers(&bufs, &dc);
+        RA_CHECK(dev->Stats().uploads == 1);
+        RA_CHECK(dev->Stats().upload_bytes == (700 - 130 + 1) * stride);
+
+        //word edges
+        MCMeshInstance* edges[] = { insts[63].get(), insts[64].get() };
+        glm::mat4 transforms[] = { RandomTransform(rnd), RandomTransform(rnd) };
+        mc.SetTransforms(edges, transforms, 2);
+        dev->ResetStats();
+        mc.PrepareBuffers(&bufs, &dc);
+        RA_CHECK(dev->Stats().uploads == 1);
+        RA_CHECK(dev->Stats().upload_bytes == 2 * stride);
+
+        insts[999]->SetTransform(RandomTransform(rnd));
+        dev->ResetStats();
+        mc.PrepareBuffers(&bufs, &dc);
+        RA_CHECK(dev->Stats().upload_bytes == stride);
+    }
+}
+
+RA_BENCH(MeshCollection_SetTransforms)
+{
+    const int meshes_count = 500;
+    fs::path scene = WriteTestScene(meshes_count);
+    DevicePtr dev = RATest::Device();
+    for (int count : { 10000, 50000 }) {
+        MeshCollection mc(dev);
+        std::vector<MCMeshInstancePtr> insts = CloneInstances(mc, scene, meshes_count, count, 200, 4, 5);
+        std::vector<MCMeshInstance*> ptrs;
+        for (const auto& inst : insts) ptrs.push_back(inst.get());
+        std::mt19937 rnd(6);
+        std::vector<glm::mat4> transforms(count);
+        for (auto& m : transforms) m = RandomTransform(rnd);
+        MeshCollectionBuffers bufs;
+        MeshCollectionDrawCommands dc;
+        mc.PrepareBuffers(&bufs, &dc);
+
+        //every instance moves, then a tenth of them scattered over the whole span
+        double best_all = 1e9;
+        double best_tenth = 1e9;
+        for (int i = 0; i < 20; i++) {
+            RATest::Timer t;
+            mc.SetTransforms(ptrs.data(), transforms.data(), count);
+            mc.PrepareBuffers(&bufs, &dc);
+            best_all = std::min(best_all, t.ElapsedMS());
+
+            RATest::Timer t2;
+            for (int k = 0; k < count; k += 10)
+                insts[k]->SetTransform(transforms[k]);
+            mc.PrepareBuffers(&bufs, &dc);
+            best_tenth = std::min(best_tenth, t2.ElapsedMS());
+        }
+        dev->ResetStats();
+        mc.SetTransforms(ptrs.data(), transforms.data(), count);
+        mc.PrepareBuffers(&bufs, &dc);
+        printf("    %d instances: all moved %.3f ms (%d uploads, %d kb), every tenth moved %.3f ms\n", count, best_all,
+               int(dev->Stats().uploads), int(dev->Stats().upload_bytes / 1024), best_tenth);
+    }
+}
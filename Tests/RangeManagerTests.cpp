@@ -0,0 +1,251 @@
+#include "Tests.h"
+#include "RUtils.h"
+#include <random>
+
+using namespace RA;
+
+namespace {
+    //brute force model of the managed space, owner id for every unit, -1 for free units
+    struct SpaceModel {
+        std::vector<int> owner;
+        bool HasFree(int size, int align) const {
+            for (int offset = 0; offset + size <= int(owner.size()); offset += align) {
+                int i = 0;
+                while ((i < size) && (owner[offset + i] < 0)) i++;
+                if (i == size) return true;
+            }
+            return false;
+        }
+        void Take(int offset, int size, int id) {
+            RA_CHECK(offset >= 0);
+            RA_CHECK(offset + size <= int(owner.size()));
+            for (int i = offset; i < offset + size; i++) {
+                RA_CHECK(owner[i] < 0);
+                owner[i] = id;
+            }
+        }
+        void Release(int offset, int size) {
+            for (int i = offset; i < offset + size; i++)
+                owner[i] = -1;
+        }
+    };
+    struct LiveRange {
+        MemRangeIntfPtr range;
+        int id;
+        int align;
+        int pad; //alignment padding in front of the range, owned by the allocation
+    };
+
+    void CheckTotals(const RangeManagerIntf* man, const std::vector<LiveRange>& live) {
+        int used = 0;
+        int used_end = 0;
+        for (const auto& r : live) {
+            used += r.range->Size();
+            used_end = std::max(used_end, r.range->Offset() + r.range->Size());
+        }
+        RangeManagerStats st = man->Stats();
+        RA_CHECK(man->Allocated() - st.padding == used);
+        RA_CHECK(man->FreeSpace() == man->Size() - man->Allocated());
+        RA_CHECK(st.used_end == used_end);
+        RA_CHECK(st.holes == st.used_end - man->Allocated());
+    }
+
+    void Churn(RangeFit fit, int align_bits, unsigned seed) {
+        std::mt19937 rnd(seed);
+        RangeManagerIntfPtr man = Create_RangeManager(64);
+        SpaceModel model;
+        model.owner.resize(man->Size(), -1);
+        std::vector<LiveRange> live;
+        int next_id = 0;
+        for (int it = 0; it < 20000; it++) {
+            if (live.empty() || (rnd() % 100 < 52)) {
+                int size = 1 + int(rnd() % 48);
+                int align = 1 << (rnd() % (align_bits + 1));
+                int padding = man->Stats().padding;
+                MemRangeIntfPtr r = man->Alloc(size, align, fit);
+                if (!r) {
+                    //only Good fit may skip a block that fits
+                    if (fit != RangeFit::Good) RA_CHECK(!model.HasFree(size, align));
+                    man->AddSpace(std::max(size + align, man->Size()));
+                    model.owner.resize(man->Size(), -1);
+                    r = man->Alloc(size, align, fit);
+                    RA_CHECK(r);
+                }
+                RA_CHECK(r->Size() == size);
+                RA_CHECK(r->Offset() % align == 0);
+                int pad = man->Stats().padding - padding;
+                RA_CHECK((pad >= 0) && (pad < align));
+                model.Take(r->Offset() - pad, size + pad, next_id);
+                live.push_back({ std::move(r), next_id++, align, pad });
+            }
+            else {
+                size_t i = rnd() % live.size();
+                std::swap(live[i], live.back());
+                const LiveRange& l = live.back();
+                model.Release(l.range->Offset() - l.pad, l.range->Size() + l.pad);
+                live.pop_back();
+            }
+            if (it % 500 == 0) CheckTotals(man.get(), live);
+        }
+        live.clear();
+        RA_CHECK(man->Allocated() == 0);
+        RA_CHECK(man->Stats().free_chunks == 1);
+    }
+}
+
+RA_TEST(RangeManager_ChurnMatchesModel)
+{
+    Churn(RangeFit::Good, 0, 1);
+    Churn(RangeFit::Best, 0, 2);
+    Churn(RangeFit::First, 0, 3);
+}
+
+RA_TEST(RangeManager_DefragKeepsData)
+{
+    std::mt19937 rnd(42);
+    RangeManagerIntfPtr man = Create_RangeManager(256);
+    std::vector<int> mem(man->Size(), -1); //id of the owner at every unit, moved by the relocation callback
+    std::vector<LiveRange> live;
+    int next_id = 0;
+    int moves = 0;
+    auto relocated = [&](const MemRangeIntf* range, int old_offset) {
+        RA_CHECK(range->Offset() != old_offset);
+        RA_CHECK(range->Offset() < old_offset);
+        memmove(&mem[range->Offset()], &mem[old_offset], range->Size() * sizeof(int));
+        moves++;
+    };
+    auto check_data = [&]() {
+        for (const auto& r : live) {
+            RA_CHECK(r.range->Offset() % r.align == 0);
+            for (int i = 0; i < r.range->Size(); i++)
+                RA_CHECK(mem[r.range->Offset() + i] == r.id);
+        }
+    };
+    for (int it = 0; it < 20000; it++) {
+        if (live.empty() || (rnd() % 100 < 50)) {
+            int size = 1 + int(rnd() % 32);
+            int align = 1 << (rnd() % 4);
+            MemRangeIntfPtr r = man->Alloc(size, align);
+            if (!r) {
+                man->AddSpace(man->Size());
+                mem.resize(man->Size(), -1);
+                r = man->Alloc(size, align);
+                RA_CHECK(r);
+            }
+            for (int i = 0; i < size; i++) mem[r->Offset() + i] = next_id;
+            live.push_back({ std::move(r), next_id++, align, 0 });
+        }
+        else {
+            size_t i = rnd() % live.size();
+            std::swap(live[i], live.back());
+            live.pop_back();
+        }
+        if (it % 16 == 0) {
+            man->Defrag(64, relocated);
+            check_data();
+        }
+    }
+    RA_CHECK(moves > 0);
+    while (!man->Defrag(1024, relocated)) {}
+    check_data();
+    RangeManagerStats st = man->Stats();
+    RA_CHECK(st.holes == 0);
+    RA_CHECK(st.free_chunks == 1);
+    RA_CHECK(st.fragmentation == 0);
+    RA_CHECK(st.used_end == man->Allocated());
+}
+
+RA_TEST(RangeManager_ExactSizeReuse)
+{
+    RangeManagerIntfPtr man = Create_RangeManager(100);
+    MemRangeIntfPtr a = man->Alloc(100);
+    RA_CHECK(a && a->Offset() == 0);
+    a.reset();
+    a = man->Alloc(100);
+    RA_CHECK(a && a->Offset() == 0);
+    a.reset();
+
+    MemRangeIntfPtr b = man->Alloc(10);
+    MemRangeIntfPtr c = man->Alloc(37);
+    MemRangeIntfPtr d = man->Alloc(10);
+    c.reset();
+    //the freed block has exactly the requested size, every policy has to pick it over the larger tail
+    for (RangeFit fit : { RangeFit::Good, RangeFit::Best, RangeFit::First }) {
+        MemRangeIntfPtr r = man->Alloc(37, 1, fit);
+        RA_CHECK(r && r->Offset() == 10);
+    }
+}
+
+RA_TEST(RangeManager_Alignment)
+{
+    RangeManagerIntfPtr man = Create_RangeManager(0);
+    man->AddSpace(1000);
+    MemRangeIntfPtr a = man->Alloc(3);
+    MemRangeIntfPtr b = man->Alloc(256, 256);
+    RA_CHECK(b && b->Offset() == 256);
+    RA_CHECK(man->Stats().padding == 253);
+    MemRangeIntfPtr c = man->Alloc(5, 16, RangeFit::First);
+    RA_CHECK(c && c->Offset() == 512);
+    b.reset();
+    RA_CHECK(man->Stats().padding == 0);
+    //First takes the lowest aligned offset, Best the smallest block
+    MemRangeIntfPtr d = man->Alloc(4, 16, RangeFit::First);
+    RA_CHECK(d && d->Offset() == 16);
+    MemRangeIntfPtr e = man->Alloc(4, 16, RangeFit::Best);
+    RA_CHECK(e && e->Offset() == 528);
+}
+
+RA_TEST(RangeManager_AlignedChurnMatchesModel)
+{
+    Churn(RangeFit::Good, 4, 4);
+    Churn(RangeFit::Best, 4, 5);
+    Churn(RangeFit::First, 4, 6);
+}
+
+RA_TEST(ManagedSBO_CoalescedUploads)
+{
+    const int stride = 16;
+    const int verts = 8;
+    DevicePtr dev = RATest::Device();
+    ManagedSBO sbo(dev, stride);
+    std::vector<ManagedSBO_RangePtr> ranges;
+    for (int i = 0; i < 200; i++) {
+        ranges.push_back(sbo.Alloc(verts));
+        RA_CHECK(ranges.back()->Offset() == i * verts);
+    }
+    auto fill = [&](int idx, char v) {
+        std::vector<char> data(size_t(verts) * stride, v);
+        ranges[idx]->SetData(data.data());
+    };
+    for (int i = 0; i < 200; i++) fill(i, char(i));
+
+    //the first call creates the buffer with the whole shadow
+    dev->ResetStats();
+    sbo.Buffer();
+    RA_CHECK(dev->Stats().uploads == 1);
+    dev->ResetStats();
+    sbo.Buffer();
+    RA_CHECK(dev->Stats().uploads == 0);
+
+    //ranges changed in any order, repeated and with small gaps are one upload
+    for (int i : { 9, 3, 0, 5, 3, 7 }) fill(i, char(100 + i));
+    dev->ResetStats();
+    sbo.Buffer();
+    RA_CHECK(dev->Stats().uploads == 1);
+    RA_CHECK(dev->Stats().upload_bytes == uint64_t(10 * verts * stride));
+
+    //gaps larger than 4kb split uploads
+    for (int i = 0; i < 10; i++) fill(i, char(50 + i));
+    for (int i = 190; i < 200; i++) fill(i, char(i - 50));
+    dev->ResetStats();
+    sbo.Buffer();
+    RA_CHECK(dev->Stats().uploads == 2);
+    RA_CHECK(dev->Stats().upload_bytes == uint64_t(20 * verts * stride));
+
+    std::vector<char> gpu(size_t(sbo.Capacity()) * stride);
+    sbo.Buffer()->ReadBack(gpu.data());
+    for (int i = 0; i < 200; i++) {
+        char expected = (i < 10) ? char(50 + i) : ((i >= 190) ? char(i - 50) : char(i));
+        RA_CHECK(gpu[size_t(i) * verts * stride] == expected);
+    }
+}
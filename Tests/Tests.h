@@ -0,0 +1,47 @@
+#pragma once
+#include "RAdopt.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+//minimal test runner. Tests run by default, benchmarks only with --bench,
+//any other argument is a substring filter for test names
+namespace RATest {
+    using TestFunc = void(*)();
+    struct TestCase {
+        const char* name;
+        TestFunc func;
+        bool bench;
+    };
+    std::vector<TestCase>& Registry();
+    struct Registrar {
+        Registrar(const char* name, TestFunc func, bool bench);
+    };
+    [[noreturn]] void Fail(const char* file, int line, const char* expr);
+
+    //device of a hidden window, created on the first call
+    RA::DevicePtr Device();
+    //operator new calls made by the process so far
+    size_t AllocCount();
+
+    class Timer {
+    private:
+        std::chrono::high_resolution_clock::time_point m_start;
+    public:
+        double ElapsedMS() const {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_start).count();
+        }
+        Timer() : m_start(std::chrono::high_resolution_clock::now()) {}
+    };
+}
+
+#define RA_TEST(name) \
+    static void name(); \
+    static RATest::Registrar name##_registrar(#name, name, false); \
+    static void name()
+#define RA_BENCH(name) \
+    static void name(); \
+    static RATest::Registrar name##_registrar(#name, name, true); \
+    static void name()
+#define RA_CHECK(expr) \
+    do { if (!(expr)) RATest::Fail(__FILE__, __LINE__, #expr); } while (0)
@@ -0,0 +1,105 @@
+#include "Tests.h"
+#include "RFonts.h"
+#include <string>
+
+using namespace RA;
+
+RA_TEST(TextBuilder_WrappedLayoutAllocations)
+{
+    Atlas_GlyphsSDF atlas(RATest::Device());
+    ITextBuilderPtr tb = Create_TextBuilder(&atlas);
+    //one short paragraph vs hundreds of distinct ones, more than the measured runs memo keeps
+    std::string small = "short paragraph of a few words";
+    std::string large;
+    for (int i = 0; i < 600; i++)
+        large += "paragraph " + std::to_string(i) + " of a longer text that wraps\n";
+    auto layout = [&](const std::string& text, int times) {
+        size_t before = RATest::AllocCount();
+        for (int i = 0; i < times; i++) {
+            tb->WriteWrappedMultiline(std::string_view(text), 300.0f);
+            tb->Finish();
+        }
+        return RATest::AllocCount() - before;
+    };
+    //glyphs, the memo and scratch buffers reach their sizes
+    layout(small, 2);
+    layout(large, 5);
+    //then only the result of Finish is allocated, whatever the amount of text
+    size_t small_allocs = layout(small, 20);
+    size_t large_allocs = layout(large, 20);
+    RA_CHECK(small_allocs == large_allocs);
+    RA_CHECK(small_allocs <= 20 * 8);
+}
+
+RA_TEST(TextLayoutCache_PerCallerBounds)
+{
+    Atlas_GlyphsSDF atlas(RATest::Device());
+    TextLayoutCache tc(&atlas);
+    FontParams font;
+    ITextLinesPtr a = tc.Obtain(L"shared label", font);
+    ITextLinesPtr b = tc.Obtain(L"shared label", font);
+    //the layout is shared, bounds and valign are not
+    RA_CHECK(a != b);
+    RA_CHECK(&a->AllGlyphs() == &b->AllGlyphs());
+    RA_CHECK(a->GetBounds() == b->GetBounds());
+    a->SetBounds(glm::vec4(10, 20, 110, 60));
+    a->SetVAlign(0.5f);
+    b->SetBounds(glm::vec4(300, 400, 500, 440));
+    RA_CHECK(a->GetBounds() == glm::vec4(10, 20, 110, 60));
+    RA_CHECK(a->GetVAlign() == 0.5f);
+    RA_CHECK(b->GetVAlign() == 0.0f);
+    //a later caller starts from the default bounds of the layout
+    ITextLinesPtr c = tc.Obtain(L"shared label", font);
+    RA_CHECK(c->GetBounds() == glm::vec4(0, 0, c->MaxLineWidth(), c->TotalHeight()));
+}
+
+RA_BENCH(TextLayoutCache_ParagraphRelayout)
+{
+    Atlas_GlyphsSDF atlas(RATest::Device());
+    std::wstring paragraph;
+    for (int i = 0; i < 40; i++)
+        paragraph += L"a paragraph of an ordinary dialog text that is wrapped to the width of its control ";
+    FontParams font;
+    font.size = 16;
+    const int frames = 100;
+    //glyphs are rasterized into the atlas before timing
+    {
+        ITextBuilderPtr tb = Create_TextBuilder(&atlas);
+        tb->Font_Set(font);
+        tb->WriteWrappedMultiline(std::wstring_view(paragraph), 400.0f);
+        tb->Finish();
+    }
+    //fresh builder every frame, nothing is reused
+    {
+        RATest::Timer t;
+        for (int i = 0; i < frames; i++) {
+            ITextBuilderPtr tb = Create_TextBuilder(&atlas);
+            tb->Font_Set(font);
+            tb->WriteWrappedMultiline(std::wstring_view(paragraph), 400.0f);
+            tb->Finish();
+        }
+        printf("    fresh builder: %.3f ms per layout\n", t.ElapsedMS() / frames);
+    }
+    //control is resized every frame, measured words are reused and only wrapping is redone
+    {
+        ITextBuilderPtr tb = Create_TextBuilder(&atlas);
+        tb->Font_Set(font);
+        RATest::Timer t;
+        for (int i = 0; i < frames; i++) {
+            tb->WriteWrappedMultiline(std::wstring_view(paragraph), 300.0f + float(i % 20) * 10.0f);
+            tb->Finish();
+        }
+        printf("    resized, measured runs memo: %.3f ms per layout\n", t.ElapsedMS() / frames);
+    }
+    //same width, the layout comes from the cache
+    {
+        TextLayoutCache tc(&atlas);
+        tc.Obtain(paragraph, font, 400.0f);
+        RATest::Timer t;
+        for (int i = 0; i < frames; i++) {
+            ITextLinesPtr lines = tc.Obtain(paragraph, font, 400.0f);
+            lines->SetBounds(glm::vec4(0, 0, 400, 300));
+        }
+        printf("    unchanged, layout cache: %.3f ms per layout\n", t.ElapsedMS() / frames);
+    }
+}
@@ -0,0 +1,99 @@
+#include "Tests.h"
+#include "RUtils.h"
+
+using namespace RA;
+
+namespace {
+    template <typename Str>
+    std::vector<uint32_t> Decode(Str s) {
+        std::vector<uint32_t> res;
+        size_t i = 0;
+        while (i < s.size()) {
+            size_t prev = i;
+            res.push_back(NextCodePoint(s, i));
+            RA_CHECK(i > prev);
+            RA_CHECK(i <= s.size());
+        }
+        return res;
+    }
+    std::vector<uint32_t> DecodeUTF8(std::string_view s) {
+        return Decode(s);
+    }
+    std::vector<uint32_t> DecodeUTF16(const std::vector<uint16_t>& units) {
+        std::wstring s(units.begin(), units.end());
+        return Decode(std::wstring_view(s));
+    }
+    using CP = std::vector<uint32_t>;
+}
+
+RA_TEST(NextCodePoint_UTF8Valid)
+{
+    RA_CHECK(DecodeUTF8("a\x7F") == CP({ 0x61, 0x7F }));
+    RA_CHECK(DecodeUTF8("\xC2\x80\xDF\xBF") == CP({ 0x80, 0x7FF }));
+    RA_CHECK(DecodeUTF8("\xE0\xA0\x80\xEF\xBF\xBF") == CP({ 0x800, 0xFFFF }));
+    RA_CHECK(DecodeUTF8("\xED\x9F\xBF\xEE\x80\x80") == CP({ 0xD7FF, 0xE000 }));
+    RA_CHECK(DecodeUTF8("\xF0\x90\x80\x80\xF4\x8F\xBF\xBF") == CP({ 0x10000, 0x10FFFF }));
+}
+
+RA_TEST(NextCodePoint_UTF8Overlong)
+{
+    RA_CHECK(DecodeUTF8("\xC0\x80") == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF8("\xC1\xBF") == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF8("\xE0\x80\xAF") == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF8("\xE0\x9F\xBF") == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF8("\xF0\x8F\xBF\xBF") == CP({ 0xFFFD }));
+    //the decoder resyncs on the next byte
+    RA_CHECK(DecodeUTF8("\xC0\xAFx") == CP({ 0xFFFD, 0x78 }));
+}
+
+RA_TEST(NextCodePoint_UTF8OutOfRange)
+{
+    //encoded surrogates
+    RA_CHECK(DecodeUTF8("\xED\xA0\x80") == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF8("\xED\xBF\xBF") == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF8("\xED\xA0\xBD\xED\xB8\x80") == CP({ 0xFFFD, 0xFFFD }));
+    //above U+10FFFF
+    RA_CHECK(DecodeUTF8("\xF4\x90\x80\x80") == CP({ 0xFFFD }));
+    //5 and 6 byte leads and bytes never valid in utf-8
+    RA_CHECK(DecodeUTF8("\xF8\xFC\xFE\xFF") == CP({ 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD }));
+    //stray continuation bytes
+    RA_CHECK(DecodeUTF8("\x80\xBFz") == CP({ 0xFFFD, 0xFFFD, 0x7A }));
+}
+
+RA_TEST(NextCodePoint_UTF8Truncated)
+{
+    RA_CHECK(DecodeUTF8("\xC2") == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF8("\xE2\x82") == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF8("\xF0\x9F\x98") == CP({ 0xFFFD }));
+    //a lead byte cut by the next character doesn't swallow it
+    RA_CHECK(DecodeUTF8("\xE2\x82" "a") == CP({ 0xFFFD, 0x61 }));
+    RA_CHECK(DecodeUTF8("\xF0\x9F\xC2\xA9") == CP({ 0xFFFD, 0xA9 }));
+    //truncation in the middle of a string_view, the bytes behind its end are not read
+    std::string_view cut("\xE2\x82\xAC", 2);
+    RA_CHECK(DecodeUTF8(cut) == CP({ 0xFFFD }));
+}
+
+RA_TEST(NextCodePoint_UTF16)
+{
+    if constexpr (sizeof(wchar_t) != 2) return;
+    RA_CHECK(DecodeUTF16({ 0x41, 0xD7FF, 0xE000, 0xFFFF }) == CP({ 0x41, 0xD7FF, 0xE000, 0xFFFF }));
+    RA_CHECK(DecodeUTF16({ 0xD800, 0xDC00, 0xDBFF, 0xDFFF }) == CP({ 0x10000, 0x10FFFF }));
+    RA_CHECK(DecodeUTF16({ 0xD83D, 0xDE00 }) == CP({ 0x1F600 }));
+    //unpaired surrogates
+    RA_CHECK(DecodeUTF16({ 0xDC00 }) == CP({ 0xFFFD }));
+    RA_CHECK(DecodeUTF16({ 0xDC00, 0xD800 }) == CP({ 0xFFFD, 0xFFFD }));
+    RA_CHECK(DecodeUTF16({ 0xD800, 0x41 }) == CP({ 0xFFFD, 0x41 }));
+    RA_CHECK(DecodeUTF16({ 0xD800, 0xD800, 0xDC00 }) == CP({ 0xFFFD, 0x10000 }));
+    //truncated pair at the end
+    RA_CHECK(DecodeUTF16({ 0x41, 0xD83D }) == CP({ 0x41, 0xFFFD }));
+}
+
+RA_TEST(NextCodePoint_RoundTrip)
+{
+    std::string utf8 = "plain ascii text, longer than 8 bytes \xC3\xA9t\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80 end";
+    std::wstring wide = UTF8ToWString(utf8);
+    RA_CHECK(WStringToUTF8(wide) == utf8);
+    RA_CHECK(Decode(std::wstring_view(wide)) == DecodeUTF8(utf8));
+    //malformed input round trips as U+FFFD
+    RA_CHECK(WStringToUTF8(UTF8ToWString("a\xC0\x80" "b")) == "a\xEF\xBF\xBD" "b");
+}
@@ -0,0 +1,100 @@
+#include "Tests.h"
+#include <Win.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+static std::atomic<size_t> g_alloc_count(0);
+
+void* operator new(size_t size)
+{
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    void* res = malloc(size ? size : 1);
+    if (!res) throw std::bad_alloc();
+    return res;
+}
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+namespace RATest {
+    struct Failure {
+        std::string msg;
+    };
+
+    std::vector<TestCase>& Registry()
+    {
+        static std::vector<TestCase> res;
+        return res;
+    }
+    Registrar::Registrar(const char* name, TestFunc func, bool bench)
+    {
+        Registry().push_back({ name, func, bench });
+    }
+    void Fail(const char* file, int line, const char* expr)
+    {
+        throw Failure{ std::string(file) + "(" + std::to_string(line) + "): " + expr };
+    }
+    RA::DevicePtr Device()
+    {
+        static RA::DevicePtr dev;
+        if (!dev) {
+            WNDCLASSEXW wcex = { };
+            wcex.cbSize = sizeof(WNDCLASSEX);
+            wcex.lpfnWndProc = DefWindowProcW;
+            wcex.hInstance = GetModuleHandle(nullptr);
+            wcex.lpszClassName = L"RAdoptTestsWnd";
+            RegisterClassExW(&wcex);
+            //never shown, the device only needs a window for the swap chain
+            HWND wnd = CreateWindowExW(0, wcex.lpszClassName, L"RAdopt tests", WS_OVERLAPPEDWINDOW,
+                                       0, 0, 256, 256, 0, 0, wcex.hInstance, nullptr);
+            dev = std::make_shared<RA::Device>(wnd, false);
+        }
+        return dev;
+    }
+    size_t AllocCount()
+    {
+        return g_alloc_count.load(std::memory_order_relaxed);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool bench = false;
+    const char* filter = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0)
+            bench = true;
+        else
+            filter = argv[i];
+    }
+    int run = 0;
+    int failed = 0;
+    for (const auto& t : RATest::Registry()) {
+        if (t.bench != bench) continue;
+        if (filter && !strstr(t.name, filter)) continue;
+        run++;
+        try {
+            t.func();
+            printf("[ OK ] %s\n", t.name);
+        }
+        catch (const RATest::Failure& f) {
+            failed++;
+            printf("[FAIL] %s\n       %s\n", t.name, f.msg.c_str());
+        }
+        catch (const std::exception& e) {
+            failed++;
+            printf("[FAIL] %s\n       exception: %s\n", t.name, e.what());
+        }
+    }
+    printf("%d run, %d failed\n", run, failed);
+    return failed ? 1 : 0;
+}
@@ -98,7 +98,9 @@ namespace RA {
             ComPtr<ID3D11DepthStencilState> m_d_state;
             D3D11_BLEND_DESC m_b_desc;
             ComPtr<ID3D11BlendState> m_b_state;
+            D3D11_RECT m_scissor;
             inline StateData(States* st) {
+                m_scissor = st->m_scissor;
                 m_r_desc = st->m_r_desc;
                 m_d_desc = st->m_d_desc;
                 m_b_desc = st->m_b_desc;
@@ -114,6 +116,8 @@ namespace RA {
 
         D3D11_RASTERIZER_DESC m_r_desc;
         ComPtr<ID3D11RasterizerState> m_r_state;
+        D3D11_RECT m_scissor;
+        bool m_scissor_valid;
 
         UINT m_stencil_ref;
         D3D11_DEPTH_STENCIL_DESC m_d_desc;
@@ -131,6 +135,7 @@ namespace RA {
 
         void SetWireframe(bool wire);
         void SetCull(CullMode cm);
+        void SetScissor(bool enable, const glm::ivec4& rect = glm::ivec4(0)); //rect: xy - min, zw - max in pixels
 
         void SetDepthEnable(bool enable);
         void SetDepthWrite(bool enable);
@@ -165,6 +170,13 @@ namespace RA {
     using ProgramPtr = std::shared_ptr<Program>;
     using UniformBufferPtr = std::shared_ptr<UniformBuffer>;
 
+    //counters of the device work, reset by Device::ResetStats
+    struct DeviceStats {
+        uint64_t draw_calls = 0;
+        uint64_t uploads = 0;      //UpdateSubresource calls, maps for write and buffers created with data
+        uint64_t upload_bytes = 0;
+    };
+
     class Device : public std::enable_shared_from_this<Device> {
         friend class Texture2D;
         friend class Texture3D;
@@ -192,6 +204,10 @@ namespace RA {
 
         bool m_srgb;
 
+        DeviceStats m_stats;
+        uint64_t m_frame_index = 0;
+        void CountUpload(size_t bytes);
+
         std::unordered_map<Sampler, ComPtr<ID3D11SamplerState>, Sampler> m_samplers;
         ID3D11SamplerState* ObtainSampler(const Sampler& s);
         void SetDefaultFBO();
@@ -213,6 +229,9 @@ namespace RA {
         FrameBufferPtr ActiveFrameBuffer() const;
         Program* ActiveProgram();
 
+        const DeviceStats& Stats() const;
+        void ResetStats();
+
         FrameBufferPtr Create_FrameBuffer();
         Texture2DPtr Create_Texture2D();
         Texture3DPtr Create_Texture3D();
@@ -224,6 +243,8 @@ namespace RA {
 
         void BeginFrame();
         void PresentToWnd();
+        //number of frames presented so far
+        uint64_t FrameIndex() const;
     };
     using DevicePtr = std::shared_ptr<Device>;
 
@@ -396,7 +417,7 @@ namespace RA {
         ~FrameBuffer();
     };
 
-    enum class LayoutType {Byte, Word, UInt, Float};
+    enum class LayoutType {Byte, Word, UInt, Float, Half};
     struct LayoutField {
         std::string name;
         LayoutType type = LayoutType::Byte;
@@ -420,12 +441,18 @@ namespace RA {
     private:
         const Layout* m_layout;
         int m_vert_count;
+        bool m_dynamic;
         ComPtr<ID3D11Buffer> m_handle;
     public:
         int VertexCount();
         const Layout* GetLayout() const;
         void SetState(const Layout* layout, int vertex_count, const void* data = nullptr);
         void SetSubData(int start_vertex, int num_vertices, const void* data);
+        //cpu writable buffer, it's filled with Map/Unmap instead of SetSubData
+        void SetStateDynamic(const Layout* layout, int vertex_count);
+        //discard = false promises that the gpu doesn't read the mapped vertices
+        void* Map(int start_vertex, int num_vertices, bool discard);
+        void Unmap();
         VertexBuffer(const DevicePtr& device);
     };
 
@@ -437,6 +464,7 @@ namespace RA {
         int m_vert_count;
         bool m_UAV_access;
         bool m_UAV_with_counter;
+        bool m_dynamic;
         ComPtr<ID3D11Buffer> m_handle;
         ComPtr<ID3D11ShaderResourceView> m_srv;
         ComPtr<ID3D11UnorderedAccessView> m_uav;
@@ -448,6 +476,10 @@ namespace RA {
 
         void SetState(int stride, int vertex_count, bool UAV = false, bool UAV_with_counter = false, const void* data = nullptr);
         void SetSubData(int start_vertex, int num_vertices, const void* data);
+        //as VertexBuffer::SetStateDynamic. Map with discard = false needs d3d 11.1 runtime (MapNoOverwriteOnDynamicBufferSRV)
+        void SetStateDynamic(int stride, int vertex_count);
+        void* Map(int start_vertex, int num_vertices, bool discard);
+        void Unmap();
 
         void ReadBack(void* data);
         StructuredBuffer(const DevicePtr& device);
@@ -2,6 +2,7 @@
 #include "RAdopt.h"
 #include "RUtils.h"
 #include <filesystem>
+#include <mutex>
 #include <unordered_set>
 
 namespace RA {
@@ -34,6 +35,7 @@ namespace RA {
         Texture2DPtr m_tex;
         StructuredBufferPtr m_glyphs_sbo;
         bool m_tex_valid;
+        std::mutex m_mutex; //sprites can be added from recording threads while the render thread validates the texture
 
         std::vector<BaseAtlasSprite*> m_sprites;
 
@@ -28,15 +28,75 @@ namespace RA {
     struct Batch {
         BatchKind kind;
         glm::ivec2 ranges;
+        glm::AABR bounds;      //canvas space bounds of the primitives, used by batch reordering
+        float pix_margin = 0;  //how far primitives can go past bounds in pixels (line width)
+        int clip = -1;         //index of the canvas clip rect applied as scissor, -1 - not clipped
     };
 
     struct CanvasBuffers {
         const std::vector<Batch>* batches;
         const VertexBufferPtr* text_buf;
         const VertexBufferPtr* tris_buf;
+        const IndexBufferPtr* tris_ibuf; //tris batch ranges are ranges of this buffer
     };
 
     enum class PenAlign { left, right };
+    enum class PenJoin { miter, round, bevel };
+
+    enum class FillRule { NonZero, EvenOdd };
+
+    //closed contours of a filled shape. Curves are flattened when they are added,
+    //a contour that isn't closed explicitly is closed by the next MoveTo or when the path is filled
+    class CanvasPath {
+        friend class PathTessCache;
+    private:
+        std::vector<glm::vec2> m_pts;
+        std::vector<int> m_contour_ends; //end of every closed contour in m_pts
+        float m_tolerance;
+        mutable uint32_t m_hash;
+        mutable bool m_hash_valid;
+        int ContourStart() const;
+    public:
+        void MoveTo(const glm::vec2& pt);
+        void LineTo(const glm::vec2& pt);
+        void QuadTo(const glm::vec2& ctrl, const glm::vec2& pt);
+        void Close();
+        void Clear();
+        bool Empty() const;
+        uint32_t Hash() const;
+        //tolerance - max distance in canvas units between a curve and its flattened segments
+        CanvasPath(float tolerance = 0.25f);
+    };
+
+    //LRU cache of path tessellations. Tessellation doesn't depend on the path position,
+    //so the same icon is triangulated once wherever it's drawn
+    class PathTessCache {
+    public:
+        struct Tessellation {
+            std::vector<glm::vec2> vertices;
+            std::vector<uint32_t> indices;
+            glm::AABR bounds;
+        };
+        using TessellationPtr = std::shared_ptr<const Tessellation>;
+    private:
+        struct Entry {
+            uint32_t hash;
+            FillRule rule;
+            std::vector<glm::vec2> pts;
+            std::vector<int> contour_ends;
+            TessellationPtr tess;
+        };
+    private:
+        size_t m_max_entries;
+        std::list<Entry> m_lru;
+        std::unordered_multimap<uint32_t, std::list<Entry>::iterator> m_entries;
+    public:
+        static TessellationPtr Tessellate(const CanvasPath& path, FillRule rule);
+        TessellationPtr Obtain(const CanvasPath& path, FillRule rule);
+        void Clear();
+        PathTessCache(size_t max_entries = 256);
+    };
+    using PathTessCachePtr = std::shared_ptr<PathTessCache>;
 
     class Pen {
     private:
@@ -45,6 +105,7 @@ namespace RA {
         float m_width;
         float m_min_pix_width;
         PenAlign m_penalign;
+        PenJoin m_join;
     public:
         glm::vec4 GetColor();
         void SetColor(const glm::vec4& color);
@@ -52,14 +113,22 @@ namespace RA {
         void SetHinting(bool hinting);
         float GetWidth();
         void SetWidth(float width);
+        //lines are never thinner than min width pixels, 1 by default
         float GetMinPixWidth();
         void SetMinPixWidth(float width);
         PenAlign GetAlign();
         void SetAlign(PenAlign align);
+        //join of polyline segments, miter joins longer than 4 widths become bevel
+        PenJoin GetJoin();
+        void SetJoin(PenJoin join);
         Pen();
     };
 
+    //Canvas instances are independent, so every one can be recorded on its own thread (atlas lookups are thread safe).
+    //Append, GetBuffers and Render upload to the device and have to be called from the render thread
     class Canvas {
+        friend class RetainedCanvas;
+        friend class CanvasItem;
     private:
         struct TextGlyphVertex3D {
             TextGlyphVertex v2d;            
@@ -71,21 +140,25 @@ namespace RA {
                 b.w -= lines->TotalHeight();
                 bounds2d = b;
             }
+            TextGlyphVertex3D(const glm::vec4& bounds2d, float valign, const TextGlyphVertex& v2d) :
+                v2d(v2d), bounds2d(bounds2d), valign(valign) {}
             static const Layout* Layout();
         };
         struct TrisVertex {
             glm::vec2 coord;
             glm::vec2 texcoord;
-            glm::vec4 color;
-            float hinting;
-            uint32_t sprite_idx;
+            uint32_t color;      //rgba8
+            uint32_t sprite_idx; //lower 31 bits - sprite index or cNoSprite, high bit - hinting
             static const Layout* Layout();
         };
+        static constexpr uint32_t cNoSprite = 0x7fffffff;
+        static constexpr uint32_t cHintingBit = 0x80000000;
+        //one instance per segment. Zero length instances are wedges of bevel and round joins
         struct LineVertex {
-            glm::vec4 coords;  //xy - start point, zw - end point
-            glm::vec4 normals; //xy - normal at start point, zw - normal at end point
-            glm::vec4 color;
-            glm::vec2 width;   //x - real width, y - minimal width in pixels
+            glm::vec4 coords;     //xy - start point, zw - end point
+            uint32_t normals[2];  //offsets of start and end point per unit of width, packed by PackLineNormal
+            uint32_t color;       //rgba8
+            float width;          //pixels
             float hinting;
             static const Layout* Layout();
         };
@@ -103,35 +176,84 @@ namespace RA {
         ProgramPtr m_lines_out_prog;
 
         std::vector<Batch> m_batches;
+        std::vector<Batch> m_reordered_batches;
+        bool m_reorder_batches;
+
+        std::vector<glm::AABR> m_clips; //canvas space, already intersected with parent clips
+        std::vector<int> m_clip_stack;
 
         std::vector<TextGlyphVertex3D> m_text;
+        std::vector<TextGlyphVertex3D> m_text_uploaded;
         VertexBufferPtr m_text_buf;
         bool m_text_buf_valid;
 
         std::vector<AtlasSpritePtr> m_used_sprites;
         std::vector<TrisVertex> m_tris;
+        std::vector<TrisVertex> m_tris_uploaded;
+        std::vector<uint32_t> m_tris_indices;
+        std::vector<uint32_t> m_tris_indices_uploaded;
         VertexBufferPtr m_tris_buf;
+        IndexBufferPtr m_tris_ibuf;
         bool m_tris_buf_valid;
 
         std::vector<LineVertex> m_lines;
+        std::vector<LineVertex> m_lines_uploaded;
         VertexBufferPtr m_lines_buf;
         bool m_lines_buf_valid;
 
+        bool m_streamed;
+        std::unique_ptr<FrameRingBuffer> m_text_ring;
+        std::unique_ptr<FrameRingBuffer> m_lines_ring;
+        uint64_t m_ring_frame;      //device frame the rings were last ended at
+        std::vector<glm::vec2> m_polyline_pts;     //scratch buffers of PushPolyline
+        std::vector<glm::vec2> m_polyline_dirs;
+        std::vector<glm::vec4> m_polyline_normals; //xy - normal at the end of incoming segment, zw - at the start of outgoing one
+
         ITextBuilderPtr m_tb;
+        TextLayoutCachePtr m_tc;
+        PathTessCachePtr m_path_cache;
 
         glm::vec3 m_pos;
 
         void ValidateBuffers();
-        void PushBatch(BatchKind kind, int size);
+        void PushBatch(BatchKind kind, int size, const glm::AABR& bounds, float pix_margin = 0);
+        void PushBatch(BatchKind kind, int size, const glm::AABR& bounds, float pix_margin, int clip);
+        const glm::AABR* ActiveClip() const;
+        glm::ivec4 ScissorRect(CameraBase& camera, const glm::mat3& transform_2d, const glm::AABR& clip);
+        const std::vector<Batch>& ReorderBatches(const glm::mat3& transform_2d);
+        uint32_t PenSpriteIdx(const AtlasSprite* sprite);
+        void PushTris(const TrisVertex* v, int vert_count, const uint32_t* indices, int ind_count);
+        void PushTessellation(const PathTessCache::Tessellation& tess, const glm::vec2& offset);
+        void PushPolyline(const glm::vec2* pts, int count, bool closed, bool flip_side);
     private:
         bool m_prog_was_inited[4];
-        void InitProgram(BatchKind kind, CameraBase& camera, const glm::mat3& transform_2d);
+        void InitProgram(BatchKind kind, CameraBase& camera, const glm::mat3& transform_2d, const VertexBufferPtr& buf, const IndexBufferPtr& ibuf);
+        //instance_offsets are added to base instances of glyph (x) and line (y) batches
+        void RenderBatches(CameraBase& camera, const glm::mat3& transform_2d, const std::vector<Batch>& batches,
+                           const VertexBufferPtr& text_buf, const VertexBufferPtr& tris_buf, const IndexBufferPtr& tris_ibuf, const VertexBufferPtr& lines_buf,
+                           const glm::ivec2& instance_offsets = glm::ivec2(0));
+        void RenderStreamed(CameraBase& camera, const glm::mat3& transform_2d, const std::vector<Batch>& batches);
     public:
         glm::vec3 GetPos();
         void SetPos(const glm::vec3& pt);
 
         Pen& Pen();
 
+        //merges batches of the same kind if nothing drawn between them overlaps, so interleaved
+        //text and shapes are drawn with a few draw calls. Visual order of overlapped primitives is kept
+        bool GetBatchReordering() const;
+        void SetBatchReordering(bool enable);
+
+        //for canvases rebuilt every frame. Glyphs and lines are pushed to frame ring buffers on every Render
+        //instead of being compared with the last upload, tris and GetBuffers are not affected
+        bool GetStreamed() const;
+        void SetStreamed(bool enable);
+
+        //primitives completely outside of the clip rect are skipped, axis aligned quads and glyphs are trimmed,
+        //everything else is cut by the scissor. Nested clip rects are intersected with the parent one
+        void PushClip(const glm::vec4& bounds); //xy - min, zw - max
+        void PopClip();
+
         AtlasSpritePtr GetSprite(const fs::path& filename);
         void AddSprite(const glm::vec2& pos,
                        const glm::vec2& origin,
@@ -150,13 +272,26 @@ namespace RA {
                        );
 
         void AddLine(const glm::vec2& pt1, const glm::vec2& pt2);
+        //connected segments with pen joins, every segment is a single line instance
+        void AddPolyline(const glm::vec2* pts, int count, bool closed = false);
+        void AddPolyline(const std::vector<glm::vec2>& pts, bool closed = false);
         void AddRectangle(const glm::AABR& rect);
         void AddRectangle(const glm::vec4& bounds);
         void AddFillRect(const glm::vec4& bounds);
+        //fills path moved by offset with the pen color, tessellation is taken from PathCache
+        void AddPath(const CanvasPath& path, FillRule rule = FillRule::NonZero, const glm::vec2& offset = glm::vec2(0));
+        //fills a single contour, polygons are usually dynamic, so they are tessellated every time
+        void AddPolygon(const std::vector<glm::vec2>& pts, FillRule rule = FillRule::NonZero);
+        PathTessCache* PathCache();
 
         ITextBuilder* TB();
+        TextLayoutCache* TC();
         void AddText(const ITextLinesPtr& lines);
+        //adds glyphs of text placed at pos that are visible inside clip (xy - min, zw - max)
+        void AddText(VirtualTextLines* text, const glm::vec2& pos, const glm::vec4& clip);
         void Clear();
+        //appends everything recorded on canvas, appended primitives are drawn at the position of this canvas
+        void Append(const Canvas& canvas);
 
         CanvasBuffers GetBuffers();
 
@@ -175,4 +310,93 @@ namespace RA {
         virtual ~Canvas() {};
     };
     using CanvasPtr = std::shared_ptr<Canvas>;
+
+    class RetainedCanvas;
+
+    //handle of a retained primitive, the primitive is removed from the canvas with the handle
+    class CanvasItem {
+        friend class RetainedCanvas;
+    private:
+        RetainedCanvas* m_owner;
+        int m_idx;                   //index in RetainedCanvas::m_items, which is kept in recording order
+        MemRangeIntfPtr m_ranges[4]; //indexed by BatchKind, nullptr if the item has no vertices of this kind
+        MemRangeIntfPtr m_tris_indices;
+        std::vector<AtlasSpritePtr> m_used_sprites;
+        CanvasItem(RetainedCanvas* owner);
+    public:
+        void Translate(const glm::vec2& delta);
+        void SetColor(const glm::vec4& color);
+        ~CanvasItem();
+    };
+    using CanvasItemPtr = std::unique_ptr<CanvasItem>;
+
+    //retained counterpart of Canvas. Vertices of every item live in range managed arenas,
+    //so adding, changing or removing an item uploads only its own vertices.
+    //Items are drawn in recording order, neighbour items of the same kind share a draw call if their vertices are adjacent
+    class RetainedCanvas {
+        friend class CanvasItem;
+    private:
+        struct Arena {
+            const Layout* layout; //nullptr for the index arena
+            int stride;
+            RangeManagerIntfPtr man;
+            std::vector<char> data;
+            VertexBufferPtr buf;
+            IndexBufferPtr ibuf;
+            glm::ivec2 dirty; //x - first dirty vertex, y - end of dirty vertices
+            bool buf_valid;   //false - buffer has to be recreated for the new capacity
+        };
+        static const int cInitialCapacity = 64;
+    private:
+        CanvasPtr m_canvas; //builds vertices of a single item and renders arenas
+        Arena m_arenas[4];
+        Arena m_tris_indices; //indices are absolute, they already include the offset of the item vertices
+        std::vector<CanvasItem*> m_items; //nullptr for removed items until the next ValidateBatches
+        std::vector<Batch> m_batches;
+        bool m_batches_valid;
+
+        void InitArena(Arena& arena, const Layout* layout);
+        void MarkDirty(Arena& arena, const glm::ivec2& offset_size);
+        MemRangeIntfPtr Store(Arena& arena, const void* data, int count);
+        void UploadArena(Arena& arena);
+        CanvasItemPtr Record();
+        void ValidateBatches();
+        void ValidateBuffers();
+    public:
+        glm::vec3 GetPos();
+        void SetPos(const glm::vec3& pt);
+
+        RA::Pen& Pen();
+        ITextBuilder* TB();
+
+        AtlasSpritePtr GetSprite(const fs::path& filename);
+        CanvasItemPtr AddSprite(const glm::vec2& pos,
+                                const glm::vec2& origin,
+                                const glm::vec2& size,
+                                float rotation,
+                                const glm::ivec4& sprite_cliprect,
+                                const AtlasSpritePtr& sprite);
+        CanvasItemPtr AddSprite(const glm::vec2& pos,
+                                const glm::vec2& origin,
+                                const glm::vec2& size,
+                                const AtlasSpritePtr& sprite);
+        CanvasItemPtr Add9Patch(const glm::AABR& rect,
+                                const glm::vec2& scale,
+                                int x1, int x2, int y1, int y2,
+                                const AtlasSpritePtr& sprite);
+        CanvasItemPtr AddLine(const glm::vec2& pt1, const glm::vec2& pt2);
+        CanvasItemPtr AddPolyline(const std::vector<glm::vec2>& pts, bool closed = false);
+        CanvasItemPtr AddRectangle(const glm::vec4& bounds);
+        CanvasItemPtr AddFillRect(const glm::vec4& bounds);
+        CanvasItemPtr AddPath(const CanvasPath& path, FillRule rule = FillRule::NonZero, const glm::vec2& offset = glm::vec2(0));
+        CanvasItemPtr AddPolygon(const std::vector<glm::vec2>& pts, FillRule rule = FillRule::NonZero);
+        CanvasItemPtr AddText(const ITextLinesPtr& lines);
+
+        void Render(CameraBase& camera);
+        void Render(CameraBase& camera, const glm::mat3& transform_2d);
+
+        RetainedCanvas(const CanvasCommonObject& canvas_common_object);
+        ~RetainedCanvas();
+    };
+    using RetainedCanvasPtr = std::shared_ptr<RetainedCanvas>;
 }
\ No newline at end of file
@@ -1,32 +1,29 @@
 #pragma once
 #include "RAdopt.h"
 #include "RAtlas.h"
+#include <array>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string_view>
 
 namespace RA {
     class Sprite_Glyph;
     using Sprite_GlyphPtr = std::shared_ptr<Sprite_Glyph>;
     struct Glyph_Key {
         const char* font;
-        wchar_t ch;
+        uint32_t ch; //unicode code point
         bool bold;
         bool italic;
         bool underline;
         bool strike;
-        Glyph_Key(const char* font, wchar_t ch, bool bold, bool italic, bool underline, bool strike) noexcept 
+        Glyph_Key(const char* font, uint32_t ch, bool bold, bool italic, bool underline, bool strike) noexcept 
             : font(font), ch(ch), bold(bold), italic(italic), underline(underline), strike(strike)  {}
         bool operator==(const Glyph_Key& d) const noexcept {
             return (font == d.font) && (ch == d.ch) && (bold == d.bold) && (italic == d.italic) && (underline == d.underline) && (strike == d.strike);
         }
 
     };
-    struct Glyph_Key_Hasher {
-        size_t operator()(const Glyph_Key& d) const noexcept {
-            return
-                std::hash<const char*>()(d.font) ^
-                std::hash<wchar_t>()(d.ch) ^
-                std::hash<int>()((d.bold ? 0 : 1) | (d.italic ? 0 : 2) | (d.underline ? 0 : 4) | (d.strike ? 0 : 8));
-        }
-    };
     struct Glyph_Data {
         Glyph_Key key;
 
@@ -37,18 +34,62 @@ namespace RA {
         Glyph_Data(const Glyph_Key& key);
     };
 
+    //interned (font, style) handle with a two-level dense table of code points.
+    //Find is lock free, so glyphs can be looked up from several threads while the atlas adds new ones
+    class Glyph_Font {
+        friend class Atlas_GlyphsSDF;
+    private:
+        static constexpr int cPageBits = 8;
+        static constexpr int cPageSize = 1 << cPageBits;
+        static constexpr int cPagesCount = (0x10FFFF >> cPageBits) + 1;
+        using Page = std::array<std::atomic<Sprite_Glyph*>, cPageSize>;
+
+        std::string m_name;
+        bool m_bold;
+        bool m_italic;
+        bool m_underline;
+        bool m_strike;
+        std::unique_ptr<std::atomic<Page*>[]> m_pages; //cPagesCount items, written under the atlas mutex
+        std::vector<std::unique_ptr<Page>> m_pages_storage;
+
+        std::once_flag m_kerning_loaded;
+        std::unordered_map<uint32_t, float> m_kerning; //key - (first << 16) | second, value - kerning at cFontSize
+
+        std::atomic<Sprite_Glyph*>* ObtainSlot(uint32_t ch);
+        void LoadKerning();
+        Glyph_Font(const char* name, bool bold, bool italic, bool underline, bool strike);
+    public:
+        inline Sprite_Glyph* Find(uint32_t ch) const {
+            uint32_t page_idx = uint32_t(ch) >> cPageBits;
+            if (page_idx >= uint32_t(cPagesCount)) return nullptr;
+            const Page* page = m_pages[page_idx].load(std::memory_order_acquire);
+            return page ? (*page)[uint32_t(ch) & (cPageSize - 1)].load(std::memory_order_acquire) : nullptr;
+        }
+        float Kerning(uint32_t first, uint32_t second);
+        const char* Name() const;
+        bool Bold() const;
+        bool Italic() const;
+        bool Underline() const;
+        bool Strike() const;
+    };
+
     class Atlas_GlyphsSDF : public BaseAtlas {
     protected:
         RA::ProgramPtr m_gen_glyph_prog;
         RA::StructuredBufferPtr m_segments_sbo;
 
-        std::vector<std::string> m_fonts;
-        std::unordered_map<Glyph_Key, Sprite_GlyphPtr, Glyph_Key_Hasher> m_sprites;
-        const char* ObtainFontPtr(const char* font);
+        std::vector<std::unique_ptr<Glyph_Font>> m_fonts;
+        std::vector<Sprite_GlyphPtr> m_sprites;
+        Sprite_Glyph* CreateSprite(Glyph_Font* font, uint32_t ch);
         void ValidateTexture() override;
     public:
         Atlas_GlyphsSDF(const DevicePtr& dev);
-        Sprite_GlyphPtr ObtainSprite(const char* font, wchar_t ch, bool bold, bool italic, bool underline, bool strike);
+        Glyph_Font* ObtainFont(const char* font, bool bold, bool italic, bool underline, bool strike);
+        inline Sprite_Glyph* ObtainSprite(Glyph_Font* font, uint32_t ch) {
+            Sprite_Glyph* res = font->Find(ch);
+            return res ? res : CreateSprite(font, ch);
+        }
+        Sprite_Glyph* ObtainSprite(const char* font, uint32_t ch, bool bold, bool italic, bool underline, bool strike);
     };
     using Atlas_GlyphsSDFPtr = std::shared_ptr<Atlas_GlyphsSDF>;
 
@@ -58,8 +99,8 @@ namespace RA {
         Glyph_Data m_data;
         Sprite_Glyph(BaseAtlas* owner, Glyph_Data data);
     public:
-        glm::vec3 XXXMetricsScaled(float font_size);
-        glm::vec4 YYYYMetricsScaled(float font_size);
+        glm::vec3 XXXMetricsScaled(float font_size) const;
+        glm::vec4 YYYYMetricsScaled(float font_size) const;
     };
 
     struct TextGlyphVertex {
@@ -85,6 +126,7 @@ namespace RA {
         virtual int LinesCount() const = 0;
         virtual glm::vec2 LineBounds(const int line_idx) const = 0;
         virtual glm::ivec2 LineGlyphs(const int line_idx) const = 0;
+        virtual float LineYPos(const int line_idx) const = 0; //bottom of the line
         virtual float MaxLineWidth() const = 0;
         virtual float TotalHeight() const = 0;
         virtual const std::vector<TextGlyphVertex>& AllGlyphs() const = 0;
@@ -104,6 +146,10 @@ namespace RA {
         bool italic = false;
         bool underline = false;
         bool striked = false;
+        bool operator==(const FontParams& p) const {
+            return (name == p.name) && (color == p.color) && (size == p.size) && (sdf_offset == p.sdf_offset) &&
+                   (bold == p.bold) && (italic == p.italic) && (underline == p.underline) && (striked == p.striked);
+        }
     };
 
     class ITextBuilder {
@@ -118,14 +164,23 @@ namespace RA {
         virtual void Font_SetStyle(bool bold, bool italic, bool underline, bool strikeout) = 0;
 
         virtual void SetLineAlign(LineAlign la) = 0;        
+        virtual void SetKerning(bool enable) = 0;
+        //reorders right-to-left words of wrapped text, base direction stays left-to-right
+        virtual void SetBidi(bool enable) = 0;
 
+        //wide strings are utf-16 on windows (surrogate pairs are joined), std::string_view overloads take utf-8
         virtual void WriteSpace(float space) = 0;
-        virtual void Write(const std::wstring& str) = 0;
-        virtual void WriteLine(const std::wstring& str) = 0;
-        virtual void WriteMultiline(const std::wstring& str) = 0;
-        virtual void WriteWrapped(const std::wstring& str) = 0;
+        virtual void Write(std::wstring_view str) = 0;
+        virtual void Write(std::string_view str) = 0;
+        virtual void WriteLine(std::wstring_view str) = 0;
+        virtual void WriteLine(std::string_view str) = 0;
+        virtual void WriteMultiline(std::wstring_view str) = 0;
+        virtual void WriteMultiline(std::string_view str) = 0;
+        virtual void WriteWrapped(std::wstring_view str) = 0;
+        virtual void WriteWrapped(std::string_view str) = 0;
         virtual void WriteWrappedEnd(float max_width, bool justify_align = false, float first_row_offset = 0, float next_row_offset = 0) = 0;
-        virtual void WriteWrappedMultiline(const std::wstring& str, float max_width, bool justify_align = false, float first_row_offset = 0, float next_row_offset = 0) = 0;
+        virtual void WriteWrappedMultiline(std::wstring_view str, float max_width, bool justify_align = false, float first_row_offset = 0, float next_row_offset = 0) = 0;
+        virtual void WriteWrappedMultiline(std::string_view str, float max_width, bool justify_align = false, float first_row_offset = 0, float next_row_offset = 0) = 0;
 
         virtual ITextLinesPtr Finish() = 0;
 
@@ -134,6 +189,89 @@ namespace RA {
     using ITextBuilderPtr = std::shared_ptr<ITextBuilder>;
 
     ITextBuilderPtr Create_TextBuilder(Atlas_GlyphsSDF* atlas);
+    //words as WriteWrapped lays them out: x - offset in str (code units), y - length, z - spaces after the word
+    void SplitWrappedWords(std::wstring_view str, std::vector<glm::ivec3>& words);
+    void SplitWrappedWords(std::string_view str, std::vector<glm::ivec3>& words);
+
+    //LRU cache of finished layouts. Glyphs and lines are shared between callers, every Obtain
+    //returns its own view of them, so bounds and valign of one caller don't affect another
+    class TextLayoutCache {
+    private:
+        struct Entry {
+            uint32_t hash;
+            std::wstring str;
+            FontParams font;
+            float max_width;
+            LineAlign align;
+            bool justify_align;
+            std::shared_ptr<const ITextLines> lines;
+        };
+    private:
+        ITextBuilderPtr m_tb;
+        size_t m_max_entries;
+        std::list<Entry> m_lru;
+        std::unordered_multimap<uint32_t, std::list<Entry>::iterator> m_entries;
+        static uint32_t Hash(std::wstring_view str, const FontParams& font, float max_width, LineAlign align, bool justify_align);
+    public:
+        //max_width <= 0 lays out str as WriteMultiline, otherwise as WriteWrappedMultiline
+        ITextLinesPtr Obtain(std::wstring_view str, const FontParams& font, float max_width = 0, LineAlign align = LineAlign::Left, bool justify_align = false);
+        void Clear();
+        TextLayoutCache(Atlas_GlyphsSDF* atlas, size_t max_entries = 512);
+    };
+    using TextLayoutCachePtr = std::shared_ptr<TextLayoutCache>;
+
+    //append-only text with a lot of lines (logs, consoles). Lines are laid out lazily in chunks,
+    //chunk y-offsets are indexed so the visible range is found with a binary search, 
+    //and only a limited number of chunk layouts is kept alive
+    class VirtualTextLines {
+    public:
+        struct Span {
+            const ITextLines* lines;
+            float ypos;          //top of the chunk in text coordinates
+            glm::ivec2 glyphs;   //x - first glyph, y - glyphs count
+        };
+    private:
+        static const int cChunkLines = 256;
+        struct Chunk {
+            int first_line;
+            int lines_count;
+            float height;
+            bool measured;       //height is exact if layout was done since the last append, estimated otherwise
+            uint64_t last_used;
+            ITextLinesPtr layout;
+        };
+    private:
+        ITextBuilderPtr m_tb;
+        FontParams m_font;
+        float m_max_width;
+        LineAlign m_align;
+        int m_max_layouts;
+
+        std::wstring m_text;
+        std::vector<size_t> m_line_starts;
+        std::vector<Chunk> m_chunks;
+        std::vector<float> m_chunk_ypos; //top of every chunk, last item is the total height
+        bool m_index_valid;
+        float m_line_height;             //estimation for chunks without layout
+        uint64_t m_frame;
+        int m_layouts_count;
+        std::vector<Span> m_visible;
+
+        std::wstring_view Line(int idx) const;
+        void LayoutChunk(Chunk& chunk);
+        void ValidateIndex();
+        void EvictLayouts();
+    public:
+        void AppendLine(std::wstring_view line);
+        void Clear();
+        int LinesCount() const;
+        float MaxWidth() const;
+        float TotalHeight();
+        //lays out chunks intersecting [y_min, y_max] if needed and returns glyph ranges of visible lines
+        const std::vector<Span>& Visible(float y_min, float y_max);
+        VirtualTextLines(Atlas_GlyphsSDF* atlas, const FontParams& font, float max_width = 0, LineAlign align = LineAlign::Left, int max_layouts = 16);
+    };
+    using VirtualTextLinesPtr = std::shared_ptr<VirtualTextLines>;
 
     void RegisterFont(const std::filesystem::path& fname);
 }
\ No newline at end of file
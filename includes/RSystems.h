@@ -55,6 +55,7 @@ namespace RA {
         MemRangeIntfPtr m_materials;
 
         std::vector<MCMeshMaterialVertex> m_materials_data;
+        uint32_t m_sort_id; //low bits of the draw sort key, albedo id << 16 | mesh id
 
         RA::UPtr<Octree> m_octree;
     public:
@@ -74,9 +75,37 @@ namespace RA {
     };
     using MCMeshPtr = std::shared_ptr<MCMesh>;
 
+    //first three rows of an affine transform, world = float3(dot(row0, p), dot(row1, p), dot(row2, p)) for p = float4(pos, 1)
+    struct MCAffine {
+        glm::vec4 row0;
+        glm::vec4 row1;
+        glm::vec4 row2;
+        static MCAffine Pack(const glm::mat4& m);
+        glm::mat4 Unpack() const;
+    };
+    //half precision rotation and scale, translation stays in floats. 
+    //world = float3(dot(row0.xyz, pos), dot(row1.xyz, pos), dot(row2.xyz, pos)) + translation
+    struct MCAffineHalf {
+        glm::u16vec4 row0; //w is unused
+        glm::u16vec4 row1;
+        glm::u16vec4 row2;
+        glm::vec3 translation;
+        static MCAffineHalf Pack(const glm::mat4& m);
+        glm::mat4 Unpack() const;
+    };
+
+    //bind transforms are shared by instances and stored in MeshCollectionBuffers::bind_transforms as MCAffine
     struct MCMeshInstanceVertex {
-        glm::mat4 bind_transform;
-        glm::mat4 transform;
+        MCAffine transform;  //trow0_, trow1_, trow2_
+        int32_t bind_idx;
+        int32_t materials_offset;
+        int32_t bone_offset;
+        int32_t bone_remap_offset;
+        static const Layout* Layout();
+    };
+    struct MCMeshInstanceVertexHalf {
+        MCAffineHalf transform; //trow0_, trow1_, trow2_ as half4, tpos_
+        int32_t bind_idx;
         int32_t materials_offset;
         int32_t bone_offset;
         int32_t bone_remap_offset;
@@ -97,6 +126,7 @@ namespace RA {
         uint32_t m_group_id;
 
         void UpdateInstanceVertex();
+        uint64_t DrawSortKey() const;
     public:
         void* user_data = nullptr;
 
@@ -126,10 +156,30 @@ namespace RA {
         const VertexBufferPtr* instances;
         const StructuredBufferPtr* bones;
         const StructuredBufferPtr* bones_remap;
+        const StructuredBufferPtr* bind_transforms;
+    };
+
+    //run of instances with the same key and consecutive instance indices
+    struct MCDrawSortItem {
+        uint64_t key; //group id << 32 | albedo id << 16 | mesh id
+        uint32_t first_instance;
+        uint32_t instances_count;
+    };
+
+    struct MeshCollectionDrawBatch {
+        uint32_t group_id;
+        Texture2DPtr albedo;
+        int first_command;
+        int commands_count;
     };
 
+    //rebuilt by every MeshCollection::PrepareBuffers call. Commands are sorted by group, albedo and mesh, 
+    //instances of one mesh with consecutive instance indices are merged into one instanced command
     struct MeshCollectionDrawCommands {
-        std::unordered_map<uint32_t, std::unordered_map<Texture2DPtr, std::vector<DrawIndexedCmd>>> commands;
+        std::vector<DrawIndexedCmd> commands;
+        std::vector<MeshCollectionDrawBatch> batches; //runs of commands with the same group and albedo
+        std::vector<MCDrawSortItem> sort_items;       //scratch, kept to avoid allocations between frames
+        std::vector<MCDrawSortItem> sort_tmp;
     };
 
     class MeshCollection {
@@ -161,13 +211,37 @@ namespace RA {
         RangeManagerIntfPtr m_mesh_matbuf_ranges;
 
         std::vector<MCMeshInstance*> m_instances;
+        //instance data by MCMeshInstance::m_idx, dirty instances are packed into m_inst_vbuf with one upload
+        std::vector<glm::mat4> m_inst_transforms;
+        std::vector<glm::ivec4> m_inst_offsets; //x - bind transform, y - materials, z - bones, w - bones remap
+        std::vector<uint64_t> m_inst_dirty;     //bit per instance
+        bool m_inst_vbuf_valid;                 //false if m_inst_vbuf has to be recreated
+        bool m_half_instances;
+        std::vector<char> m_inst_staging;
         VertexBufferPtr m_inst_vbuf;
+
+        //distinct bind transforms with reference counts, instances of an armature share one
+        struct BindTransform {
+            glm::mat4 m;
+            int refs;
+        };
+        std::vector<BindTransform> m_bind_transforms;
+        std::unordered_map<glm::mat4, int> m_bind_lookup;
+        std::vector<int> m_bind_free;
+        bool m_bind_buf_valid;
+        StructuredBufferPtr m_bind_buf;
         StructuredBufferPtr m_bone_remap;
         RangeManagerIntfPtr m_bone_remap_ranges;
 
         RA::Texture2DPtr m_tex_white_pixel;
         std::unordered_map<std::filesystem::path, RA::Texture2DPtr> m_maps;
 
+        //dense ids for draw sort keys, textures are cached in m_maps and never released
+        std::unordered_map<Texture2D*, uint32_t> m_sort_tex_ids;
+        std::vector<RA::Texture2DPtr> m_sort_textures;
+        std::vector<uint32_t> m_sort_mesh_free;
+        uint32_t m_sort_mesh_next;
+
         std::unordered_map<fs::path, std::unique_ptr<AVMScene>, path_hasher> m_cache;
         AVMScene* ObtainScene(const fs::path& filename);
 
@@ -175,24 +249,38 @@ namespace RA {
 
         MCMeshInstancePtr Clone_MeshInstance(AVMScene* scene, const std::string& instance_name);
         void ValidateArmatures();
+        void AddInstance(MCMeshInstance* inst);
+        void RemoveInstance(MCMeshInstance* inst);
+        void MarkInstanceDirty(int idx);
+        void ValidateInstances();
+        int AcquireBindTransform(const glm::mat4& m);
+        void ReleaseBindTransform(int idx);
+        void ValidateBindTransforms();
         void FillBuffers(MeshCollectionBuffers* bufs);
         RA::Texture2DPtr ObtainTexture(const std::filesystem::path& path, bool srgb);
         DrawIndexedCmd GetDrawCommand(MCMeshInstance* inst);
+        uint32_t AcquireMeshSortID(const Texture2DPtr& albedo);
+        void ReleaseMeshSortID(uint32_t sort_id);
+        void BuildDrawCommands(MeshCollectionDrawCommands* draw_commands);
     public:
         float HitTest(const glm::Ray& ray, MCMeshInstance*& hit_inst);
 
-        DrawIndexedCmd GetDrawCommand(MCMeshInstance* inst, Texture2DPtr& albedo);
-
         void PrepareBuffers(MeshCollectionBuffers* bufs, MeshCollectionDrawCommands* draw_commands);
         void PrepareBuffers(const std::vector<MCMeshInstance*>& instances, MeshCollectionBuffers* bufs, MeshCollectionDrawCommands* draw_commands);
         void PrepareBuffers(const std::vector<MCMeshInstancePtr>& instances, MeshCollectionBuffers* bufs, MeshCollectionDrawCommands* draw_commands);
 
+        //same as SetTransform on every instance, instances have to belong to this collection
+        void SetTransforms(MCMeshInstance* const* instances, const glm::mat4* transforms, int count);
+
         MCArmaturePtr Create_Armature(const fs::path& filename, const std::string& armature_name);
         MCMeshInstancePtr Clone_MeshInstance(const fs::path& filename, const std::string& instance_name);
         std::vector<MCMeshInstancePtr> Clone_MeshInstances(const fs::path& filename, const std::vector<std::string>& instances, uint32_t groupID);
         void AllMeshInstances(const fs::path& filename, const std::function<void(std::string)>& cb);
 
-        MeshCollection(const DevicePtr& dev);
+        const Layout* InstanceLayout() const;
+
+        //half_instances stores instance transforms as MCMeshInstanceVertexHalf
+        MeshCollection(const DevicePtr& dev, bool half_instances = false);
         ~MeshCollection();
     };
 
@@ -2,8 +2,10 @@
 #include "RAdopt.h"
 #include "GLM.h"
 #include "GLMUtils.h"
+#include <deque>
 #include <filesystem>
 #include <string>
+#include <string_view>
 
 namespace RA {
     enum class FrustumPlane {Top, Bottom, Right, Left, Near, Far};
@@ -154,15 +156,38 @@ namespace RA {
         virtual ~MemRangeIntf() {};
     };
     using MemRangeIntfPtr = std::unique_ptr<MemRangeIntf>;
+    struct RangeManagerStats {
+        int free_chunks;     //the free tail included
+        int largest_free;
+        int used_end;        //end of the last allocated range
+        int holes;           //free space below used_end
+        float fragmentation; //1 - largest_free / free space, 0 if the free space is one chunk
+        int padding;         //allocated space lost to alignment
+    };
+    enum class RangeFit {
+        Good,  //O(1), the block found can be larger than the best one
+        Best,  //smallest fitting block, scans free lists of one size class
+        First, //fitting block with the lowest offset, scans all blocks
+    };
+    //called for every range moved by Defrag. The range already has the new offset, 
+    //new and old places can overlap, so data has to be moved as with memmove
+    using RangeRelocatedCallback = std::function<void(const MemRangeIntf* range, int old_offset)>;
     class RangeManagerIntf {
     public:
-        virtual MemRangeIntfPtr Alloc(int size) = 0;
+        //offset of the range is a multiple of align, padding below it stays allocated with the range
+        virtual MemRangeIntfPtr Alloc(int size, int align = 1, RangeFit fit = RangeFit::Good) = 0;
         virtual int Size() const = 0;
         virtual int Allocated() const = 0;
         virtual int FreeSpace() const = 0;
+        virtual RangeManagerStats Stats() const = 0;
 
         virtual void AddSpace(int new_space) = 0;
-        //virtual void Defrag() = 0;
+        //shrinks the free space after the last range by up to space units, returns the removed space
+        virtual int RemoveSpace(int space) = 0;
+        //moves ranges down into the lowest holes until about budget units are moved (at least one range is moved).
+        //Ranges keep their alignment. Returns true when there are no holes left below the last range
+        virtual bool Defrag(int budget, const RangeRelocatedCallback& relocated) = 0;
+        virtual ~RangeManagerIntf() {};
     };
     using RangeManagerIntfPtr = std::unique_ptr<RangeManagerIntf>;
     RangeManagerIntfPtr Create_RangeManager(int size);
@@ -173,16 +198,14 @@ namespace RA {
         friend class ManagedSBO;
     private:
         ManagedSBO* m_sbo;
-        uint32_t m_idx;
         MemRangeIntfPtr m_range;
-        std::vector<char> m_data;
-        void UpdateSBOData();
     public:
+        //offset can change after ManagedSBO::Trim
         int Offset() const;
         int Size() const;
+        //data is uploaded with the next ManagedSBO::Buffer call
         void SetData(const void* data);
         ManagedSBO_Range(ManagedSBO* owner, MemRangeIntfPtr range);
-        ~ManagedSBO_Range();
     };
     using ManagedSBO_RangePtr = std::unique_ptr<ManagedSBO_Range>;
 
@@ -190,26 +213,138 @@ namespace RA {
         friend class ManagedSBO_Range;
     private:
         RangeManagerIntfPtr m_man;
+        int m_min_size;
         StructuredBufferPtr m_buffer;
-        std::vector<ManagedSBO_Range*> m_ranges;
+        std::vector<char> m_shadow;        //cpu copy of the whole buffer, ranges are stored at their offsets
+        std::vector<glm::ivec2> m_dirty;   //x - offset, y - size in vertices
         bool m_buffer_valid;
         void ValidateBuffer();
+        void FlushDirty();
     public:
         ManagedSBO_RangePtr Alloc(int vertex_count);
+        //uploads ranges changed since the last call, close ranges are uploaded with a single call
         StructuredBufferPtr Buffer();
+        int Capacity() const;
+        int Allocated() const;
+        float Utilization() const;
+        //compacts ranges and shrinks the buffer to the next power of two if utilization is below min_utilization.
+        //Returns true if the buffer was shrunk
+        bool Trim(float min_utilization = 0.25f);
         ManagedSBO(const DevicePtr& dev, int stride_size);
     };
 
     class ManagedTexSlices {
     private:
         RangeManagerIntfPtr m_man;
+        int m_min_size;
         Texture2DPtr m_tex;
     public:
+        //the texture content is lost if tex_reallocated is set, all slices have to be uploaded again
         MemRangeIntfPtr Alloc(int slices_count, bool* tex_reallocated);
         Texture2DPtr Texture();
+        int Capacity() const;
+        int Allocated() const;
+        float Utilization() const;
+        //compacts ranges and shrinks the texture as ManagedSBO::Trim. If true is returned offsets 
+        //of ranges have changed and all slices have to be uploaded again
+        bool Trim(float min_utilization = 0.25f);
         ManagedTexSlices(const DevicePtr& dev, TextureFmt fmt, const glm::ivec2& tex_size);
     };
 
+    //buffer FrameRingBuffer writes to, capacity and offsets are in elements
+    class FrameRingStorage {
+    public:
+        virtual int Stride() const = 0;
+        virtual int Capacity() const = 0;
+        //discard = false promises that the mapped elements are not in use
+        virtual void* Map(int offset, int count, bool discard) = 0;
+        virtual void Unmap() = 0;
+        virtual ~FrameRingStorage() {};
+    };
+    using FrameRingStoragePtr = std::shared_ptr<FrameRingStorage>;
+    using FrameRingStorageFactory = std::function<FrameRingStoragePtr(int capacity)>;
+
+    class FrameRingStorage_VB : public FrameRingStorage {
+    private:
+        VertexBufferPtr m_buf;
+    public:
+        int Stride() const override;
+        int Capacity() const override;
+        void* Map(int offset, int count, bool discard) override;
+        void Unmap() override;
+        const VertexBufferPtr& Buffer() const;
+        FrameRingStorage_VB(const DevicePtr& dev, const Layout* layout, int capacity);
+        static FrameRingStorageFactory Factory(const DevicePtr& dev, const Layout* layout);
+    };
+    class FrameRingStorage_SBO : public FrameRingStorage {
+    private:
+        StructuredBufferPtr m_buf;
+    public:
+        int Stride() const override;
+        int Capacity() const override;
+        void* Map(int offset, int count, bool discard) override;
+        void Unmap() override;
+        const StructuredBufferPtr& Buffer() const;
+        FrameRingStorage_SBO(const DevicePtr& dev, int stride, int capacity);
+        static FrameRingStorageFactory Factory(const DevicePtr& dev, int stride);
+    };
+    //cpu memory, for tools and tests without a device
+    class FrameRingStorage_CPU : public FrameRingStorage {
+    private:
+        int m_stride;
+        std::vector<char> m_data;
+    public:
+        int Stride() const override;
+        int Capacity() const override;
+        void* Map(int offset, int count, bool discard) override;
+        void Unmap() override;
+        const void* Data() const;
+        FrameRingStorage_CPU(int stride, int capacity);
+        static FrameRingStorageFactory Factory(int stride);
+    };
+
+    struct FrameRingRange {
+        FrameRingStorage* storage; //storage to bind, it's kept alive while the range is valid
+        int offset;
+    };
+
+    //sub-allocates transient data from one persistent buffer. Data written in a frame stays untouched
+    //until frames_in_flight more frames are ended, so it's written with no-overwrite maps.
+    //If the buffer is full it's replaced with a twice larger one, previous storages live while their frames are in flight
+    class FrameRingBuffer {
+    private:
+        struct Frame {
+            int size = 0; //elements taken in m_storage, wrap padding included
+            std::vector<FrameRingStoragePtr> retired;
+        };
+    private:
+        FrameRingStorageFactory m_factory;
+        FrameRingStoragePtr m_storage;
+        int m_frames_in_flight;
+        int m_head;
+        int m_tail;
+        int m_used;
+        bool m_fresh; //storage wasn't mapped yet
+        Frame m_frame;
+        std::deque<Frame> m_frames;
+        int m_frame_pushed;
+        int m_peak;
+        int Reserve(int count);
+    public:
+        void* Map(int count, FrameRingRange* range);
+        void Unmap();
+        FrameRingRange Push(const void* data, int count);
+        //ranges of the frames_in_flight-th previous frame are released
+        void EndFrame();
+
+        FrameRingStorage* Storage();
+        int Capacity() const;
+        int Used() const;
+        int PeakFrameUsage() const; //max elements pushed in a frame
+        FrameRingBuffer(const FrameRingStorageFactory& factory, int capacity = 4096, int frames_in_flight = 3);
+    };
+    using FrameRingBufferPtr = std::shared_ptr<FrameRingBuffer>;
+
     class QPC {
     private:
         uint64_t m_start;
@@ -382,6 +517,37 @@ namespace RA {
         }
     };
 
-    std::wstring UTF8ToWString(const std::string& utf8);
-    std::string WStringToUTF8(const std::wstring& wstr);
+    //decodes the code point starting at s[i] and moves i past it, malformed input gives U+FFFD
+    inline uint32_t NextCodePoint(std::string_view s, size_t& i) {
+        uint32_t c = uint8_t(s[i++]);
+        if (c < 0x80) return c;
+        int tail;
+        uint32_t min_cp;
+        if ((c & 0xE0) == 0xC0) { tail = 1; c &= 0x1F; min_cp = 0x80; }
+        else if ((c & 0xF0) == 0xE0) { tail = 2; c &= 0x0F; min_cp = 0x800; }
+        else if ((c & 0xF8) == 0xF0) { tail = 3; c &= 0x07; min_cp = 0x10000; }
+        else return 0xFFFD;
+        for (int k = 0; k < tail; k++) {
+            if ((i >= s.size()) || ((uint8_t(s[i]) & 0xC0) != 0x80)) return 0xFFFD;
+            c = (c << 6) | (uint8_t(s[i++]) & 0x3F);
+        }
+        if ((c < min_cp) || (c > 0x10FFFF) || ((c >= 0xD800) && (c <= 0xDFFF))) return 0xFFFD;
+        return c;
+    }
+    //joins utf-16 surrogate pairs when wchar_t is 16 bit, unpaired surrogates give U+FFFD
+    inline uint32_t NextCodePoint(std::wstring_view s, size_t& i) {
+        uint32_t c = uint32_t(s[i++]);
+        if constexpr (sizeof(wchar_t) == 2) {
+            if ((c >= 0xD800) && (c <= 0xDBFF)) {
+                if ((i < s.size()) && (uint32_t(s[i]) >= 0xDC00) && (uint32_t(s[i]) <= 0xDFFF))
+                    return 0x10000 + ((c - 0xD800) << 10) + (uint32_t(s[i++]) - 0xDC00);
+                return 0xFFFD;
+            }
+            if ((c >= 0xDC00) && (c <= 0xDFFF)) return 0xFFFD;
+        }
+        return c;
+    }
+
+    std::wstring UTF8ToWString(std::string_view utf8);
+    std::string WStringToUTF8(std::wstring_view wstr);
 }
\ No newline at end of file
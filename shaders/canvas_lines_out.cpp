@@ -3,9 +3,9 @@
 
 struct VS_Input {
     float4 S_(coords);
-    float4 S_(normals);
+    float4 S_(normals); //unorm16, offsets per unit of width in [-cMiterLimit, cMiterLimit]
     float4 S_(color);
-    float2 S_(width);
+    float  S_(width);
     float  S_(hinting);
     uint S_VertexID(vid);
 };
@@ -21,11 +21,13 @@ struct VS_Output {
 };
 
 static const float2 quad[4] = {{0,0}, {0,1}, {1,0}, {1,1}};
+static const float cMiterLimit = 4.0;
 
 VS_Output VS(VS_Input In) {
     float end_k = In.vid >= 2;
     float2 crd = lerp(In.coords.xy, In.coords.zw, end_k);
-    float2 n = lerp(In.normals.xy, In.normals.zw, end_k);
+    float4 normals = (In.normals * 2.0 - 1.0) * cMiterLimit;
+    float2 n = lerp(normals.xy, normals.zw, end_k);
 
     VS_Output res;    
     res.color = In.color;
@@ -37,7 +39,7 @@ VS_Output VS(VS_Input In) {
     float2 offset2d = mul(transform_2d, float4(crd, 0.0, 1.0)).xy;
     res.pos.xy += float2(offset2d.x, -offset2d.y);
     if (In.hinting) res.pos.xy = round(res.pos.xy);    
-    res.pos.xy += n * (In.vid % 2) * In.width.x * dpi_scale;
+    res.pos.xy += n * (In.vid % 2) * In.width * dpi_scale;
     res.pos.xy *= view_pixel_size;
     res.pos.xy *= res.pos.w;
 
@@ -5,8 +5,7 @@ struct VS_Input {
     float2 S_(coord);
     float2 S_(texcoord);
     float4 S_(color);
-    float S_(hinting);
-    uint S_(sprite_idx);
+    uint S_(sprite_idx); //high bit - hinting
 };
 
 struct AtlasSprite {
@@ -31,8 +30,10 @@ struct VS_Output {
 VS_Output VS(VS_Input In) {    
     AtlasSprite sprite;
     
-    if (In.sprite_idx != 0xffffffff) {
-        sprite = sprites_data[In.sprite_idx];
+    uint sprite_idx = In.sprite_idx & 0x7fffffff;
+    bool hinting = (In.sprite_idx & 0x80000000) != 0;
+    if (sprite_idx != 0x7fffffff) {
+        sprite = sprites_data[sprite_idx];
     } else {
         sprite.slice = -1;
         sprite.size = 1;
@@ -48,7 +49,7 @@ VS_Output VS(VS_Input In) {
     res.pos.xy /= view_pixel_size;
     float2 offset2d = mul(transform_2d, float4(In.coord.x, In.coord.y, 0.0, 1.0)).xy;
     res.pos.xy += float2(offset2d.x, -offset2d.y);
-    if (In.hinting) res.pos.xy = round(res.pos.xy);
+    if (hinting) res.pos.xy = round(res.pos.xy);
     res.pos.xy *= view_pixel_size;
     res.pos.xy *= res.pos.w;
 
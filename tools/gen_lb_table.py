@@ -0,0 +1,92 @@
+# Prints cLBRanges of RFonts.cpp (UAX #14 line break classes used by WriteWrapped).
+# The table is hand-maintained: SPEC below is a subset of LineBreak.txt from Unicode 15.0,
+# simplified to the classes RFonts knows (e.g. whole CJK blocks are ID, small kana are NS).
+# Edit SPEC and run:
+#   python tools/gen_lb_table.py           - print the table
+#   python tools/gen_lb_table.py --check   - check that RFonts.cpp has the same table
+import os
+import sys
+
+# (first, last, class), later entries override earlier ones, everything missing is AL
+SPEC = [
+ (0x0300,0x036F,'CM'),(0x0483,0x0489,'CM'),(0x0591,0x05BD,'CM'),(0x05BF,0x05BF,'CM'),(0x05C1,0x05C2,'CM'),
+ (0x0610,0x061A,'CM'),(0x064B,0x065F,'CM'),(0x0670,0x0670,'CM'),(0x06D6,0x06DC,'CM'),(0x06DF,0x06E4,'CM'),
+ (0x00A0,0x00A0,'GL'),(0x00AB,0x00AB,'QU'),(0x00AD,0x00AD,'BA'),(0x00BB,0x00BB,'QU'),(0x00BF,0x00BF,'OP'),(0x00A1,0x00A1,'OP'),
+ (0x0F0C,0x0F0C,'GL'),
+ (0x1100,0x115F,'ID'),(0x1160,0x11FF,'CM'),
+ (0x1680,0x1680,'BA'),
+ (0x2000,0x2006,'BA'),(0x2007,0x2007,'GL'),(0x2008,0x200A,'BA'),(0x200B,0x200B,'ZW'),(0x200C,0x200F,'CM'),
+ (0x2010,0x2010,'BA'),(0x2011,0x2011,'GL'),(0x2012,0x2014,'BA'),
+ (0x2018,0x2019,'QU'),(0x201C,0x201D,'QU'),(0x2024,0x2026,'NS'),(0x2027,0x2027,'BA'),(0x202F,0x202F,'GL'),
+ (0x203C,0x203D,'NS'),(0x2047,0x2049,'NS'),(0x2060,0x2060,'WJ'),
+ (0x20D0,0x20F0,'CM'),
+ (0x2E80,0x2FFF,'ID'),(0x3000,0x3000,'BA'),(0x3001,0x3002,'CL'),(0x3003,0x3004,'ID'),(0x3005,0x3005,'NS'),(0x3006,0x3007,'ID'),
+ (0x3008,0x3008,'OP'),(0x3009,0x3009,'CL'),(0x300A,0x300A,'OP'),(0x300B,0x300B,'CL'),(0x300C,0x300C,'OP'),(0x300D,0x300D,'CL'),
+ (0x300E,0x300E,'OP'),(0x300F,0x300F,'CL'),(0x3010,0x3010,'OP'),(0x3011,0x3011,'CL'),(0x3012,0x3013,'ID'),
+ (0x3014,0x3014,'OP'),(0x3015,0x3015,'CL'),(0x3016,0x3016,'OP'),(0x3017,0x3017,'CL'),(0x3018,0x3018,'OP'),(0x3019,0x3019,'CL'),
+ (0x301A,0x301A,'OP'),(0x301B,0x301B,'CL'),(0x301C,0x301C,'NS'),(0x301D,0x301D,'OP'),(0x301E,0x301F,'CL'),
+ (0x3020,0x303F,'ID'),(0x303B,0x303C,'NS'),
+ (0x3040,0x30FF,'ID'),
+ (0x3041,0x3041,'NS'),(0x3043,0x3043,'NS'),(0x3045,0x3045,'NS'),(0x3047,0x3047,'NS'),(0x3049,0x3049,'NS'),(0x3063,0x3063,'NS'),
+ (0x3083,0x3083,'NS'),(0x3085,0x3085,'NS'),(0x3087,0x3087,'NS'),(0x308E,0x308E,'NS'),(0x3095,0x3096,'NS'),
+ (0x3099,0x309A,'CM'),(0x309B,0x309E,'NS'),(0x30A0,0x30A0,'NS'),
+ (0x30A1,0x30A1,'NS'),(0x30A3,0x30A3,'NS'),(0x30A5,0x30A5,'NS'),(0x30A7,0x30A7,'NS'),(0x30A9,0x30A9,'NS'),(0x30C3,0x30C3,'NS'),
+ (0x30E3,0x30E3,'NS'),(0x30E5,0x30E5,'NS'),(0x30E7,0x30E7,'NS'),(0x30EE,0x30EE,'NS'),(0x30F5,0x30F6,'NS'),(0x30FB,0x30FE,'NS'),
+ (0x3100,0x31EF,'ID'),(0x31F0,0x31FF,'NS'),(0x3200,0x4DBF,'ID'),(0x4E00,0x9FFF,'ID'),(0xA000,0xA4CF,'ID'),
+ (0xAC00,0xD7A3,'ID'),(0xF900,0xFAFF,'ID'),
+ (0xFE30,0xFE4F,'ID'),(0xFE50,0xFE50,'CL'),(0xFE52,0xFE52,'CL'),
+ (0xFEFF,0xFEFF,'WJ'),
+ (0xFF01,0xFF60,'ID'),(0xFF01,0xFF01,'EX'),(0xFF08,0xFF08,'OP'),(0xFF09,0xFF09,'CL'),(0xFF0C,0xFF0C,'CL'),(0xFF0E,0xFF0E,'CL'),
+ (0xFF1A,0xFF1B,'NS'),(0xFF1F,0xFF1F,'EX'),(0xFF3B,0xFF3B,'OP'),(0xFF3D,0xFF3D,'CL'),(0xFF5B,0xFF5B,'OP'),(0xFF5D,0xFF5D,'CL'),
+ (0xFF5F,0xFF5F,'OP'),(0xFF60,0xFF60,'CL'),
+ (0xFF61,0xFF61,'CL'),(0xFF62,0xFF62,'OP'),(0xFF63,0xFF64,'CL'),(0xFF65,0xFF65,'NS'),(0xFF66,0xFF9F,'ID'),(0xFF9E,0xFF9F,'NS'),
+ (0xFFE0,0xFFE6,'ID'),
+ (0x1B000,0x1B2FF,'ID'),(0x1F000,0x1FAFF,'ID'),(0x1F3FB,0x1F3FF,'CM'),(0x20000,0x3FFFD,'ID'),
+ (0xE0001,0xE007F,'CM'),(0xE0100,0xE01EF,'CM'),(0xFE00,0xFE0F,'CM'),
+]
+
+
+def build_ranges():
+    cls = {}
+    for first, last, c in SPEC:
+        for cp in range(first, last + 1):
+            cls[cp] = c
+    ranges = []
+    for cp in sorted(cls):
+        c = cls[cp]
+        if ranges and ranges[-1][1] == cp - 1 and ranges[-1][2] == c:
+            ranges[-1][1] = cp
+        else:
+            ranges.append([cp, cp, c])
+    return ranges
+
+def format_table(ranges):
+    lines = []
+    cur = ''
+    for first, last, c in ranges:
+        item = '{ 0x%04X, 0x%04X, LB::%s },' % (first, last, c)
+        if len(cur) + len(item) + 1 > 150:
+            lines.append(cur.rstrip())
+            cur = ''
+        cur += item + ' '
+    lines.append(cur.rstrip().rstrip(','))
+    return ''.join('        ' + l + '\n' for l in lines)
+
+def main():
+    table = format_table(build_ranges())
+    if '--check' not in sys.argv:
+        sys.stdout.write(table)
+        return 0
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'RFonts.cpp')
+    with open(path, newline='') as f:
+        src = f.read()
+    start = src.index('static const LBRange cLBRanges[] = {\n') + len('static const LBRange cLBRanges[] = {\n')
+    end = src.index('    };\n', start)
+    if src[start:end] != table:
+        print('cLBRanges in RFonts.cpp differs from SPEC')
+        return 1
+    print('cLBRanges is up to date')
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())